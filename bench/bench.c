@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+// helpers shared by the benches, tcpm-bench itself is in main.c
+
+uint64_t
+benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void
+benchWait(atomic_uint_fast64_t* counter, uint64_t target) {
+    struct timespec ts  = { .tv_sec = 0, .tv_nsec = 50000 };
+    while( atomic_load(counter) < target ) {
+        nanosleep(&ts, NULL);
+    }
+}
+
+// retry until delivered, only for mailboxes that cannot stay full: a failure
+// here is another sender holding the destination lock
+uint64_t
+benchSend(PID dest, void* msg) {
+    uint64_t    failures    = 0;
+    SendResult  res;
+    while( (res = Process_sendMessage(dest, msg, MA_KEEP)) == SEND_FAIL ) {
+        ++failures;
+        sched_yield();
+    }
+    return failures;
+}
+
+PID
+benchSpawn(ProcessQueue* dq, ProcessHandler handler, void* state, uint32_t messageCap, ProcessReleaseState releaseState) {
+    PID     pid     = { 0 };
+    while( pid.pq == NULL ) {
+        ProcessSpawnParameters  sp  = { 0 };
+        sp.handler              = handler;
+        sp.initialState         = state;
+        sp.messageCap           = messageCap;
+        sp.maxMessagePerCycle   = messageCap;
+        sp.releaseState         = releaseState;
+        pid = ProcessQueue_spawn(dq, &sp);
+        if( pid.pq == NULL ) {
+            sched_yield();
+        }
+    }
+    return pid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Result tables
+////////////////////////////////////////////////////////////////////////////////
+
+void
+benchTableBegin(BenchTable* t, FILE* out, BenchFormat format, const char* columns, const char* meta) {
+    t->out      = out;
+    t->format   = format;
+    t->columns  = columns;
+    t->next     = columns;
+    t->cells    = 0;
+    t->rows     = 0;
+    if( format == BF_CSV ) {
+        fprintf(out, "%s\n", columns);
+    } else {
+        fprintf(out, "{%s\"results\":[", meta ? meta : "");
+    }
+}
+
+// separator and, in JSON, the key of the next cell
+static
+void
+beginCell(BenchTable* t) {
+    const char* name    = t->next;
+    size_t      length  = strcspn(name, ",");
+    t->next = name[length] ? name + length + 1 : name + length;
+    if( t->format == BF_CSV ) {
+        if( t->cells ) {
+            fputc(',', t->out);
+        }
+    } else {
+        fprintf(t->out, "%s\"%.*s\":", t->cells ? "," : (t->rows ? ",\n{" : "\n{"), (int)length, name);
+    }
+    ++t->cells;
+}
+
+void
+benchTableString(BenchTable* t, const char* value) {
+    beginCell(t);
+    fprintf(t->out, t->format == BF_CSV ? "%s" : "\"%s\"", value);
+}
+
+void
+benchTableU64(BenchTable* t, uint64_t value) {
+    beginCell(t);
+    fprintf(t->out, "%" PRIu64, value);
+}
+
+void
+benchTableDouble(BenchTable* t, double value, int decimals) {
+    beginCell(t);
+    fprintf(t->out, "%.*f", decimals, value);
+}
+
+void
+benchTableBool(BenchTable* t, bool value) {
+    beginCell(t);
+    if( t->format == BF_CSV ) {
+        fprintf(t->out, "%d", value ? 1 : 0);
+    } else {
+        fprintf(t->out, "%s", value ? "true" : "false");
+    }
+}
+
+void
+benchTableEndRow(BenchTable* t) {
+    fprintf(t->out, t->format == BF_CSV ? "\n" : "}");
+    fflush(t->out);
+    t->next     = t->columns;
+    t->cells    = 0;
+    ++t->rows;
+}
+
+void
+benchTableEnd(BenchTable* t) {
+    if( t->format == BF_JSON ) {
+        fprintf(t->out, "\n]}\n");
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef BENCH__H
+#define BENCH__H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <tcpm.h>
+
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-bench: standard actor workloads
+////////////////////////////////////////////////////////////////////////////////
+
+// messages are plain integers, shifted by one: a NULL message means "no message"
+#define BENCH_MSG(value)        ((void*)(uintptr_t)((uint64_t)(value) + 1))
+#define BENCH_VALUE(msg)        ((uint64_t)(uintptr_t)(msg) - 1)
+
+typedef struct {
+    uint32_t        threads;
+    uint32_t        processes;      // meaning depends on the workload (-n)
+    uint64_t        messages;       // meaning depends on the workload (-m)
+} BenchConfig;
+
+typedef struct {
+    const char*     workload;
+    uint32_t        threads;
+    uint64_t        processes;      // processes spawned
+    uint64_t        operations;     // messages/operations the rate is computed on
+    double          seconds;
+    uint64_t        sendFailures;   // SEND_FAIL returns retried by the workload
+    uint64_t        sendFull;       // optional, failures on a full mailbox
+    uint64_t        sendBusy;       // optional, failures on a taken release lock
+    double          retrySeconds;   // optional, CPU time spent retrying sends
+    double          cpuSeconds;     // optional, process CPU time during the run
+    Histogram*      latency;        // optional, nanoseconds
+} BenchResult;
+
+typedef bool        (*BenchRun)     (const BenchConfig* config, BenchResult* result);
+
+typedef struct {
+    const char*     name;
+    const char*     description;
+    BenchRun        run;
+    uint32_t        defaultProcesses;
+    uint64_t        defaultMessages;
+} Workload;
+
+uint64_t    benchNow        (void);
+void        benchWait       (atomic_uint_fast64_t* counter, uint64_t target);
+uint64_t    benchSend       (PID dest, void* msg);
+PID         benchSpawn      (ProcessQueue* dq, ProcessHandler handler, void* state, uint32_t messageCap, ProcessReleaseState releaseState);
+
+// compare two JSON result files, returns the process exit code
+int         benchCompare    (int argc, char** argv);
+
+bool        pingpongRun     (const BenchConfig* config, BenchResult* result);
+bool        ringRun         (const BenchConfig* config, BenchResult* result);
+bool        faninRun        (const BenchConfig* config, BenchResult* result);
+bool        fanoutRun       (const BenchConfig* config, BenchResult* result);
+bool        skynetRun       (const BenchConfig* config, BenchResult* result);
+bool        chameneosRun    (const BenchConfig* config, BenchResult* result);
+bool        saturationRun   (const BenchConfig* config, BenchResult* result);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+
+#include "bench.h"
+
+// chameneos: -n creatures repeatedly ask a single broker for a meeting, the
+// broker pairs them, both take the complement color, until -m meetings
+
+#define COLOR_COUNT     3
+#define FADED           COLOR_COUNT
+
+// requests are (creature << 2) | color, replies the new color or FADED; the
+// first message a creature receives is its initial color
+
+typedef struct {
+    PID                     broker;
+    uint64_t                color;
+    uint64_t                meetings;
+    uint64_t                sendFailures;
+    bool                    started;
+    atomic_uint_fast64_t*   done;
+} Creature;
+
+typedef struct {
+    PID*                    creatures;
+    uint64_t                remaining;
+    bool                    waiting;        // a creature is waiting for a partner
+    uint64_t                waitingRequest;
+    uint64_t                sendFailures;
+} Broker;
+
+static
+uint64_t
+complement(uint64_t a, uint64_t b) {
+    return a == b ? a : COLOR_COUNT - a - b;
+}
+
+static
+ProcessContinuation
+creatureHandler(ProcessQueue* dq, void* state, void* msg) {
+    Creature*   creature    = (Creature*)state;
+    if( msg == NULL ) {
+        return PCT_WAIT_MESSAGE;
+    }
+    uint64_t    reply   = BENCH_VALUE(msg);
+    if( reply == FADED ) {
+        atomic_fetch_add(creature->done, 1);
+        return PCT_STOP;
+    }
+    creature->color = reply;
+    if( creature->started ) {
+        ++creature->meetings;
+    }
+    creature->started   = true;
+    uint64_t    self    = Process_self(dq).id;
+    creature->sendFailures += benchSend(creature->broker, BENCH_MSG((self << 2) | creature->color));
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+ProcessContinuation
+brokerHandler(ProcessQueue* dq, void* state, void* msg) {
+    Broker*     broker  = (Broker*)state;
+    (void)dq;
+    if( msg == NULL ) {
+        return PCT_WAIT_MESSAGE;
+    }
+
+    uint64_t    request = BENCH_VALUE(msg);
+    PID         from    = broker->creatures[request >> 2];
+    if( broker->remaining == 0 ) {
+        broker->sendFailures   += benchSend(from, BENCH_MSG(FADED));
+    } else if( !broker->waiting ) {
+        broker->waiting         = true;
+        broker->waitingRequest  = request;
+    } else {
+        uint64_t    color   = complement(broker->waitingRequest & 3, request & 3);
+        broker->sendFailures   += benchSend(broker->creatures[broker->waitingRequest >> 2], BENCH_MSG(color));
+        broker->sendFailures   += benchSend(from, BENCH_MSG(color));
+        broker->waiting         = false;
+        --broker->remaining;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+bool
+chameneosRun(const BenchConfig* config, BenchResult* result) {
+    uint32_t                count       = config->processes < 2 ? 2 : config->processes;
+    // creature ids index the PID table: ids are slots in [0, procCap)
+    ProcessQueue*           dq          = ProcessQueue_init(count + 1, config->threads);
+    Creature*               creatures   = (Creature*)calloc(count, sizeof(Creature));
+    PID*                    pids        = (PID*)calloc(count + 1, sizeof(PID));
+    atomic_uint_fast64_t    done        = 0;
+    Broker                  broker      = { .creatures = pids, .remaining = config->messages };
+
+    uint64_t    start   = benchNow();
+    PID         brokerPid   = benchSpawn(dq, brokerHandler, &broker, count + 1, NULL);
+    for( uint32_t c = 0; c < count; ++c ) {
+        creatures[c].broker = brokerPid;
+        creatures[c].done   = &done;
+        PID pid = benchSpawn(dq, creatureHandler, &creatures[c], 2, NULL);
+        pids[pid.id]    = pid;
+    }
+    // creatures only start once the broker knows every PID
+    for( uint32_t c = 0; c <= count; ++c ) {
+        if( pids[c].pq ) {
+            result->sendFailures   += benchSend(pids[c], BENCH_MSG(c % COLOR_COUNT));
+        }
+    }
+    benchWait(&done, count);
+    uint64_t    end     = benchNow();
+
+    ProcessQueue_release(dq);
+    uint64_t    meetings    = 0;
+    for( uint32_t c = 0; c < count; ++c ) {
+        meetings               += creatures[c].meetings;
+        result->sendFailures   += creatures[c].sendFailures;
+    }
+    result->sendFailures   += broker.sendFailures;
+    result->processes       = count + 1;
+    result->operations      = meetings / 2;
+    result->seconds         = (double)(end - start) / 1e9;
+    free(pids);
+    free(creatures);
+    return meetings == 2 * config->messages;
+}
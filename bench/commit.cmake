@@ -0,0 +1,19 @@
+# Writes the commit the benchmarks are built from to OUTPUT (commit.h).
+# Run at every build: the file is only touched when the commit changed.
+execute_process(COMMAND git describe --always --dirty
+                WORKING_DIRECTORY ${SOURCE_DIR}
+                OUTPUT_VARIABLE TCPM_BENCH_COMMIT
+                OUTPUT_STRIP_TRAILING_WHITESPACE
+                ERROR_QUIET)
+if(NOT TCPM_BENCH_COMMIT)
+    set(TCPM_BENCH_COMMIT "unknown")
+endif()
+
+set(CONTENT "#define TCPM_BENCH_COMMIT   \"${TCPM_BENCH_COMMIT}\"\n")
+set(PREVIOUS "")
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} PREVIOUS)
+endif()
+if(NOT PREVIOUS STREQUAL CONTENT)
+    file(WRITE ${OUTPUT} "${CONTENT}")
+endif()
@@ -0,0 +1,143 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+// tcpm-bench compare: matches the results of two JSON files on workload,
+// threads and processes and flags throughput drops and p99 latency increases
+// beyond a relative threshold; only reads the one-result-per-line format
+// tcpm-bench writes
+
+typedef struct {
+    char        workload[32];
+    uint64_t    threads;
+    uint64_t    processes;
+    double      opsPerSec;
+    double      p99;
+} Entry;
+
+typedef struct {
+    Entry*      entries;
+    uint32_t    count;
+    uint32_t    cap;
+} EntryList;
+
+static
+bool
+jsonNumber(const char* line, const char* key, double* value) {
+    char        pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* at  = strstr(line, pattern);
+    if( at == NULL ) {
+        return false;
+    }
+    *value  = strtod(at + strlen(pattern), NULL);
+    return true;
+}
+
+static
+bool
+loadResults(const char* path, EntryList* list) {
+    FILE*   in  = fopen(path, "r");
+    if( in == NULL ) {
+        fprintf(stderr, "unable to open %s\n", path);
+        return false;
+    }
+
+    char    line[1024];
+    while( fgets(line, sizeof(line), in) ) {
+        const char* name    = strstr(line, "\"workload\":\"");
+        if( name == NULL ) {
+            continue;
+        }
+        if( list->count == list->cap ) {
+            list->cap       = list->cap ? list->cap * 2 : 64;
+            list->entries   = (Entry*)realloc(list->entries, list->cap * sizeof(Entry));
+        }
+        Entry*  e       = &list->entries[list->count];
+        double  threads = 0.0;
+        double  procs   = 0.0;
+        name   += strlen("\"workload\":\"");
+        snprintf(e->workload, sizeof(e->workload), "%.*s", (int)strcspn(name, "\""), name);
+        if( !jsonNumber(line, "threads", &threads) || !jsonNumber(line, "processes", &procs) || !jsonNumber(line, "ops_per_sec", &e->opsPerSec) ) {
+            continue;
+        }
+        if( !jsonNumber(line, "p99_ns", &e->p99) ) {
+            e->p99  = 0.0;
+        }
+        e->threads      = (uint64_t)threads;
+        e->processes    = (uint64_t)procs;
+        ++list->count;
+    }
+    fclose(in);
+    if( list->count == 0 ) {
+        fprintf(stderr, "no results in %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+static
+const Entry*
+findEntry(const EntryList* list, const Entry* key) {
+    for( uint32_t i = 0; i < list->count; ++i ) {
+        const Entry*    e   = &list->entries[i];
+        if( e->threads == key->threads && e->processes == key->processes && strcmp(e->workload, key->workload) == 0 ) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// relative change in percent, positive is worse
+static
+bool
+printChange(const Entry* e, const char* metric, double base, double cand, double worse, double threshold) {
+    bool    regressed   = worse > threshold;
+    printf("%-10s %7" PRIu64 " %9" PRIu64 " %-11s %14.0f %14.0f %+8.1f%% %s\n",
+           e->workload, e->threads, e->processes, metric, base, cand, (cand - base) / base * 100.0, regressed ? "REGRESSION" : "");
+    return regressed;
+}
+
+int
+benchCompare(int argc, char** argv) {
+    double  threshold   = 5.0;
+    if( argc == 4 && strcmp(argv[2], "-r") == 0 ) {
+        threshold   = strtod(argv[3], NULL);
+    } else if( argc != 2 ) {
+        fprintf(stderr, "usage: tcpm-bench compare <baseline.json> <candidate.json> [-r threshold %%]\n");
+        return 2;
+    }
+
+    EntryList   baseline    = { 0 };
+    EntryList   candidate   = { 0 };
+    if( !loadResults(argv[0], &baseline) || !loadResults(argv[1], &candidate) ) {
+        free(baseline.entries);
+        free(candidate.entries);
+        return 2;
+    }
+
+    uint32_t    regressions = 0;
+    printf("%-10s %7s %9s %-11s %14s %14s %9s\n", "workload", "threads", "processes", "metric", "baseline", "candidate", "change");
+    for( uint32_t i = 0; i < candidate.count; ++i ) {
+        const Entry*    cand    = &candidate.entries[i];
+        const Entry*    base    = findEntry(&baseline, cand);
+        if( base == NULL ) {
+            continue;
+        }
+        if( base->opsPerSec > 0.0 ) {
+            regressions    += printChange(cand, "ops/s", base->opsPerSec, cand->opsPerSec,
+                                          (base->opsPerSec - cand->opsPerSec) / base->opsPerSec * 100.0, threshold);
+        }
+        if( base->p99 > 0.0 && cand->p99 > 0.0 ) {
+            regressions    += printChange(cand, "p99 ns", base->p99, cand->p99,
+                                          (cand->p99 - base->p99) / base->p99 * 100.0, threshold);
+        }
+    }
+    printf("%" PRIu32 " regression(s) beyond %.1f%%\n", regressions, threshold);
+
+    free(baseline.entries);
+    free(candidate.entries);
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-coroutine-bench: cost of coroutine processes against handlers
+//
+// each test runs once with plain re-entrant handlers and once with coroutine
+// processes doing the same thing:
+//   yield     one process rescheduled N times (PCT_CONTINUE / Process_yield)
+//   pingpong  two processes bouncing N messages (Process_receiveBlocking)
+//   spawn     N processes spawned, each stopping at once (pooled stacks)
+////////////////////////////////////////////////////////////////////////////////
+
+#define PING    ((void*)1)
+#define STOP    ((void*)2)
+
+typedef struct {
+    PID             a;
+    PID             b;
+    atomic_bool     ready;      // a is known to b
+    uint64_t        count;
+    uint64_t        done;
+    atomic_uint64_t finished;
+} Shared;
+
+static
+void
+send(PID dest, void* msg) {
+    while( Process_sendMessage(dest, msg, MA_KEEP) == SEND_FAIL ) {
+        sched_yield();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// handlers
+////////////////////////////////////////////////////////////////////////////////
+
+static
+ProcessContinuation
+yieldHandler(ProcessQueue* dq, void* state, void* msg) {
+    Shared*     s   = (Shared*)state;
+    (void)dq;
+    (void)msg;
+    if( ++s->done == s->count ) {
+        atomic_fetch_add(&s->finished, 1);
+        return PCT_STOP;
+    }
+    return PCT_CONTINUE;
+}
+
+static
+ProcessContinuation
+pingHandler(ProcessQueue* dq, void* state, void* msg) {
+    Shared*     s   = (Shared*)state;
+    if( msg == NULL ) {
+        s->a    = Process_self(dq);
+        atomic_store(&s->ready, true);
+    } else if( ++s->done == s->count ) {
+        send(s->b, STOP);
+        atomic_fetch_add(&s->finished, 1);
+        return PCT_STOP;
+    }
+    send(s->b, PING);
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+ProcessContinuation
+pongHandler(ProcessQueue* dq, void* state, void* msg) {
+    Shared*     s   = (Shared*)state;
+    (void)dq;
+    if( msg == STOP ) {
+        atomic_fetch_add(&s->finished, 1);
+        return PCT_STOP;
+    }
+    if( msg ) {
+        send(s->a, PING);
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+ProcessContinuation
+stopHandler(ProcessQueue* dq, void* state, void* msg) {
+    (void)dq;
+    (void)msg;
+    atomic_fetch_add(&((Shared*)state)->finished, 1);
+    return PCT_STOP;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// coroutines
+////////////////////////////////////////////////////////////////////////////////
+
+static
+void
+yieldBody(ProcessQueue* dq, void* state) {
+    Shared*     s   = (Shared*)state;
+    while( ++s->done < s->count ) {
+        Process_yield(dq);
+    }
+    atomic_fetch_add(&s->finished, 1);
+}
+
+static
+void
+pingBody(ProcessQueue* dq, void* state) {
+    Shared*     s   = (Shared*)state;
+    s->a    = Process_self(dq);
+    atomic_store(&s->ready, true);
+    for( ; s->done < s->count; ++s->done ) {
+        send(s->b, PING);
+        Process_receiveBlocking(dq);
+    }
+    send(s->b, STOP);
+    atomic_fetch_add(&s->finished, 1);
+}
+
+static
+void
+pongBody(ProcessQueue* dq, void* state) {
+    Shared*     s   = (Shared*)state;
+    while( Process_receiveBlocking(dq) != STOP ) {
+        send(s->a, PING);
+    }
+    atomic_fetch_add(&s->finished, 1);
+}
+
+static
+void
+stopBody(ProcessQueue* dq, void* state) {
+    (void)dq;
+    atomic_fetch_add(&((Shared*)state)->finished, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// driver
+////////////////////////////////////////////////////////////////////////////////
+
+static
+PID
+spawn(ProcessQueue* dq, bool coroutine, ProcessHandler handler, CoroutineBody body, Shared* s) {
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = handler;
+    sp.initialState         = s;
+    sp.messageCap           = 4;
+    sp.maxMessagePerCycle   = 4;
+    PID     pid;
+    while( (pid = coroutine ? ProcessQueue_spawnCoroutine(dq, &sp, body, 0) : ProcessQueue_spawn(dq, &sp)).pq == NULL ) {
+        sched_yield();      // process table full, or no stack
+    }
+    return pid;
+}
+
+static
+void
+waitFinished(Shared* s, uint64_t target) {
+    while( atomic_load(&s->finished) < target ) {
+        sched_yield();
+    }
+}
+
+static
+double
+runTest(ProcessQueue* dq, const char* test, bool coroutine, uint64_t count) {
+    Shared      s       = { .count = count };
+    uint64_t    start   = monotonicNs();
+    if( strcmp(test, "yield") == 0 ) {
+        spawn(dq, coroutine, yieldHandler, yieldBody, &s);
+        waitFinished(&s, 1);
+    } else if( strcmp(test, "pingpong") == 0 ) {
+        s.b = spawn(dq, coroutine, pongHandler, pongBody, &s);
+        spawn(dq, coroutine, pingHandler, pingBody, &s);
+        waitFinished(&s, 2);
+    } else {
+        for( uint64_t n = 0; n < count; ++n ) {
+            spawn(dq, coroutine, stopHandler, stopBody, &s);
+        }
+        waitFinished(&s, count);
+    }
+    double      seconds = (double)(monotonicNs() - start) / 1e9;
+    while( atomic_load(&dq->procCount) ) {
+        sched_yield();
+    }
+    return seconds;
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n operations] [-f csv|json] [-o file]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 1;
+    uint64_t    count       = 1000000;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            count       = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || count == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ProcessQueue*   dq      = ProcessQueue_init(1024, threads);
+    const char*     tests[] = { "yield", "pingpong", "spawn" };
+    BenchTable      table;
+    benchTableBegin(&table, out, format, "test,kind,threads,operations,seconds,ns_per_op", NULL);
+    for( size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); ++t ) {
+        for( int coroutine = 0; coroutine < 2; ++coroutine ) {
+            double      seconds = runTest(dq, tests[t], coroutine, count);
+            benchTableString(&table, tests[t]);
+            benchTableString(&table, coroutine ? "coroutine" : "handler");
+            benchTableU64(&table, threads);
+            benchTableU64(&table, count);
+            benchTableDouble(&table, seconds, 6);
+            benchTableDouble(&table, seconds * 1e9 / (double)count, 1);
+            benchTableEndRow(&table);
+        }
+    }
+    benchTableEnd(&table);
+
+    ProcessQueue_release(dq);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+
+#include <tcpm.hpp>
+
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-cxx-bench: tcpm.hpp against the raw C API
+//
+// the same ping-pong written three times: C handlers, tcpm::Actor and
+// tcpm::Task, once with an int (travelling in the mailbox pointer) and once
+// with a 64 bytes struct (malloc/free in C, a by-value mailbox in C++).
+////////////////////////////////////////////////////////////////////////////////
+
+struct Blob {
+    uint64_t    words[8];
+};
+
+// ends the pong side, above any round trip count
+static constexpr uint64_t       STOP_VALUE  = 0x7fffffff;
+static std::atomic<uint32_t>    finished;
+
+static
+uint64_t
+nowNs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static
+void
+waitFinished(uint32_t target) {
+    while( finished.load() < target ) {
+        sched_yield();
+    }
+    finished    = 0;
+}
+
+static
+ProcessSpawnParameters
+parameters(ProcessHandler handler, void* state) {
+    ProcessSpawnParameters  sp  = {};
+    sp.handler              = handler;
+    sp.initialState         = state;
+    sp.messageCap           = 64;
+    sp.maxMessagePerCycle   = 16;
+    return sp;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// C
+////////////////////////////////////////////////////////////////////////////////
+
+struct CPair {
+    PID         ping;
+    PID         pong;
+    uint64_t    remaining;
+    bool        blob;
+};
+
+static
+void*
+cMessage(CPair* pair, uint64_t value) {
+    if( pair->blob ) {
+        Blob*   b   = (Blob*)malloc(sizeof(Blob));
+        b->words[0] = value;
+        return b;
+    }
+    return (void*)(uintptr_t)(value + 1);
+}
+
+static
+uint64_t
+cValue(CPair* pair, void* msg) {
+    if( pair->blob ) {
+        uint64_t    value   = ((Blob*)msg)->words[0];
+        free(msg);
+        return value;
+    }
+    return (uint64_t)(uintptr_t)msg - 1;
+}
+
+static
+ProcessContinuation
+cPing(ProcessQueue* dq, void* state, void* msg) {
+    CPair*      pair    = (CPair*)state;
+    uint64_t    value   = 0;
+    if( msg == nullptr ) {
+        pair->ping  = Process_self(dq);
+    } else {
+        value   = cValue(pair, msg);
+        if( --pair->remaining == 0 ) {
+            Process_sendMessage(pair->pong, cMessage(pair, STOP_VALUE), MA_KEEP);
+            ++finished;
+            return PCT_STOP;
+        }
+    }
+    Process_sendMessage(pair->pong, cMessage(pair, value + 1), MA_KEEP);
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+ProcessContinuation
+cPong(ProcessQueue* dq, void* state, void* msg) {
+    CPair*      pair    = (CPair*)state;
+    (void)dq;
+    if( msg == nullptr ) {
+        return PCT_WAIT_MESSAGE;
+    }
+    uint64_t    value   = cValue(pair, msg);
+    if( value == STOP_VALUE ) {
+        ++finished;
+        return PCT_STOP;
+    }
+    Process_sendMessage(pair->ping, cMessage(pair, value), MA_KEEP);
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+void
+runC(ProcessQueue* dq, uint64_t count, bool blob) {
+    CPair                   pair    = { {}, {}, count, blob };
+    ProcessSpawnParameters  sp      = parameters(cPong, &pair);
+    pair.pong   = ProcessQueue_spawn(dq, &sp);
+    sp          = parameters(cPing, &pair);
+    ProcessQueue_spawn(dq, &sp);
+    waitFinished(2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm::Actor
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Msg>
+static
+Msg
+makeMsg(uint64_t value) {
+    if constexpr( std::is_same_v<Msg, Blob> ) {
+        Blob    b   = {};
+        b.words[0]  = value;
+        return b;
+    } else {
+        return (Msg)value;
+    }
+}
+
+template <typename Msg>
+static
+uint64_t
+valueOf(const Msg& msg) {
+    if constexpr( std::is_same_v<Msg, Blob> ) {
+        return msg.words[0];
+    } else {
+        return (uint64_t)msg;
+    }
+}
+
+template <typename Msg>
+struct Pong {
+    tcpm::Pid<Msg>* ping;
+    ProcessContinuation operator()(tcpm::Context<Msg>&, Msg&& msg) {
+        if( valueOf(msg) == STOP_VALUE ) {
+            ++finished;
+            return PCT_STOP;
+        }
+        ping->send(std::move(msg));
+        return PCT_WAIT_MESSAGE;
+    }
+};
+
+template <typename Msg>
+struct Ping {
+    tcpm::Pid<Msg>* self;
+    tcpm::Pid<Msg>  pong;
+    uint64_t        remaining;
+    ProcessContinuation start(tcpm::Context<Msg>& ctx) {
+        *self   = ctx.self();
+        pong.send(makeMsg<Msg>(1));
+        return PCT_WAIT_MESSAGE;
+    }
+    ProcessContinuation operator()(tcpm::Context<Msg>&, Msg&& msg) {
+        if( --remaining == 0 ) {
+            pong.send(makeMsg<Msg>(STOP_VALUE));
+            ++finished;
+            return PCT_STOP;
+        }
+        pong.send(makeMsg<Msg>(valueOf(msg) + 1));
+        return PCT_WAIT_MESSAGE;
+    }
+};
+
+template <typename Msg>
+static
+void
+runActor(ProcessQueue* dq, uint64_t count) {
+    tcpm::Pid<Msg>  ping;
+    tcpm::Pid<Msg>  pong    = tcpm::Actor<Pong<Msg>, Msg>::spawn(dq, Pong<Msg>{ &ping });
+    tcpm::Actor<Ping<Msg>, Msg>::spawn(dq, Ping<Msg>{ &ping, pong, count });
+    waitFinished(2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm::Task
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Msg>
+static
+tcpm::Task<Msg>
+pongTask(tcpm::Context<Msg> ctx, tcpm::Pid<Msg>* ping) {
+    while( true ) {
+        Msg     msg = co_await ctx.receive();
+        if( valueOf(msg) == STOP_VALUE ) {
+            break;
+        }
+        ping->send(std::move(msg));
+    }
+    ++finished;
+}
+
+template <typename Msg>
+static
+tcpm::Task<Msg>
+pingTask(tcpm::Context<Msg> ctx, tcpm::Pid<Msg>* self, tcpm::Pid<Msg> pong, uint64_t count) {
+    *self   = ctx.self();
+    pong.send(makeMsg<Msg>(1));
+    for( uint64_t n = 1; n < count; ++n ) {
+        Msg     msg = co_await ctx.receive();
+        pong.send(makeMsg<Msg>(valueOf(msg) + 1));
+    }
+    co_await ctx.receive();
+    pong.send(makeMsg<Msg>(STOP_VALUE));
+    ++finished;
+}
+
+template <typename Msg>
+static
+void
+runTask(ProcessQueue* dq, uint64_t count) {
+    tcpm::Pid<Msg>  ping;
+    tcpm::Pid<Msg>  pong    = pongTask<Msg>(tcpm::Context<Msg>(dq), &ping).spawn(dq);
+    pingTask<Msg>(tcpm::Context<Msg>(dq), &ping, pong, count).spawn(dq);
+    waitFinished(2);
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n round trips] [-f csv|json] [-o file]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 1;
+    uint64_t    count       = 1000000;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, nullptr, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            count       = strtoull(arg, nullptr, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == nullptr ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || count == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct Variant {
+        const char* api;
+        const char* message;
+        void        (*run)(ProcessQueue* dq, uint64_t count);
+    };
+    const Variant   variants[]  = {
+        { "c",     "int",  [](ProcessQueue* dq, uint64_t n) { runC(dq, n, false); } },
+        { "actor", "int",  runActor<int> },
+        { "task",  "int",  runTask<int> },
+        { "c",     "blob", [](ProcessQueue* dq, uint64_t n) { runC(dq, n, true); } },
+        { "actor", "blob", runActor<Blob> },
+        { "task",  "blob", runTask<Blob> },
+    };
+
+    ProcessQueue*   dq  = ProcessQueue_init(16, threads);
+    BenchTable      table;
+    benchTableBegin(&table, out, format, "api,message,threads,round_trips,seconds,ns_per_round_trip", nullptr);
+    for( size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v ) {
+        uint64_t    start   = nowNs();
+        variants[v].run(dq, count);
+        double      seconds = (double)(nowNs() - start) / 1e9;
+        benchTableString(&table, variants[v].api);
+        benchTableString(&table, variants[v].message);
+        benchTableU64(&table, threads);
+        benchTableU64(&table, count);
+        benchTableDouble(&table, seconds, 6);
+        benchTableDouble(&table, seconds * 1e9 / (double)count, 1);
+        benchTableEndRow(&table);
+    }
+    benchTableEnd(&table);
+
+    ProcessQueue_release(dq);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return 0;
+}
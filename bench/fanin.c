@@ -0,0 +1,77 @@
+#include <stdlib.h>
+
+#include "bench.h"
+
+// -n senders push -m messages each into one receiver; senders never block,
+// a failed send is retried on their next cycle
+
+#define FANIN_MAILBOX   1024
+
+typedef struct {
+    PID                     receiver;
+    uint64_t                remaining;
+    uint64_t                sendFailures;
+} Sender;
+
+typedef struct {
+    uint64_t                received;
+    uint64_t                expected;
+    atomic_uint_fast64_t*   done;
+} Receiver;
+
+static
+ProcessContinuation
+senderHandler(ProcessQueue* dq, void* state, void* msg) {
+    Sender*     sender  = (Sender*)state;
+    (void)dq;
+    (void)msg;
+    if( Process_sendMessage(sender->receiver, BENCH_MSG(sender->remaining), MA_KEEP) == SEND_SUCCESS ) {
+        if( --sender->remaining == 0 ) {
+            return PCT_STOP;
+        }
+    } else {
+        ++sender->sendFailures;
+    }
+    return PCT_CONTINUE;
+}
+
+static
+ProcessContinuation
+receiverHandler(ProcessQueue* dq, void* state, void* msg) {
+    Receiver*   receiver    = (Receiver*)state;
+    (void)dq;
+    if( msg && ++receiver->received == receiver->expected ) {
+        atomic_store(receiver->done, 1);
+        return PCT_STOP;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+bool
+faninRun(const BenchConfig* config, BenchResult* result) {
+    uint32_t                count       = config->processes;
+    ProcessQueue*           dq          = ProcessQueue_init(count + 1, config->threads);
+    Sender*                 senders     = (Sender*)calloc(count, sizeof(Sender));
+    atomic_uint_fast64_t    done        = 0;
+    Receiver                receiver    = { .received = 0, .expected = (uint64_t)count * config->messages, .done = &done };
+
+    uint64_t    start   = benchNow();
+    PID         pid     = benchSpawn(dq, receiverHandler, &receiver, FANIN_MAILBOX, NULL);
+    for( uint32_t s = 0; s < count; ++s ) {
+        senders[s].receiver     = pid;
+        senders[s].remaining    = config->messages;
+        benchSpawn(dq, senderHandler, &senders[s], 16, NULL);
+    }
+    benchWait(&done, 1);
+    uint64_t    end     = benchNow();
+
+    ProcessQueue_release(dq);
+    for( uint32_t s = 0; s < count; ++s ) {
+        result->sendFailures   += senders[s].sendFailures;
+    }
+    result->processes   = count + 1;
+    result->operations  = receiver.expected;
+    result->seconds     = (double)(end - start) / 1e9;
+    free(senders);
+    return true;
+}
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+
+#include "bench.h"
+
+// one sender pushes -m messages to each of -n receivers, round robin; the
+// sender never blocks, a failed send is retried on its next cycle
+
+#define FANOUT_MAILBOX  64
+
+typedef struct {
+    PID*                    receivers;
+    uint32_t                receiverCount;
+    uint64_t                next;
+    uint64_t                total;
+    uint64_t                sendFailures;
+} Sender;
+
+typedef struct {
+    uint64_t                remaining;
+    atomic_uint_fast64_t*   done;
+} Receiver;
+
+static
+ProcessContinuation
+senderHandler(ProcessQueue* dq, void* state, void* msg) {
+    Sender*     sender  = (Sender*)state;
+    (void)dq;
+    (void)msg;
+    if( Process_sendMessage(sender->receivers[sender->next % sender->receiverCount], BENCH_MSG(sender->next), MA_KEEP) == SEND_SUCCESS ) {
+        if( ++sender->next == sender->total ) {
+            return PCT_STOP;
+        }
+    } else {
+        ++sender->sendFailures;
+    }
+    return PCT_CONTINUE;
+}
+
+static
+ProcessContinuation
+receiverHandler(ProcessQueue* dq, void* state, void* msg) {
+    Receiver*   receiver    = (Receiver*)state;
+    (void)dq;
+    if( msg && --receiver->remaining == 0 ) {
+        atomic_fetch_add(receiver->done, 1);
+        return PCT_STOP;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+bool
+fanoutRun(const BenchConfig* config, BenchResult* result) {
+    uint32_t                count       = config->processes;
+    ProcessQueue*           dq          = ProcessQueue_init(count + 1, config->threads);
+    Receiver*               receivers   = (Receiver*)calloc(count, sizeof(Receiver));
+    PID*                    pids        = (PID*)calloc(count, sizeof(PID));
+    atomic_uint_fast64_t    done        = 0;
+    Sender                  sender      = { .receivers = pids, .receiverCount = count, .next = 0, .total = (uint64_t)count * config->messages };
+
+    uint64_t    start   = benchNow();
+    for( uint32_t r = 0; r < count; ++r ) {
+        receivers[r].remaining  = config->messages;
+        receivers[r].done       = &done;
+        pids[r] = benchSpawn(dq, receiverHandler, &receivers[r], FANOUT_MAILBOX, NULL);
+    }
+    benchSpawn(dq, senderHandler, &sender, 64, NULL);
+    benchWait(&done, count);
+    uint64_t    end     = benchNow();
+
+    ProcessQueue_release(dq);
+    result->sendFailures    = sender.sendFailures;
+    result->processes       = count + 1;
+    result->operations      = sender.total;
+    result->seconds         = (double)(end - start) / 1e9;
+    free(pids);
+    free(receivers);
+    return true;
+}
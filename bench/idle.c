@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-idle-bench: what an idle process costs
+//
+// for each N: resident memory per process, CPU burnt by N waiting processes
+// without any traffic, and the latency of waking one of them with a message
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_SWEEP       16
+
+typedef struct {
+    Histogram*      latency;
+    atomic_bool*    woken;
+} Sleeper;
+
+static
+ProcessContinuation
+sleeperHandler(ProcessQueue* dq, void* state, void* msg) {
+    Sleeper*    sleeper = (Sleeper*)state;
+    (void)dq;
+    if( msg ) {
+        Histogram_record(sleeper->latency, monotonicNs() - (uint64_t)(uintptr_t)msg);
+        atomic_store_explicit(sleeper->woken, true, memory_order_release);
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+uint64_t
+residentBytes(void) {
+    unsigned long   size        = 0;
+    unsigned long   resident    = 0;
+    FILE*           statm       = fopen("/proc/self/statm", "r");
+    if( statm ) {
+        if( fscanf(statm, "%lu %lu", &size, &resident) != 2 ) {
+            resident    = 0;
+        }
+        fclose(statm);
+    }
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static
+double
+cpuSeconds(void) {
+    struct rusage   ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n processes] [-q mailbox cap] [-d idle seconds] [-w wake ups] [-f csv|json] [-o file]\n"
+                    "  -n takes a comma separated list (default 1000,10000,100000,1000000)\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    long        cpus        = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t    threads     = cpus > 0 ? (uint32_t)cpus : 1;
+    uint32_t    counts[MAX_SWEEP]   = { 1000, 10000, 100000, 1000000 };
+    uint32_t    countCount  = 4;
+    uint32_t    messageCap  = 16;
+    double      idleSeconds = 1.0;
+    uint32_t    wakeups     = 1000;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            countCount  = 0;
+            while( *arg && countCount < MAX_SWEEP ) {
+                char*   end = NULL;
+                counts[countCount++]    = (uint32_t)strtoul(arg, &end, 10);
+                arg = *end == ',' ? end + 1 : end;
+            }
+        } else if( strcmp(argv[a], "-q") == 0 ) {
+            messageCap  = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-d") == 0 ) {
+            idleSeconds = strtod(arg, NULL);
+        } else if( strcmp(argv[a], "-w") == 0 ) {
+            wakeups     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || messageCap == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    BenchTable  table;
+    benchTableBegin(&table, out, format, "processes,threads,message_cap,bytes_per_process,idle_cpu_pct,wakeups,"
+                                         "wake_p50_ns,wake_p99_ns,wake_p999_ns,wake_max_ns", NULL);
+
+    Histogram*  latency = (Histogram*)malloc(sizeof(Histogram));
+    for( uint32_t c = 0; c < countCount; ++c ) {
+        uint32_t    count   = counts[c];
+        if( count == 0 ) {
+            continue;
+        }
+        fprintf(stderr, "%" PRIu32 " processes...\n", count);
+
+        atomic_bool     woken   = false;
+        Sleeper         sleeper = { .latency = latency, .woken = &woken };
+        PID*            pids    = (PID*)malloc(count * sizeof(PID));
+        Histogram_init(latency);
+
+        // memory: everything the queue allocates for and because of the processes
+        uint64_t        rssBefore   = residentBytes();
+        ProcessQueue*   dq          = ProcessQueue_init(count, threads);
+        for( uint32_t p = 0; p < count; ++p ) {
+            ProcessSpawnParameters  sp  = { 0 };
+            sp.handler              = sleeperHandler;
+            sp.initialState         = &sleeper;
+            sp.messageCap           = messageCap;
+            sp.maxMessagePerCycle   = messageCap;
+            pids[p] = ProcessQueue_spawn(dq, &sp);
+        }
+        uint64_t        rssAfter    = residentBytes();
+
+        // idle: let every process reach its first wait, then only measure polling
+        struct timespec settle  = { .tv_sec = 0, .tv_nsec = 100000000 };
+        nanosleep(&settle, NULL);
+        struct timespec idle    = { .tv_sec = (time_t)idleSeconds, .tv_nsec = (long)((idleSeconds - (double)(time_t)idleSeconds) * 1e9) };
+        double          cpuStart    = cpuSeconds();
+        uint64_t        wallStart   = monotonicNs();
+        nanosleep(&idle, NULL);
+        double          idleCpu     = (cpuSeconds() - cpuStart) / ((double)(monotonicNs() - wallStart) / 1e9) * 100.0;
+
+        // wake up: one message at a time to a random waiting process
+        srand(count);
+        for( uint32_t w = 0; w < wakeups; ++w ) {
+            atomic_store(&woken, false);
+            while( Process_sendMessage(pids[(uint32_t)rand() % count], (void*)(uintptr_t)monotonicNs(), MA_KEEP) != SEND_SUCCESS ) {}
+            while( !atomic_load_explicit(&woken, memory_order_acquire) ) {
+                sched_yield();
+            }
+        }
+
+        ProcessQueue_release(dq);
+        free(pids);
+
+        benchTableU64(&table, count);
+        benchTableU64(&table, threads);
+        benchTableU64(&table, messageCap);
+        benchTableU64(&table, rssAfter > rssBefore ? (rssAfter - rssBefore) / count : 0);
+        benchTableDouble(&table, idleCpu, 1);
+        benchTableU64(&table, wakeups);
+        benchTableU64(&table, Histogram_percentile(latency, 50.0));
+        benchTableU64(&table, Histogram_percentile(latency, 99.0));
+        benchTableU64(&table, Histogram_percentile(latency, 99.9));
+        benchTableU64(&table, Histogram_max(latency));
+        benchTableEndRow(&table);
+    }
+    free(latency);
+    benchTableEnd(&table);
+
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,371 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-io-bench: Process_submitIo round trips
+//
+// One process keeps -d requests in flight, each completion comes back as a
+// message and is checked before the request is submitted again:
+//   write     4KB pwrites over a 4MB temporary file
+//   read      4KB preads of the same blocks, contents checked
+//   fsync     fsyncs of the file
+//   accept    accepts on a loopback socket the benchmark connects to
+//   error     reads of an invalid fd, must fail with -EBADF
+//   release   -d reads of an empty pipe left in flight: ProcessQueue_release
+//             must cancel them instead of waiting
+//
+// The backend is io_uring when built with TCPM_IO_URING and the kernel allows
+// it, the thread pool otherwise: run both builds to cover both. Any wrong
+// result makes the exit code 1.
+////////////////////////////////////////////////////////////////////////////////
+
+#define BLOCK_SIZE      4096
+#define FILE_BLOCKS     1024
+#define FSYNC_MAX       64
+#define ACCEPT_MAX      1000
+
+typedef struct {
+    const char*     test;
+    IoOp            op;
+    int             fd;
+    bool            stream;         // no offset: pipe reads
+    uint64_t        count;
+    uint32_t        depth;
+    uint8_t*        buffers;        // depth blocks
+    IoRequest*      requests;       // depth
+    uint64_t*       started;        // per request, monotonic ns
+    uint32_t*       idle;           // requests not in flight
+    uint32_t        idleCount;
+    uint64_t        submitted;
+    uint64_t        completed;
+    uint64_t        errors;         // unexpected results
+    uint64_t        refused;        // Process_submitIo returned false
+    Histogram*      latency;
+    atomic_bool     allSubmitted;
+    atomic_bool     done;
+} Job;
+
+static
+void
+fillBlock(uint8_t* block, uint64_t index) {
+    memset(block, (int)((index * 31 + 7) & 0xff), BLOCK_SIZE);
+    memcpy(block, &index, sizeof(index));
+}
+
+static
+bool
+checkBlock(const uint8_t* block, uint64_t index) {
+    uint64_t    stored;
+    memcpy(&stored, block, sizeof(stored));
+    if( stored != index ) {
+        return false;
+    }
+    for( uint32_t b = sizeof(index); b < BLOCK_SIZE; ++b ) {
+        if( block[b] != ((index * 31 + 7) & 0xff) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static
+void
+prepare(Job* j, uint32_t slot, uint64_t n) {
+    IoRequest*  req     = &j->requests[slot];
+    uint8_t*    buffer  = j->buffers + (size_t)slot * BLOCK_SIZE;
+    uint64_t    block   = n % FILE_BLOCKS;
+    memset(req, 0, sizeof(*req));
+    req->op         = j->op;
+    req->fd         = j->fd;
+    req->buffer     = buffer;
+    req->length     = BLOCK_SIZE;
+    req->offset     = (j->op == IO_READ || j->op == IO_WRITE) && !j->stream ? block * BLOCK_SIZE : IO_OFFSET_NONE;
+    req->userData   = (void*)(uintptr_t)slot;
+    if( j->op == IO_WRITE ) {
+        fillBlock(buffer, block);
+    }
+}
+
+static
+bool
+checkResult(Job* j, IoRequest* req) {
+    if( strcmp(j->test, "error") == 0 ) {
+        return req->result == -EBADF;
+    }
+    switch( req->op ) {
+    case IO_WRITE:
+        return req->result == BLOCK_SIZE;
+    case IO_READ:
+        return req->result == BLOCK_SIZE && checkBlock((const uint8_t*)req->buffer, req->offset / BLOCK_SIZE);
+    case IO_ACCEPT:
+        if( req->result < 0 ) {
+            return false;
+        }
+        close((int)req->result);
+        return true;
+    default:
+        return req->result == 0;
+    }
+}
+
+static
+ProcessContinuation
+ioProcess(ProcessQueue* dq, void* state, void* msg) {
+    Job*    j   = (Job*)state;
+    if( msg ) {
+        IoRequest*  req     = (IoRequest*)msg;
+        uint32_t    slot    = (uint32_t)(uintptr_t)req->userData;
+        Histogram_record(j->latency, monotonicNs() - j->started[slot]);
+        if( !checkResult(j, req) ) {
+            if( j->errors++ == 0 ) {
+                fprintf(stderr, "%s: unexpected result %" PRId64 "\n", j->test, req->result);
+            }
+        }
+        ++j->completed;
+        j->idle[j->idleCount++] = slot;
+    }
+
+    PID     self    = Process_self(dq);
+    while( j->idleCount && j->submitted < j->count ) {
+        uint32_t    slot    = j->idle[--j->idleCount];
+        prepare(j, slot, j->submitted);
+        j->started[slot]    = monotonicNs();
+        if( Process_submitIo(self, &j->requests[slot]) == false ) {
+            // too many staged requests: retry on the next cycle
+            j->idle[j->idleCount++] = slot;
+            ++j->refused;
+            return PCT_CONTINUE;
+        }
+        ++j->submitted;
+    }
+    atomic_store(&j->allSubmitted, j->submitted == j->count);
+    if( j->completed == j->count ) {
+        atomic_store(&j->done, true);
+        return PCT_STOP;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// driver
+////////////////////////////////////////////////////////////////////////////////
+
+static
+void
+allocateJob(Job* j) {
+    j->buffers      = (uint8_t*)calloc(j->depth, BLOCK_SIZE);
+    j->requests     = (IoRequest*)calloc(j->depth, sizeof(IoRequest));
+    j->started      = (uint64_t*)calloc(j->depth, sizeof(uint64_t));
+    j->idle         = (uint32_t*)calloc(j->depth, sizeof(uint32_t));
+    for( uint32_t s = 0; s < j->depth; ++s ) {
+        j->idle[j->idleCount++] = j->depth - 1 - s;
+    }
+    Histogram_init(j->latency);
+}
+
+static
+void
+freeJob(Job* j) {
+    free(j->buffers);
+    free(j->requests);
+    free(j->started);
+    free(j->idle);
+}
+
+static
+void
+spawnJob(ProcessQueue* dq, Job* j) {
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = ioProcess;
+    sp.initialState         = j;
+    sp.messageCap           = j->depth;
+    sp.maxMessagePerCycle   = j->depth;
+    ProcessQueue_spawn(dq, &sp);
+}
+
+static
+double
+runJob(ProcessQueue* dq, Job* j, uint16_t connectPort) {
+    allocateJob(j);
+    uint64_t    start   = monotonicNs();
+    spawnJob(dq, j);
+
+    // accepts block until the benchmark connects
+    for( uint64_t c = 0; connectPort && c < j->count; ++c ) {
+        struct sockaddr_in  addr    = { .sin_family = AF_INET, .sin_port = htons(connectPort) };
+        addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+        int     fd  = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if( fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ) {
+            fprintf(stderr, "accept: connect failed: %s\n", strerror(errno));
+            exit(1);
+        }
+        close(fd);
+    }
+    while( !atomic_load(&j->done) ) {
+        sched_yield();
+    }
+    double      seconds = (double)(monotonicNs() - start) / 1e9;
+    while( atomic_load(&dq->procCount) ) {
+        sched_yield();
+    }
+    freeJob(j);
+    return seconds;
+}
+
+// the reads never complete: the time is the one of ProcessQueue_release
+static
+double
+releasePending(ProcessQueue* dq, Job* j) {
+    allocateJob(j);
+    spawnJob(dq, j);
+    while( !atomic_load(&j->allSubmitted) ) {
+        sched_yield();
+    }
+    uint64_t    start   = monotonicNs();
+    ProcessQueue_release(dq);
+    double      seconds = (double)(monotonicNs() - start) / 1e9;
+    freeJob(j);
+    return seconds;
+}
+
+static
+int
+listenLoopback(uint16_t* port) {
+    struct sockaddr_in  addr    = { .sin_family = AF_INET };
+    socklen_t           len     = sizeof(addr);
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    // blocking: accept requests wait for a connection instead of failing
+    int     fd  = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if( fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1024) != 0
+     || getsockname(fd, (struct sockaddr*)&addr, &len) != 0 ) {
+        fprintf(stderr, "unable to listen on loopback: %s\n", strerror(errno));
+        exit(1);
+    }
+    *port   = ntohs(addr.sin_port);
+    return fd;
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n requests] [-d depth] [-f csv|json] [-o file]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 1;
+    uint64_t    count       = 100000;
+    uint32_t    depth       = 32;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            count       = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-d") == 0 ) {
+            depth       = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || count == 0 || depth == 0 || depth > IO_URING_ENTRIES ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char        path[]  = "/tmp/tcpm-io-bench-XXXXXX";
+    int         fileFd  = mkstemp(path);
+    if( fileFd < 0 || ftruncate(fileFd, (off_t)FILE_BLOCKS * BLOCK_SIZE) != 0 ) {
+        fprintf(stderr, "unable to create %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    unlink(path);
+    uint16_t    port;
+    int         listenFd    = listenLoopback(&port);
+    int         pipeFds[2];
+    if( pipe(pipeFds) != 0 ) {
+        fprintf(stderr, "unable to create a pipe: %s\n", strerror(errno));
+        return 1;
+    }
+
+    Job         jobs[]  = {
+        { .test = "write",  .op = IO_WRITE,     .fd = fileFd,   .count = count },
+        { .test = "read",   .op = IO_READ,      .fd = fileFd,   .count = count },
+        { .test = "fsync",  .op = IO_FSYNC,     .fd = fileFd,   .count = count < FSYNC_MAX ? count : FSYNC_MAX },
+        { .test = "accept", .op = IO_ACCEPT,    .fd = listenFd, .count = count < ACCEPT_MAX ? count : ACCEPT_MAX },
+        { .test = "error",  .op = IO_READ,      .fd = -1,       .count = count < ACCEPT_MAX ? count : ACCEPT_MAX },
+        { .test = "release",.op = IO_READ,      .fd = pipeFds[0],   .count = depth, .stream = true },
+    };
+    size_t      jobCount    = sizeof(jobs) / sizeof(jobs[0]);
+    double      seconds[sizeof(jobs) / sizeof(jobs[0])];
+    Histogram*  latency     = (Histogram*)malloc(sizeof(Histogram) * jobCount);
+    ProcessQueue*   dq      = ProcessQueue_init(16, threads);
+    for( size_t t = 0; t < jobCount; ++t ) {
+        fprintf(stderr, "%s...\n", jobs[t].test);
+        jobs[t].depth   = jobs[t].count < depth ? (uint32_t)jobs[t].count : depth;
+        jobs[t].latency = &latency[t];
+        if( t + 1 < jobCount ) {
+            seconds[t]  = runJob(dq, &jobs[t], jobs[t].op == IO_ACCEPT ? port : 0);
+        }
+    }
+    const char* backend = ProcessQueue_ioBackend(dq);
+    seconds[jobCount - 1]   = releasePending(dq, &jobs[jobCount - 1]);
+
+    bool        failed  = false;
+    BenchTable  table;
+    benchTableBegin(&table, out, format, "test,backend,threads,requests,depth,seconds,ns_per_request,p50_ns,p99_ns,errors,refused", NULL);
+    for( size_t t = 0; t < jobCount; ++t ) {
+        Job*        j   = &jobs[t];
+        failed  = failed || j->errors;
+        benchTableString(&table, j->test);
+        benchTableString(&table, backend);
+        benchTableU64(&table, threads);
+        benchTableU64(&table, j->count);
+        benchTableU64(&table, j->depth);
+        benchTableDouble(&table, seconds[t], 6);
+        benchTableDouble(&table, seconds[t] * 1e9 / (double)j->count, 1);
+        benchTableU64(&table, Histogram_percentile(j->latency, 50.0));
+        benchTableU64(&table, Histogram_percentile(j->latency, 99.0));
+        benchTableU64(&table, j->errors);
+        benchTableU64(&table, j->refused);
+        benchTableEndRow(&table);
+    }
+    benchTableEnd(&table);
+
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    close(listenFd);
+    close(fileFd);
+    free(latency);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-load-bench: latency under a fixed offered load
+//
+// the injector thread schedules message i at start + i / rate and stamps it
+// with that intended time, not with the time it managed to send it: a stalled
+// scheduler (full mailboxes, late injector) shows up in the latency instead of
+// silently lowering the offered load (coordinated omission)
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_RATES       32
+#define LOAD_MAILBOX    1024
+
+typedef struct {
+    Histogram*              latency;
+    uint64_t                workNs;         // busy loop per message, simulated service time
+    atomic_uint_fast64_t*   received;
+} Receiver;
+
+static
+ProcessContinuation
+receiverHandler(ProcessQueue* dq, void* state, void* msg) {
+    Receiver*   receiver    = (Receiver*)state;
+    (void)dq;
+    if( msg ) {
+        uint64_t    now     = monotonicNs();
+        if( receiver->workNs ) {
+            uint64_t    until   = now + receiver->workNs;
+            while( monotonicNs() < until ) {}
+        }
+        Histogram_record(receiver->latency, now - (uint64_t)(uintptr_t)msg);
+        atomic_fetch_add_explicit(receiver->received, 1, memory_order_release);
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+void
+sleepUntil(uint64_t deadline) {
+    uint64_t    now     = monotonicNs();
+    // sleep while far ahead, spin the last stretch, the scheduler wake up is too coarse
+    if( deadline > now + 100000 ) {
+        struct timespec ts  = { .tv_sec = (time_t)((deadline - 50000) / 1000000000ull), .tv_nsec = (long)((deadline - 50000) % 1000000000ull) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    while( monotonicNs() < deadline ) {}
+}
+
+typedef struct {
+    uint64_t    rate;
+    uint64_t    sent;
+    uint64_t    retries;
+    double      seconds;
+    bool        saturated;
+    Histogram   latency;
+} LoadResult;
+
+static
+void
+runRate(uint32_t threads, uint32_t processes, uint64_t rate, double duration, uint64_t workNs, LoadResult* result) {
+    ProcessQueue*           dq          = ProcessQueue_init(processes, threads);
+    Receiver*               receivers   = (Receiver*)calloc(processes, sizeof(Receiver));
+    PID*                    pids        = (PID*)calloc(processes, sizeof(PID));
+    atomic_uint_fast64_t    received    = 0;
+
+    for( uint32_t p = 0; p < processes; ++p ) {
+        receivers[p].latency    = (Histogram*)malloc(sizeof(Histogram));
+        receivers[p].workNs     = workNs;
+        receivers[p].received   = &received;
+        Histogram_init(receivers[p].latency);
+
+        ProcessSpawnParameters  sp  = { 0 };
+        sp.handler              = receiverHandler;
+        sp.initialState         = &receivers[p];
+        sp.messageCap           = LOAD_MAILBOX;
+        sp.maxMessagePerCycle   = LOAD_MAILBOX;
+        pids[p] = ProcessQueue_spawn(dq, &sp);
+    }
+
+    uint64_t    planned     = (uint64_t)((double)rate * duration);
+    uint64_t    start       = monotonicNs() + 1000000;
+    uint64_t    giveUp      = start + (uint64_t)(2.0 * duration * 1e9);
+    result->rate            = rate;
+    result->sent            = 0;
+    result->retries         = 0;
+    result->saturated       = false;
+    for( uint64_t i = 0; i < planned; ++i ) {
+        uint64_t    intended    = start + (uint64_t)((double)i * 1e9 / (double)rate);
+        sleepUntil(intended);
+        while( Process_sendMessage(pids[i % processes], (void*)(uintptr_t)intended, MA_KEEP) == SEND_FAIL ) {
+            ++result->retries;
+        }
+        ++result->sent;
+        // more than one duration late: the scheduler cannot keep up with this rate
+        if( monotonicNs() > giveUp ) {
+            result->saturated   = true;
+            break;
+        }
+    }
+    while( atomic_load_explicit(&received, memory_order_acquire) < result->sent ) {
+        sched_yield();
+    }
+    result->seconds         = (double)(monotonicNs() - start) / 1e9;
+    result->saturated       = result->saturated || result->seconds > duration * 1.1;
+
+    ProcessQueue_release(dq);
+    Histogram_init(&result->latency);
+    for( uint32_t p = 0; p < processes; ++p ) {
+        Histogram_merge(&result->latency, receivers[p].latency);
+        free(receivers[p].latency);
+    }
+    free(pids);
+    free(receivers);
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n processes] [-r rates] [-d seconds per rate] [-w work ns per message] [-f csv|json] [-o file]\n"
+                    "  -r takes a comma separated list of messages per second, the sweep stops at the first saturated rate\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    long        cpus        = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t    threads     = cpus > 0 ? (uint32_t)cpus : 1;
+    uint32_t    processes   = 100;
+    uint64_t    rates[MAX_RATES]    = { 10000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000 };
+    uint32_t    rateCount   = 8;
+    double      duration    = 2.0;
+    uint64_t    workNs      = 0;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            processes   = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-r") == 0 ) {
+            rateCount   = 0;
+            while( *arg && rateCount < MAX_RATES ) {
+                char*   end = NULL;
+                rates[rateCount++]  = strtoull(arg, &end, 10);
+                arg = *end == ',' ? end + 1 : end;
+            }
+        } else if( strcmp(argv[a], "-d") == 0 ) {
+            duration    = strtod(arg, NULL);
+        } else if( strcmp(argv[a], "-w") == 0 ) {
+            workNs      = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || processes == 0 || duration <= 0.0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    BenchTable  table;
+    benchTableBegin(&table, out, format, "rate,threads,processes,sent,seconds,achieved_per_sec,send_retries,saturated,"
+                                         "p50_ns,p90_ns,p99_ns,p999_ns,p9999_ns,max_ns", NULL);
+    LoadResult* r   = (LoadResult*)malloc(sizeof(LoadResult));
+    for( uint32_t i = 0; i < rateCount; ++i ) {
+        if( rates[i] == 0 ) {
+            continue;
+        }
+        fprintf(stderr, "offering %" PRIu64 " msg/s...\n", rates[i]);
+        runRate(threads, processes, rates[i], duration, workNs, r);
+
+        benchTableU64(&table, r->rate);
+        benchTableU64(&table, threads);
+        benchTableU64(&table, processes);
+        benchTableU64(&table, r->sent);
+        benchTableDouble(&table, r->seconds, 6);
+        benchTableDouble(&table, (double)r->sent / r->seconds, 0);
+        benchTableU64(&table, r->retries);
+        benchTableBool(&table, r->saturated);
+        benchTableU64(&table, Histogram_percentile(&r->latency, 50.0));
+        benchTableU64(&table, Histogram_percentile(&r->latency, 90.0));
+        benchTableU64(&table, Histogram_percentile(&r->latency, 99.0));
+        benchTableU64(&table, Histogram_percentile(&r->latency, 99.9));
+        benchTableU64(&table, Histogram_percentile(&r->latency, 99.99));
+        benchTableU64(&table, Histogram_max(&r->latency));
+        benchTableEndRow(&table);
+        if( r->saturated ) {
+            break;
+        }
+    }
+    free(r);
+    benchTableEnd(&table);
+
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return 0;
+}
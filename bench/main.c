@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "commit.h"     // generated at build time
+
+static const Workload workloads[] = {
+    { "pingpong",  "-n pairs exchange -m round trips each, latency per round trip",    pingpongRun,    1,      100000 },
+    { "ring",      "token passed -m laps around a ring of -n processes",               ringRun,        1000,   10 },
+    { "fanin",     "-n senders send -m messages each to one receiver",                 faninRun,       100,    10000 },
+    { "fanout",    "one sender sends -m messages to each of -n receivers",             fanoutRun,      100,    10000 },
+    { "skynet",    "tree of processes, 10 children each, down to -n leaves",           skynetRun,      100000, 0 },
+    { "chameneos", "-n chameneos meet -m times through a single broker",               chameneosRun,   100,    100000 },
+    { "saturation", "-n senders flood one receiver with a 4 message mailbox, -m each", saturationRun,  64,     1000 },
+};
+
+#define WORKLOAD_COUNT  (sizeof(workloads) / sizeof(workloads[0]))
+
+// machine and build description, so results from different runs can be told apart
+static
+void
+formatMeta(char* meta, size_t size) {
+    const char*     commit  = getenv("TCPM_BENCH_COMMIT");
+    struct utsname  un;
+    char            model[128]  = "unknown";
+    char            date[32]    = "";
+    time_t          now         = time(NULL);
+
+    if( uname(&un) != 0 ) {
+        memset(&un, 0, sizeof(un));
+    }
+    FILE*   cpuinfo = fopen("/proc/cpuinfo", "r");
+    if( cpuinfo ) {
+        char    line[256];
+        while( fgets(line, sizeof(line), cpuinfo) ) {
+            char*   colon   = strchr(line, ':');
+            if( strncmp(line, "model name", 10) == 0 && colon ) {
+                snprintf(model, sizeof(model), "%s", colon + 2);
+                model[strcspn(model, "\n\"\\")]    = '\0';
+                break;
+            }
+        }
+        fclose(cpuinfo);
+    }
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    snprintf(meta, size, "\"meta\":{\"commit\":\"%s\",\"date\":\"%s\",\"host\":\"%s\",\"system\":\"%s %s %s\",\"cpu\":\"%s\",\"cpus\":%ld},\n",
+             commit ? commit : TCPM_BENCH_COMMIT, date, un.nodename, un.sysname, un.release, un.machine, model, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+static
+void
+printResult(BenchTable* table, const BenchResult* r) {
+    uint64_t    p[5]    = { 0 };
+    if( r->latency && Histogram_count(r->latency) ) {
+        p[0]    = Histogram_percentile(r->latency, 50.0);
+        p[1]    = Histogram_percentile(r->latency, 99.0);
+        p[2]    = Histogram_percentile(r->latency, 99.9);
+        p[3]    = Histogram_percentile(r->latency, 99.99);
+        p[4]    = Histogram_max(r->latency);
+    }
+
+    benchTableString(table, r->workload);
+    benchTableU64(table, r->threads);
+    benchTableU64(table, r->processes);
+    benchTableU64(table, r->operations);
+    benchTableDouble(table, r->seconds, 6);
+    benchTableDouble(table, r->seconds > 0 ? (double)r->operations / r->seconds : 0.0, 0);
+    benchTableU64(table, r->sendFailures);
+    benchTableU64(table, r->sendFull);
+    benchTableU64(table, r->sendBusy);
+    benchTableDouble(table, r->retrySeconds, 6);
+    benchTableDouble(table, r->cpuSeconds, 6);
+    for( size_t i = 0; i < sizeof(p) / sizeof(p[0]); ++i ) {
+        benchTableU64(table, p[i]);
+    }
+    benchTableEndRow(table);
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s <workload|all> [-t threads] [-s] [-n processes] [-m messages] [-f csv|json] [-o file]\n"
+                    "       %s compare <baseline.json> <candidate.json> [-r threshold %%]\n\n"
+                    "  -s runs every workload with 1, 2, 4, ... up to -t threads\n\nworkloads:\n", argv0, argv0);
+    for( size_t w = 0; w < WORKLOAD_COUNT; ++w ) {
+        fprintf(stderr, "  %-10s %s (default -n %" PRIu32 " -m %" PRIu64 ")\n",
+                workloads[w].name, workloads[w].description, workloads[w].defaultProcesses, workloads[w].defaultMessages);
+    }
+}
+
+int
+main(int argc, char** argv) {
+    if( argc < 2 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if( strcmp(argv[1], "compare") == 0 ) {
+        return benchCompare(argc - 2, argv + 2);
+    }
+
+    const char* selected    = argv[1];
+    long        cpus        = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t    threads     = cpus > 0 ? (uint32_t)cpus : 1;
+    uint32_t    processes   = 0;
+    uint64_t    messages    = 0;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+    bool        sweep       = false;
+
+    for( int a = 2; a < argc; ++a ) {
+        if( strcmp(argv[a], "-s") == 0 ) {
+            sweep   = true;
+            continue;
+        }
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(argv[++a], NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            processes   = (uint32_t)strtoul(argv[++a], NULL, 10);
+        } else if( strcmp(argv[a], "-m") == 0 ) {
+            messages    = strtoull(argv[++a], NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(argv[++a], "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(argv[++a], "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", argv[a]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if( threads == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char        meta[1024];
+    BenchTable  table;
+    bool        found   = false;
+    formatMeta(meta, sizeof(meta));
+    benchTableBegin(&table, out, format, "workload,threads,processes,operations,seconds,ops_per_sec,send_failures,send_full,send_busy,"
+                                         "retry_cpu_s,cpu_s,p50_ns,p99_ns,p999_ns,p9999_ns,max_ns", meta);
+    // sweep: 1, 2, 4, ... and finally the requested count if not a power of 2
+    for( uint32_t t = sweep ? 1 : threads; t <= threads; t = (t == threads || t * 2 < threads) ? t * 2 : threads ) {
+        for( size_t w = 0; w < WORKLOAD_COUNT; ++w ) {
+            if( strcmp(selected, "all") != 0 && strcmp(selected, workloads[w].name) != 0 ) {
+                continue;
+            }
+            found   = true;
+
+            BenchConfig config  = {
+                .threads    = t,
+                .processes  = processes ? processes : workloads[w].defaultProcesses,
+                .messages   = messages ? messages : workloads[w].defaultMessages,
+            };
+            BenchResult result;
+            memset(&result, 0, sizeof(result));
+            result.workload = workloads[w].name;
+            result.threads  = t;
+
+            fprintf(stderr, "running %s with %" PRIu32 " threads...\n", workloads[w].name, t);
+            if( workloads[w].run(&config, &result) ) {
+                printResult(&table, &result);
+            } else {
+                fprintf(stderr, "%s failed\n", workloads[w].name);
+            }
+            free(result.latency);
+        }
+    }
+    benchTableEnd(&table);
+
+    if( out != stdout ) {
+        fclose(out);
+    }
+    if( !found ) {
+        usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
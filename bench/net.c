@@ -0,0 +1,464 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-net-bench: loopback TCP server, one process per connection
+//
+// an acceptor process waits for connections through the reactor and spawns
+// a process per accepted socket, which answers echo or minimal HTTP requests.
+// The bundled load generator runs closed-loop clients (one request in flight
+// per connection) on its own threads, outside the ProcessQueue.
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_SWEEP       16
+#define NET_BUFFER      4096
+#define ECHO_SIZE       64
+
+static const char   httpRequest[]   = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char   httpResponse[]  = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nContent-Type: text/plain\r\n\r\nok";
+
+typedef enum {
+    NM_ECHO,
+    NM_HTTP,
+} NetMode;
+
+typedef struct {
+    int         fd;
+    NetMode     mode;
+    char        ready;          // readiness message, its address is the token
+    char        in[NET_BUFFER];
+    uint32_t    inLength;
+    char        out[NET_BUFFER];
+    uint32_t    outLength;
+    uint32_t    outOffset;
+} Connection;
+
+typedef struct {
+    int                 fd;
+    NetMode             mode;
+    char                ready;
+    atomic_uint64_t     accepted;
+} Acceptor;
+
+////////////////////////////////////////////////////////////////////////////////
+// server
+////////////////////////////////////////////////////////////////////////////////
+
+static
+void
+connectionRelease(void* state) {
+    Connection* conn    = (Connection*)state;
+    close(conn->fd);
+    free(conn);
+}
+
+// false: the peer closed or failed
+static
+bool
+flushOut(Connection* conn) {
+    while( conn->outOffset < conn->outLength ) {
+        ssize_t n   = write(conn->fd, conn->out + conn->outOffset, conn->outLength - conn->outOffset);
+        if( n < 0 ) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn->outOffset    += (uint32_t)n;
+    }
+    conn->outLength = conn->outOffset = 0;
+    return true;
+}
+
+static
+void
+queueOut(Connection* conn, const char* data, uint32_t length) {
+    if( conn->outLength + length > NET_BUFFER ) {
+        return;     // clients have one request in flight, cannot happen
+    }
+    memcpy(conn->out + conn->outLength, data, length);
+    conn->outLength    += length;
+}
+
+// answer every complete request buffered so far
+static
+void
+serveRequests(Connection* conn) {
+    if( conn->mode == NM_ECHO ) {
+        queueOut(conn, conn->in, conn->inLength);
+        conn->inLength  = 0;
+        return;
+    }
+
+    uint32_t    consumed    = 0;
+    for( ;; ) {
+        char*   end = memmem(conn->in + consumed, conn->inLength - consumed, "\r\n\r\n", 4);
+        if( end == NULL ) {
+            break;
+        }
+        consumed    = (uint32_t)(end + 4 - conn->in);
+        queueOut(conn, httpResponse, sizeof(httpResponse) - 1);
+    }
+    memmove(conn->in, conn->in + consumed, conn->inLength - consumed);
+    conn->inLength -= consumed;
+}
+
+static
+ProcessContinuation
+connectionHandler(ProcessQueue* dq, void* state, void* msg) {
+    Connection* conn    = (Connection*)state;
+    PID         self    = Process_self(dq);
+
+    if( msg == &conn->ready ) {
+        if( !flushOut(conn) ) {
+            Process_unwatchFd(self, conn->fd);
+            return PCT_STOP;
+        }
+        while( conn->outLength == 0 ) {
+            ssize_t n   = read(conn->fd, conn->in + conn->inLength, NET_BUFFER - conn->inLength);
+            if( n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ) {
+                Process_unwatchFd(self, conn->fd);
+                return PCT_STOP;
+            }
+            if( n < 0 ) {
+                break;
+            }
+            conn->inLength += (uint32_t)n;
+            serveRequests(conn);
+            if( !flushOut(conn) ) {
+                Process_unwatchFd(self, conn->fd);
+                return PCT_STOP;
+            }
+        }
+    }
+    Process_watchFd(self, conn->fd, conn->outLength ? FE_WRITE : FE_READ, &conn->ready);
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+ProcessContinuation
+acceptorHandler(ProcessQueue* dq, void* state, void* msg) {
+    Acceptor*   acceptor    = (Acceptor*)state;
+    (void)msg;
+    int         fd;
+    while( (fd = accept4(acceptor->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 ) {
+        int     one     = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        Connection* conn    = (Connection*)calloc(1, sizeof(Connection));
+        conn->fd            = fd;
+        conn->mode          = acceptor->mode;
+        ProcessSpawnParameters  sp  = { 0 };
+        sp.handler              = connectionHandler;
+        sp.initialState         = conn;
+        sp.messageCap           = 2;
+        sp.maxMessagePerCycle   = 2;
+        sp.releaseState         = connectionRelease;
+        // on failure (process table full) the state is released: the connection is closed
+        ProcessQueue_spawn(dq, &sp);
+        atomic_fetch_add_explicit(&acceptor->accepted, 1, memory_order_relaxed);
+    }
+    Process_watchFd(Process_self(dq), acceptor->fd, FE_READ, &acceptor->ready);
+    return PCT_WAIT_MESSAGE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// load generator
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    int         fd;
+    uint64_t    sentNs;
+    uint32_t    received;
+} Client;
+
+typedef struct {
+    Client*     clients;
+    uint32_t    count;
+    NetMode     mode;
+    uint64_t    endNs;
+    uint64_t    requests;
+    uint64_t    errors;
+    Histogram*  latency;
+} Loader;
+
+static
+uint32_t
+responseSize(NetMode mode) {
+    return mode == NM_ECHO ? ECHO_SIZE : (uint32_t)sizeof(httpResponse) - 1;
+}
+
+static
+bool
+sendRequest(Client* client, NetMode mode) {
+    static const char   echo[ECHO_SIZE] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde";
+    const char*         data    = mode == NM_ECHO ? echo : httpRequest;
+    size_t              length  = mode == NM_ECHO ? ECHO_SIZE : sizeof(httpRequest) - 1;
+    client->sentNs      = monotonicNs();
+    client->received    = 0;
+    // requests are tiny, the socket buffer always takes them
+    return write(client->fd, data, length) == (ssize_t)length;
+}
+
+static
+void*
+loaderThread(void* loader_) {
+    Loader*             loader  = (Loader*)loader_;
+    int                 epfd    = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event  events[256];
+    char                buf[NET_BUFFER];
+    uint32_t            active  = 0;
+
+    for( uint32_t c = 0; c < loader->count; ++c ) {
+        struct epoll_event  ev  = { .events = EPOLLIN, .data.u32 = c };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, loader->clients[c].fd, &ev);
+        if( sendRequest(&loader->clients[c], loader->mode) ) {
+            ++active;
+        } else {
+            ++loader->errors;
+        }
+    }
+
+    // every client stops after its last response past the deadline
+    while( active ) {
+        int ready   = epoll_wait(epfd, events, 256, 100);
+        if( ready == 0 && monotonicNs() > loader->endNs + 1000000000ull ) {
+            loader->errors += active;   // server lost some requests
+            break;
+        }
+        for( int e = 0; e < ready; ++e ) {
+            Client* client  = &loader->clients[events[e].data.u32];
+            ssize_t n       = read(client->fd, buf, sizeof(buf));
+            if( n <= 0 ) {
+                if( n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) ) {
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+                    ++loader->errors;
+                    --active;
+                }
+                continue;
+            }
+            client->received   += (uint32_t)n;
+            if( client->received < responseSize(loader->mode) ) {
+                continue;
+            }
+            uint64_t    now = monotonicNs();
+            Histogram_record(loader->latency, now - client->sentNs);
+            ++loader->requests;
+            if( now >= loader->endNs || !sendRequest(client, loader->mode) ) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+                --active;
+            }
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+static
+int
+connectTo(uint16_t port) {
+    struct sockaddr_in  addr    = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int                 fd      = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if( fd < 0 ) {
+        return -1;
+    }
+    if( connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ) {
+        close(fd);
+        return -1;
+    }
+    int     one     = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [echo|http] [-t threads] [-l load threads] [-c connections] [-d seconds] [-f csv|json] [-o file]\n"
+                    "  -c takes a comma separated list (default 1,10,100,1000,10000)\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    long        cpus        = sysconf(_SC_NPROCESSORS_ONLN);
+    NetMode     mode        = NM_ECHO;
+    uint32_t    threads     = cpus > 0 ? (uint32_t)cpus : 1;
+    uint32_t    loadThreads = 2;
+    uint32_t    counts[MAX_SWEEP]   = { 1, 10, 100, 1000, 10000 };
+    uint32_t    countCount  = 5;
+    double      seconds     = 2.0;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    int a = 1;
+    if( a < argc && argv[a][0] != '-' ) {
+        if( strcmp(argv[a], "http") == 0 ) {
+            mode    = NM_HTTP;
+        } else if( strcmp(argv[a], "echo") != 0 ) {
+            usage(argv[0]);
+            return 1;
+        }
+        ++a;
+    }
+    for( ; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-l") == 0 ) {
+            loadThreads = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-c") == 0 ) {
+            countCount  = 0;
+            while( *arg && countCount < MAX_SWEEP ) {
+                char*   end = NULL;
+                counts[countCount++]    = (uint32_t)strtoul(arg, &end, 10);
+                arg = *end == ',' ? end + 1 : end;
+            }
+        } else if( strcmp(argv[a], "-d") == 0 ) {
+            seconds     = strtod(arg, NULL);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || loadThreads == 0 || seconds <= 0.0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // both ends of every connection live in this process
+    struct rlimit   rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    uint32_t        maxConnections  = rl.rlim_cur > 256 ? (uint32_t)((rl.rlim_cur - 128) / 2) : 64;
+    uint32_t        procCap         = 2;
+    for( uint32_t c = 0; c < countCount; ++c ) {
+        if( counts[c] > maxConnections ) {
+            fprintf(stderr, "%" PRIu32 " connections need more file descriptors, using %" PRIu32 "\n", counts[c], maxConnections);
+            counts[c]   = maxConnections;
+        }
+        procCap = counts[c] + 2 > procCap ? counts[c] + 2 : procCap;
+    }
+
+    Acceptor            acceptor    = { .mode = mode };
+    struct sockaddr_in  addr        = { .sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t           addrLength  = sizeof(addr);
+    int                 one         = 1;
+    acceptor.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    setsockopt(acceptor.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if( bind(acceptor.fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(acceptor.fd, 4096) != 0
+     || getsockname(acceptor.fd, (struct sockaddr*)&addr, &addrLength) != 0 ) {
+        perror("listen");
+        return 1;
+    }
+
+    ProcessQueue*   dq  = ProcessQueue_init(procCap, threads);
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = acceptorHandler;
+    sp.initialState         = &acceptor;
+    sp.messageCap           = 2;
+    sp.maxMessagePerCycle   = 2;
+    ProcessQueue_spawn(dq, &sp);
+
+    BenchTable  table;
+    benchTableBegin(&table, out, format, "mode,connections,threads,requests,seconds,req_per_sec,errors,p50_ns,p99_ns,p999_ns,max_ns", NULL);
+    Histogram*  latency = (Histogram*)malloc(sizeof(Histogram));
+    for( uint32_t c = 0; c < countCount; ++c ) {
+        uint32_t    count   = counts[c];
+        if( count == 0 ) {
+            continue;
+        }
+        fprintf(stderr, "%" PRIu32 " connections...\n", count);
+
+        Client*     clients = (Client*)calloc(count, sizeof(Client));
+        uint64_t    errors  = 0;
+        for( uint32_t k = 0; k < count; ++k ) {
+            clients[k].fd   = connectTo(ntohs(addr.sin_port));
+            if( clients[k].fd < 0 ) {
+                fprintf(stderr, "connect: %s\n", strerror(errno));
+                count   = k;
+                break;
+            }
+        }
+
+        uint32_t    loaders = loadThreads < count ? loadThreads : count;
+        Loader*     load    = (Loader*)calloc(loaders ? loaders : 1, sizeof(Loader));
+        pthread_t*  ids     = (pthread_t*)calloc(loaders ? loaders : 1, sizeof(pthread_t));
+        uint64_t    start   = monotonicNs();
+        for( uint32_t l = 0; l < loaders; ++l ) {
+            load[l].clients = clients + (uint64_t)count * l / loaders;
+            load[l].count   = (uint32_t)((uint64_t)count * (l + 1) / loaders - (uint64_t)count * l / loaders);
+            load[l].mode    = mode;
+            load[l].endNs   = start + (uint64_t)(seconds * 1e9);
+            load[l].latency = (Histogram*)malloc(sizeof(Histogram));
+            Histogram_init(load[l].latency);
+            pthread_create(&ids[l], NULL, loaderThread, &load[l]);
+        }
+
+        uint64_t    requests    = 0;
+        Histogram_init(latency);
+        for( uint32_t l = 0; l < loaders; ++l ) {
+            pthread_join(ids[l], NULL);
+            requests   += load[l].requests;
+            errors     += load[l].errors;
+            Histogram_merge(latency, load[l].latency);
+            free(load[l].latency);
+        }
+        double      elapsed = (double)(monotonicNs() - start) / 1e9;
+        // closing the client side stops the connection processes
+        for( uint32_t k = 0; k < count; ++k ) {
+            close(clients[k].fd);
+        }
+        while( atomic_load(&dq->procCount) > 1 ) {
+            sched_yield();
+        }
+
+        benchTableString(&table, mode == NM_ECHO ? "echo" : "http");
+        benchTableU64(&table, count);
+        benchTableU64(&table, threads);
+        benchTableU64(&table, requests);
+        benchTableDouble(&table, elapsed, 6);
+        benchTableDouble(&table, (double)requests / elapsed, 0);
+        benchTableU64(&table, errors);
+        benchTableU64(&table, Histogram_percentile(latency, 50.0));
+        benchTableU64(&table, Histogram_percentile(latency, 99.0));
+        benchTableU64(&table, Histogram_percentile(latency, 99.9));
+        benchTableU64(&table, Histogram_max(latency));
+        benchTableEndRow(&table);
+        free(ids);
+        free(load);
+        free(clients);
+    }
+    free(latency);
+    benchTableEnd(&table);
+
+    ProcessQueue_release(dq);
+    close(acceptor.fd);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return 0;
+}
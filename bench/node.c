@@ -0,0 +1,320 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-node-bench: remote PIDs between two nodes over loopback
+//
+// two ProcessQueues in this OS process, node 1 and node 2, connected by TCP
+// through their transport processes. A process on node 1 ping-pongs with a
+// process on node 2 (round trip latency), then streams messages to another
+// one (throughput, acknowledged at the end).
+////////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    NK_PING,
+    NK_DATA,
+    NK_END,
+} NodeKind;
+
+// the wire format is the struct itself, both nodes are in this OS process
+typedef struct {
+    uint32_t    kind;
+    uint32_t    fromNode;
+    uint64_t    fromId;
+    uint64_t    fromGen;
+    uint64_t    seq;
+    uint64_t    sentNs;
+} NodeMsg;
+
+static
+uint32_t
+serializeMsg(ProcessQueue* dq, void* message, void* buffer, uint32_t cap, void* ctx) {
+    (void)ctx;
+    NodeMsg*    msg = (NodeMsg*)message;
+    if( cap >= sizeof(NodeMsg) ) {
+        NodeMsg wire    = *msg;
+        // qualify local PIDs with this node
+        wire.fromNode   = wire.fromNode ? wire.fromNode : ProcessQueue_node(dq);
+        memcpy(buffer, &wire, sizeof(wire));
+    }
+    return sizeof(NodeMsg);
+}
+
+static
+void*
+deserializeMsg(ProcessQueue* dq, const void* buffer, uint32_t size, void* ctx) {
+    (void)dq;
+    (void)ctx;
+    if( size != sizeof(NodeMsg) ) {
+        return NULL;
+    }
+    NodeMsg*    msg = (NodeMsg*)malloc(sizeof(NodeMsg));
+    memcpy(msg, buffer, sizeof(NodeMsg));
+    return msg;
+}
+
+static
+void
+releaseMsg(void* message, void* ctx) {
+    (void)ctx;
+    free(message);
+}
+
+static
+PID
+sender(ProcessQueue* dq, const NodeMsg* msg) {
+    return Process_remote(dq, msg->fromNode, msg->fromId, msg->fromGen);
+}
+
+static
+NodeMsg*
+newMsg(ProcessQueue* dq, NodeKind kind, uint64_t seq) {
+    PID         self    = Process_self(dq);
+    NodeMsg*    msg     = (NodeMsg*)malloc(sizeof(NodeMsg));
+    msg->kind       = kind;
+    msg->fromNode   = self.node;
+    msg->fromId     = self.id;
+    msg->fromGen    = self.gen;
+    msg->seq        = seq;
+    msg->sentNs     = monotonicNs();
+    return msg;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// node 2: echo and sink
+////////////////////////////////////////////////////////////////////////////////
+
+static
+ProcessContinuation
+ponger(ProcessQueue* dq, void* state, void* msg) {
+    (void)state;
+    if( msg ) {
+        NodeMsg*    ping    = (NodeMsg*)msg;
+        PID         from    = sender(dq, ping);
+        PID         self    = Process_self(dq);
+        ping->fromNode  = self.node;
+        ping->fromId    = self.id;
+        ping->fromGen   = self.gen;
+        if( Process_sendMessage(from, ping, MA_KEEP) != SEND_SUCCESS ) {
+            free(ping);
+        }
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+typedef struct {
+    uint64_t    received;
+} Sink;
+
+static
+ProcessContinuation
+sink(ProcessQueue* dq, void* state, void* msg) {
+    Sink*       s   = (Sink*)state;
+    NodeMsg*    in  = (NodeMsg*)msg;
+    if( in && in->kind == NK_END ) {
+        NodeMsg*    ack = newMsg(dq, NK_END, s->received);
+        if( Process_sendMessage(sender(dq, in), ack, MA_KEEP) != SEND_SUCCESS ) {
+            free(ack);
+        }
+        s->received = 0;
+    } else if( in ) {
+        ++s->received;
+    }
+    free(in);
+    return PCT_WAIT_MESSAGE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// node 1: drivers
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    PID             target;     // remote
+    uint64_t        count;
+    uint64_t        done;
+    NodeMsg*        pending;    // not sent yet, the transport mailbox was full
+    Histogram*      latency;
+    uint64_t        acked;
+    atomic_bool     finished;
+} Driver;
+
+// false: retry later
+static
+bool
+trySend(Driver* d, NodeMsg* msg) {
+    switch( Process_sendMessage(d->target, msg, MA_KEEP) ) {
+    case SEND_SUCCESS:  d->pending = NULL; return true;
+    case SEND_FAIL:     d->pending = msg; return false;
+    case ACTOR_IS_DEAD:
+    case SEND_UNSUPPORTED:  free(msg); d->pending = NULL; return true;
+    }
+    return true;
+}
+
+static
+ProcessContinuation
+pinger(ProcessQueue* dq, void* state, void* msg) {
+    Driver*     d   = (Driver*)state;
+    if( msg ) {
+        Histogram_record(d->latency, monotonicNs() - ((NodeMsg*)msg)->sentNs);
+        free(msg);
+        if( ++d->done == d->count ) {
+            atomic_store(&d->finished, true);
+            return PCT_STOP;
+        }
+    }
+    if( !trySend(d, d->pending ? d->pending : newMsg(dq, NK_PING, d->done)) ) {
+        return PCT_CONTINUE;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+ProcessContinuation
+streamer(ProcessQueue* dq, void* state, void* msg) {
+    Driver*     d   = (Driver*)state;
+    if( msg ) {     // acknowledgement
+        d->acked    = ((NodeMsg*)msg)->seq;
+        free(msg);
+        atomic_store(&d->finished, true);
+        return PCT_STOP;
+    }
+    for( uint32_t n = 0; n < 256 && d->done <= d->count; ++n ) {
+        NodeMsg*    next    = d->pending ? d->pending : newMsg(dq, d->done < d->count ? NK_DATA : NK_END, d->done);
+        if( !trySend(d, next) ) {
+            return PCT_CONTINUE;
+        }
+        ++d->done;
+    }
+    return d->done <= d->count ? PCT_CONTINUE : PCT_WAIT_MESSAGE;
+}
+
+static
+void
+runDriver(ProcessQueue* dq, ProcessHandler handler, Driver* d) {
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = handler;
+    sp.initialState         = d;
+    sp.messageCap           = 64;
+    sp.maxMessagePerCycle   = 1;
+    ProcessQueue_spawn(dq, &sp);
+    while( !atomic_load(&d->finished) ) {
+        usleep(1000);
+    }
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads per node] [-n messages] [-f csv|json] [-o file]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 1;
+    uint64_t    messages    = 20000;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            messages    = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || messages == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    NodeSerializer  serializer  = { serializeMsg, deserializeMsg, releaseMsg, NULL };
+    ProcessQueue*   node1       = ProcessQueue_init(16, threads);
+    ProcessQueue*   node2       = ProcessQueue_init(16, threads);
+    ProcessQueue_setNode(node1, 1, &serializer);
+    ProcessQueue_setNode(node2, 2, &serializer);
+    uint16_t        port        = ProcessQueue_listen(node2, "127.0.0.1", 0);
+    if( port == 0 || !ProcessQueue_connect(node1, 2, "127.0.0.1", port) ) {
+        fprintf(stderr, "unable to connect the nodes\n");
+        return 1;
+    }
+
+    Sink                    s   = { 0 };
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = ponger;
+    sp.messageCap           = 1024;
+    sp.maxMessagePerCycle   = 64;
+    PID                     pong    = ProcessQueue_spawn(node2, &sp);
+    sp.handler              = sink;
+    sp.initialState         = &s;
+    PID                     count   = ProcessQueue_spawn(node2, &sp);
+
+    Histogram*  latency = (Histogram*)malloc(sizeof(Histogram));
+    Histogram_init(latency);
+    Driver      ping    = { .target = Process_remote(node1, 2, pong.id, pong.gen), .count = messages, .latency = latency };
+    uint64_t    start   = monotonicNs();
+    runDriver(node1, pinger, &ping);
+    double      pingSeconds     = (double)(monotonicNs() - start) / 1e9;
+
+    Driver      stream  = { .target = Process_remote(node1, 2, count.id, count.gen), .count = messages };
+    start   = monotonicNs();
+    runDriver(node1, streamer, &stream);
+    double      streamSeconds   = (double)(monotonicNs() - start) / 1e9;
+    if( stream.acked != messages ) {
+        fprintf(stderr, "stream: %" PRIu64 " messages received out of %" PRIu64 "\n", stream.acked, messages);
+    }
+
+    BenchTable  table;
+    benchTableBegin(&table, out, format, "test,threads,messages,seconds,msgs_per_sec,p50_ns,p99_ns,p999_ns,max_ns", NULL);
+    benchTableString(&table, "pingpong");
+    benchTableU64(&table, threads);
+    benchTableU64(&table, messages);
+    benchTableDouble(&table, pingSeconds, 6);
+    benchTableDouble(&table, (double)messages / pingSeconds, 0);
+    benchTableU64(&table, Histogram_percentile(latency, 50.0));
+    benchTableU64(&table, Histogram_percentile(latency, 99.0));
+    benchTableU64(&table, Histogram_percentile(latency, 99.9));
+    benchTableU64(&table, Histogram_max(latency));
+    benchTableEndRow(&table);
+    // the stream has no per message latency
+    benchTableString(&table, "stream");
+    benchTableU64(&table, threads);
+    benchTableU64(&table, stream.acked);
+    benchTableDouble(&table, streamSeconds, 6);
+    benchTableDouble(&table, (double)stream.acked / streamSeconds, 0);
+    for( uint32_t p = 0; p < 4; ++p ) {
+        benchTableU64(&table, 0);
+    }
+    benchTableEndRow(&table);
+    benchTableEnd(&table);
+
+    ProcessQueue_release(node1);
+    ProcessQueue_release(node2);
+    free(latency);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return stream.acked == messages ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+
+#include "bench.h"
+
+// pairs of processes bouncing a timestamp, the ping side records the round trip
+
+typedef struct {
+    PID                     ping;
+    PID                     pong;
+    atomic_bool             ready;
+    uint64_t                remaining;          // ping side
+    uint64_t                pongRemaining;
+    uint64_t                sendFailures;       // ping side
+    uint64_t                pongSendFailures;
+    Histogram*              latency;
+    atomic_uint_fast64_t*   done;
+} Pair;
+
+static
+ProcessContinuation
+pingHandler(ProcessQueue* dq, void* state, void* msg) {
+    Pair*   pair    = (Pair*)state;
+    (void)dq;
+    if( msg == NULL ) {
+        // wait until the pong side knows who we are
+        if( !atomic_load(&pair->ready) ) {
+            return PCT_CONTINUE;
+        }
+    } else {
+        Histogram_record(pair->latency, benchNow() - BENCH_VALUE(msg));
+        if( --pair->remaining == 0 ) {
+            atomic_fetch_add(pair->done, 1);
+            return PCT_STOP;
+        }
+    }
+    pair->sendFailures += benchSend(pair->pong, BENCH_MSG(benchNow()));
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+ProcessContinuation
+pongHandler(ProcessQueue* dq, void* state, void* msg) {
+    Pair*   pair    = (Pair*)state;
+    (void)dq;
+    if( msg ) {
+        pair->pongSendFailures += benchSend(pair->ping, msg);
+        if( --pair->pongRemaining == 0 ) {
+            return PCT_STOP;
+        }
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+bool
+pingpongRun(const BenchConfig* config, BenchResult* result) {
+    uint32_t                pairCount   = config->processes;
+    ProcessQueue*           dq          = ProcessQueue_init(2 * pairCount, config->threads);
+    Pair*                   pairs       = (Pair*)calloc(pairCount, sizeof(Pair));
+    atomic_uint_fast64_t    done        = 0;
+
+    result->latency = (Histogram*)malloc(sizeof(Histogram));
+    Histogram_init(result->latency);
+
+    uint64_t    start   = benchNow();
+    for( uint32_t p = 0; p < pairCount; ++p ) {
+        pairs[p].remaining      = config->messages;
+        pairs[p].pongRemaining  = config->messages;
+        pairs[p].latency    = result->latency;
+        pairs[p].done       = &done;
+        pairs[p].pong       = benchSpawn(dq, pongHandler, &pairs[p], 2, NULL);
+        pairs[p].ping       = benchSpawn(dq, pingHandler, &pairs[p], 2, NULL);
+        atomic_store(&pairs[p].ready, true);
+    }
+    benchWait(&done, pairCount);
+    uint64_t    end     = benchNow();
+
+    ProcessQueue_release(dq);
+    for( uint32_t p = 0; p < pairCount; ++p ) {
+        result->sendFailures   += pairs[p].sendFailures + pairs[p].pongSendFailures;
+    }
+    result->processes   = 2 * pairCount;
+    result->operations  = 2 * pairCount * config->messages;
+    result->seconds     = (double)(end - start) / 1e9;
+    free(pairs);
+    return true;
+}
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-queue-bench: BoundedQueue in isolation, P producers and C consumers
+//
+// producers push their send time as the element, consumers record the
+// enqueue to dequeue latency
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_SWEEP       16
+
+typedef struct {
+    BoundedQueue*           queue;
+    uint32_t                cpu;
+    bool                    pin;
+    uint64_t                operations;     // producers: elements to push
+    uint64_t                total;          // consumers: elements to pop, all consumers
+    uint64_t                full;           // push returned false
+    uint64_t                empty;          // pop returned NULL
+    Histogram*              latency;        // consumers only
+    atomic_bool*            start;
+    atomic_uint_fast64_t*   popped;
+} Actor;
+
+typedef struct {
+    uint32_t    values[MAX_SWEEP];
+    uint32_t    count;
+} Sweep;
+
+static
+void
+pinThread(uint32_t cpu) {
+    cpu_set_t   set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static
+void*
+producer(void* actor_) {
+    Actor*  actor   = (Actor*)actor_;
+    if( actor->pin ) {
+        pinThread(actor->cpu);
+    }
+    while( !atomic_load_explicit(actor->start, memory_order_acquire) ) {}
+
+    for( uint64_t i = 0; i < actor->operations; ++i ) {
+        while( !BoundedQueue_push(actor->queue, (void*)(uintptr_t)monotonicNs()) ) {
+            ++actor->full;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static
+void*
+consumer(void* actor_) {
+    Actor*  actor   = (Actor*)actor_;
+    if( actor->pin ) {
+        pinThread(actor->cpu);
+    }
+    while( !atomic_load_explicit(actor->start, memory_order_acquire) ) {}
+
+    while( atomic_load_explicit(actor->popped, memory_order_relaxed) < actor->total ) {
+        void*   el  = BoundedQueue_pop(actor->queue);
+        if( el == NULL ) {
+            ++actor->empty;
+            sched_yield();
+        } else {
+            Histogram_record(actor->latency, monotonicNs() - (uint64_t)(uintptr_t)el);
+            atomic_fetch_add_explicit(actor->popped, 1, memory_order_relaxed);
+        }
+    }
+    return NULL;
+}
+
+static
+void
+runOnce(BenchTable* table, uint32_t producers, uint32_t consumers, uint32_t cap, uint64_t operations, bool pin) {
+    long                    cpus    = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t                threads = producers + consumers;
+    BoundedQueue            queue;
+    Actor*                  actors  = (Actor*)calloc(threads, sizeof(Actor));
+    pthread_t*              ids     = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    Histogram*              latency = (Histogram*)malloc(sizeof(Histogram));
+    atomic_bool             start   = false;
+    atomic_uint_fast64_t    popped  = 0;
+
+    BoundedQueue_init(&queue, cap, NULL);
+    Histogram_init(latency);
+
+    for( uint32_t t = 0; t < threads; ++t ) {
+        Actor*  actor       = &actors[t];
+        actor->queue        = &queue;
+        actor->cpu          = t % (uint32_t)(cpus > 0 ? cpus : 1);
+        actor->pin          = pin;
+        actor->operations   = operations;
+        actor->total        = operations * producers;
+        actor->start        = &start;
+        actor->popped       = &popped;
+        if( t >= producers ) {
+            actor->latency  = (Histogram*)malloc(sizeof(Histogram));
+            Histogram_init(actor->latency);
+        }
+        pthread_create(&ids[t], NULL, t < producers ? producer : consumer, actor);
+    }
+
+    uint64_t    begin   = monotonicNs();
+    atomic_store_explicit(&start, true, memory_order_release);
+    for( uint32_t t = 0; t < threads; ++t ) {
+        pthread_join(ids[t], NULL);
+    }
+    double      seconds = (double)(monotonicNs() - begin) / 1e9;
+
+    uint64_t    full    = 0;
+    uint64_t    empty   = 0;
+    for( uint32_t t = 0; t < threads; ++t ) {
+        full   += actors[t].full;
+        empty  += actors[t].empty;
+        if( actors[t].latency ) {
+            Histogram_merge(latency, actors[t].latency);
+            free(actors[t].latency);
+        }
+    }
+
+    uint64_t    total   = operations * producers;
+    benchTableU64(table, producers);
+    benchTableU64(table, consumers);
+    benchTableU64(table, cap);
+    benchTableU64(table, total);
+    benchTableDouble(table, seconds, 6);
+    benchTableDouble(table, seconds > 0 ? (double)total / seconds : 0.0, 0);
+    benchTableU64(table, full);
+    benchTableU64(table, empty);
+    benchTableU64(table, Histogram_percentile(latency, 50.0));
+    benchTableU64(table, Histogram_percentile(latency, 99.0));
+    benchTableU64(table, Histogram_percentile(latency, 99.9));
+    benchTableU64(table, Histogram_percentile(latency, 99.99));
+    benchTableU64(table, Histogram_max(latency));
+    benchTableEndRow(table);
+
+    BoundedQueue_release(&queue);
+    free(latency);
+    free(ids);
+    free(actors);
+}
+
+static
+bool
+parseSweep(const char* arg, Sweep* sweep) {
+    sweep->count    = 0;
+    while( *arg && sweep->count < MAX_SWEEP ) {
+        char*   end     = NULL;
+        unsigned long   value   = strtoul(arg, &end, 10);
+        if( end == arg || value == 0 ) {
+            return false;
+        }
+        sweep->values[sweep->count++]   = (uint32_t)value;
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return sweep->count > 0;
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-p producers] [-c consumers] [-q capacities] [-n pushes per producer] [-u] [-f csv|json] [-o file]\n"
+                    "  -p, -c and -q take comma separated lists (default 1,2,4 / 1,2,4 / 64,1024,65536)\n"
+                    "  -u leaves the threads unpinned\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    Sweep       producers   = { { 1, 2, 4 }, 3 };
+    Sweep       consumers   = { { 1, 2, 4 }, 3 };
+    Sweep       capacities  = { { 64, 1024, 65536 }, 3 };
+    uint64_t    operations  = 1000000;
+    bool        pin         = true;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; ++a ) {
+        if( strcmp(argv[a], "-u") == 0 ) {
+            pin     = false;
+            continue;
+        }
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[++a];
+        bool        ok  = true;
+        if( strcmp(argv[a - 1], "-p") == 0 ) {
+            ok  = parseSweep(arg, &producers);
+        } else if( strcmp(argv[a - 1], "-c") == 0 ) {
+            ok  = parseSweep(arg, &consumers);
+        } else if( strcmp(argv[a - 1], "-q") == 0 ) {
+            ok  = parseSweep(arg, &capacities);
+        } else if( strcmp(argv[a - 1], "-n") == 0 ) {
+            operations  = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a - 1], "-f") == 0 ) {
+            format  = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a - 1], "-o") == 0 ) {
+            out     = fopen(arg, "w");
+            ok      = out != NULL;
+        } else {
+            ok      = false;
+        }
+        if( !ok ) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    BenchTable  table;
+    benchTableBegin(&table, out, format, "producers,consumers,capacity,operations,seconds,ops_per_sec,push_full,pop_empty,"
+                                         "p50_ns,p99_ns,p999_ns,p9999_ns,max_ns", NULL);
+    for( uint32_t q = 0; q < capacities.count; ++q ) {
+        for( uint32_t p = 0; p < producers.count; ++p ) {
+            for( uint32_t c = 0; c < consumers.count; ++c ) {
+                runOnce(&table, producers.values[p], consumers.values[c], capacities.values[q], operations, pin);
+            }
+        }
+    }
+    benchTableEnd(&table);
+
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+
+#include "bench.h"
+
+// a single token travels -m laps around a ring of -n processes
+
+typedef struct {
+    PID                     next;
+    uint64_t                sendFailures;
+    atomic_uint_fast64_t*   done;
+} RingNode;
+
+static
+ProcessContinuation
+ringHandler(ProcessQueue* dq, void* state, void* msg) {
+    RingNode*   node    = (RingNode*)state;
+    (void)dq;
+    if( msg ) {
+        uint64_t    hops    = BENCH_VALUE(msg);
+        if( hops == 0 ) {
+            atomic_store(node->done, 1);
+        } else {
+            node->sendFailures += benchSend(node->next, BENCH_MSG(hops - 1));
+        }
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+bool
+ringRun(const BenchConfig* config, BenchResult* result) {
+    uint32_t                count   = config->processes;
+    uint64_t                hops    = (uint64_t)count * config->messages;
+    ProcessQueue*           dq      = ProcessQueue_init(count, config->threads);
+    RingNode*               nodes   = (RingNode*)calloc(count, sizeof(RingNode));
+    PID*                    pids    = (PID*)calloc(count, sizeof(PID));
+    atomic_uint_fast64_t    done    = 0;
+
+    for( uint32_t n = 0; n < count; ++n ) {
+        nodes[n].done   = &done;
+        pids[n]         = benchSpawn(dq, ringHandler, &nodes[n], 2, NULL);
+    }
+    // the processes only read their neighbour once the token reaches them
+    for( uint32_t n = 0; n < count; ++n ) {
+        nodes[n].next   = pids[(n + 1) % count];
+    }
+
+    uint64_t    start   = benchNow();
+    result->sendFailures    = benchSend(pids[0], BENCH_MSG(hops));
+    benchWait(&done, 1);
+    uint64_t    end     = benchNow();
+
+    ProcessQueue_release(dq);
+    for( uint32_t n = 0; n < count; ++n ) {
+        result->sendFailures   += nodes[n].sendFailures;
+    }
+    result->processes   = count;
+    result->operations  = hops;
+    result->seconds     = (double)(end - start) / 1e9;
+    free(pids);
+    free(nodes);
+    return true;
+}
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "internals.h"
+
+// -n senders flood one receiver with a tiny mailbox: measures how often sends
+// fail, whether on a full mailbox or on a busy release lock, and the CPU time
+// burnt retrying them
+
+#define SATURATION_MAILBOX  4
+#define SATURATION_SPINS    64      // retries before giving the worker back
+
+typedef struct {
+    PID                     receiver;
+    uint64_t                remaining;
+    uint64_t                sendFailures;
+    uint64_t                sendFull;       // mailbox found full after the failure
+    uint64_t                retryNs;        // thread CPU time spent in failed sends
+} Sender;
+
+typedef struct {
+    uint64_t                received;
+    uint64_t                expected;
+    atomic_uint_fast64_t*   done;
+} Receiver;
+
+static
+uint64_t
+threadCpuNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static
+ProcessContinuation
+senderHandler(ProcessQueue* dq, void* state, void* msg) {
+    Sender*     sender  = (Sender*)state;
+    (void)msg;
+    if( Process_sendMessage(sender->receiver, BENCH_MSG(sender->remaining), MA_KEEP) == SEND_SUCCESS ) {
+        return --sender->remaining == 0 ? PCT_STOP : PCT_CONTINUE;
+    }
+
+    // spin on the send like an eager producer would, the worker is given
+    // back after SATURATION_SPINS failures
+    BoundedQueue*   mailbox = &dq->processes[sender->receiver.id].messageQueue;
+    uint64_t        start   = threadCpuNs();
+    for( uint32_t spin = 0; spin < SATURATION_SPINS; ++spin ) {
+        ++sender->sendFailures;
+        // racy, only used without TCPM_METRICS
+        if( BoundedQueue_size(mailbox) >= mailbox->cap ) {
+            ++sender->sendFull;
+        }
+        if( Process_sendMessage(sender->receiver, BENCH_MSG(sender->remaining), MA_KEEP) == SEND_SUCCESS ) {
+            sender->retryNs    += threadCpuNs() - start;
+            return --sender->remaining == 0 ? PCT_STOP : PCT_CONTINUE;
+        }
+    }
+    ++sender->sendFailures;
+    sender->retryNs    += threadCpuNs() - start;
+    return PCT_CONTINUE;
+}
+
+static
+ProcessContinuation
+receiverHandler(ProcessQueue* dq, void* state, void* msg) {
+    Receiver*   receiver    = (Receiver*)state;
+    (void)dq;
+    if( msg && ++receiver->received == receiver->expected ) {
+        atomic_store(receiver->done, 1);
+        return PCT_STOP;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+double
+processCpuSeconds(void) {
+    struct rusage   ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+bool
+saturationRun(const BenchConfig* config, BenchResult* result) {
+    uint32_t                count       = config->processes;
+    ProcessQueue*           dq          = ProcessQueue_init(count + 1, config->threads);
+    Sender*                 senders     = (Sender*)calloc(count, sizeof(Sender));
+    atomic_uint_fast64_t    done        = 0;
+    Receiver                receiver    = { .received = 0, .expected = (uint64_t)count * config->messages, .done = &done };
+
+    double      cpuStart    = processCpuSeconds();
+    uint64_t    start       = benchNow();
+    PID         pid         = benchSpawn(dq, receiverHandler, &receiver, SATURATION_MAILBOX, NULL);
+    for( uint32_t s = 0; s < count; ++s ) {
+        senders[s].receiver     = pid;
+        senders[s].remaining    = config->messages;
+        benchSpawn(dq, senderHandler, &senders[s], 1, NULL);
+    }
+    benchWait(&done, 1);
+    uint64_t    end         = benchNow();
+    double      cpuEnd      = processCpuSeconds();
+
+    ProcessQueueCounters    counters;
+    bool                    exact   = ProcessQueue_counters(dq, &counters);
+    ProcessQueue_release(dq);
+
+    uint64_t    retryNs     = 0;
+    for( uint32_t s = 0; s < count; ++s ) {
+        result->sendFailures   += senders[s].sendFailures;
+        result->sendFull       += senders[s].sendFull;
+        retryNs                += senders[s].retryNs;
+    }
+    if( exact ) {
+        result->sendFull    = counters.sendFull;
+        result->sendBusy    = counters.sendBusy;
+    } else {
+        result->sendBusy    = result->sendFailures - result->sendFull;
+    }
+    result->retrySeconds    = (double)retryNs / 1e9;
+    result->cpuSeconds      = cpuEnd - cpuStart;
+    result->processes       = count + 1;
+    result->operations      = receiver.received;
+    result->seconds         = (double)(end - start) / 1e9;
+    free(senders);
+    return true;
+}
@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-shm-bench: messages between two OS processes
+//
+// the parent talks to a tcpm process in a forked child, once over a pair of
+// shared channels and once over a Unix seqpacket socket pair watched by the
+// reactor. Each transport runs a ping-pong (round trip latency) and a stream
+// (one way throughput, acknowledged at the end).
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_PAYLOAD     4096
+
+typedef enum {
+    BK_PING,
+    BK_DATA,
+    BK_END,
+    BK_QUIT,
+} BenchKind;
+
+typedef struct {
+    uint32_t    kind;
+    uint32_t    seq;
+} BenchHeader;
+
+typedef struct {
+    SharedChannel*  in;
+    SharedChannel*  out;
+    int             fd;
+    char            ready;
+    uint64_t        received;
+    unsigned char   buffer[MAX_PAYLOAD];
+} Receiver;
+
+////////////////////////////////////////////////////////////////////////////////
+// child: one tcpm process per transport
+////////////////////////////////////////////////////////////////////////////////
+
+static
+void
+channelReply(SharedChannel* out, uint32_t kind, uint32_t seq) {
+    BenchHeader reply   = { kind, seq };
+    while( !SharedChannel_send(out, &reply, sizeof(reply)) ) {
+        sched_yield();
+    }
+}
+
+// false: told to quit
+static
+bool
+handlePayload(Receiver* rcv, const BenchHeader* header, void (*reply)(Receiver*, uint32_t, uint32_t)) {
+    switch( header->kind ) {
+    case BK_PING:   reply(rcv, BK_PING, header->seq); break;
+    case BK_DATA:   ++rcv->received; break;
+    case BK_END:    reply(rcv, BK_END, (uint32_t)rcv->received); rcv->received = 0; break;
+    case BK_QUIT:   return false;
+    }
+    return true;
+}
+
+static
+void
+replyChannel(Receiver* rcv, uint32_t kind, uint32_t seq) {
+    channelReply(rcv->out, kind, seq);
+}
+
+static
+void
+replySocket(Receiver* rcv, uint32_t kind, uint32_t seq) {
+    BenchHeader reply   = { kind, seq };
+    while( write(rcv->fd, &reply, sizeof(reply)) < 0 && (errno == EAGAIN || errno == EINTR) ) {
+        sched_yield();
+    }
+}
+
+static
+ProcessContinuation
+channelReceiver(ProcessQueue* dq, void* state, void* msg) {
+    Receiver*   rcv     = (Receiver*)state;
+    uint32_t    size    = 0;
+    (void)msg;
+    while( SharedChannel_receive(rcv->in, rcv->buffer, &size) ) {
+        if( !handlePayload(rcv, (BenchHeader*)rcv->buffer, replyChannel) ) {
+            Process_unwatchChannel(Process_self(dq), rcv->in);
+            return PCT_STOP;
+        }
+    }
+    Process_watchChannel(Process_self(dq), rcv->in, &rcv->ready);
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+ProcessContinuation
+socketReceiver(ProcessQueue* dq, void* state, void* msg) {
+    Receiver*   rcv     = (Receiver*)state;
+    (void)msg;
+    while( read(rcv->fd, rcv->buffer, sizeof(rcv->buffer)) > 0 ) {
+        if( !handlePayload(rcv, (BenchHeader*)rcv->buffer, replySocket) ) {
+            Process_unwatchFd(Process_self(dq), rcv->fd);
+            return PCT_STOP;
+        }
+    }
+    Process_watchFd(Process_self(dq), rcv->fd, FE_READ, &rcv->ready);
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+int
+runChild(const char* pingName, const char* pongName, int fd, uint32_t threads) {
+    Receiver    channel = { .in = SharedChannel_open(pingName), .out = SharedChannel_open(pongName), .fd = -1 };
+    Receiver    socket  = { .fd = fd };
+    if( channel.in == NULL || channel.out == NULL ) {
+        fprintf(stderr, "child: unable to open the channels\n");
+        return 1;
+    }
+
+    ProcessQueue*           dq  = ProcessQueue_init(4, threads);
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = channelReceiver;
+    sp.initialState         = &channel;
+    sp.messageCap           = 2;
+    sp.maxMessagePerCycle   = 2;
+    ProcessQueue_spawn(dq, &sp);
+    sp.handler              = socketReceiver;
+    sp.initialState         = &socket;
+    ProcessQueue_spawn(dq, &sp);
+
+    while( atomic_load(&dq->procCount) > 0 ) {
+        usleep(1000);
+    }
+    ProcessQueue_release(dq);
+    SharedChannel_close(channel.in);
+    SharedChannel_close(channel.out);
+    close(fd);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// parent: plain thread driving both transports
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const char* name;
+    void        (*send)     (void* ctx, const void* payload, uint32_t size);
+    void        (*receive)  (void* ctx, BenchHeader* header);
+    void*       ctx;
+} Transport;
+
+typedef struct {
+    SharedChannel*  ping;
+    SharedChannel*  pong;
+} ChannelPair;
+
+static
+void
+channelSend(void* ctx, const void* payload, uint32_t size) {
+    ChannelPair*    pair    = (ChannelPair*)ctx;
+    while( !SharedChannel_send(pair->ping, payload, size) ) {
+        sched_yield();
+    }
+}
+
+static
+void
+channelReceive(void* ctx, BenchHeader* header) {
+    ChannelPair*    pair    = (ChannelPair*)ctx;
+    while( !SharedChannel_receive(pair->pong, header, NULL) ) {
+        sched_yield();
+    }
+}
+
+static
+void
+socketSend(void* ctx, const void* payload, uint32_t size) {
+    while( write(*(int*)ctx, payload, size) < 0 && errno == EINTR ) {}
+}
+
+static
+void
+socketReceive(void* ctx, BenchHeader* header) {
+    while( read(*(int*)ctx, header, sizeof(BenchHeader)) < 0 && errno == EINTR ) {}
+}
+
+static
+void
+report(BenchTable* table, const char* transport, const char* test, uint64_t messages, uint32_t size,
+       double seconds, const Histogram* latency) {
+    benchTableString(table, transport);
+    benchTableString(table, test);
+    benchTableU64(table, messages);
+    benchTableU64(table, size);
+    benchTableDouble(table, seconds, 6);
+    benchTableDouble(table, (double)messages / seconds, 0);
+    benchTableU64(table, latency ? Histogram_percentile(latency, 50.0) : 0);
+    benchTableU64(table, latency ? Histogram_percentile(latency, 99.0) : 0);
+    benchTableU64(table, latency ? Histogram_percentile(latency, 99.9) : 0);
+    benchTableU64(table, latency ? Histogram_max(latency) : 0);
+    benchTableEndRow(table);
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n messages] [-s payload bytes] [-q channel cap] [-f csv|json] [-o file]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 1;
+    uint64_t    messages    = 100000;
+    uint32_t    size        = 64;
+    uint32_t    cap         = 1024;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            messages    = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-s") == 0 ) {
+            size        = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-q") == 0 ) {
+            cap         = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || messages == 0 || cap == 0 || size < sizeof(BenchHeader) || size > MAX_PAYLOAD ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char        pingName[64];
+    char        pongName[64];
+    snprintf(pingName, sizeof(pingName), "/tcpm-shm-bench.%d.ping", (int)getpid());
+    snprintf(pongName, sizeof(pongName), "/tcpm-shm-bench.%d.pong", (int)getpid());
+    ChannelPair pair    = { SharedChannel_create(pingName, cap, size), SharedChannel_create(pongName, cap, sizeof(BenchHeader)) };
+    int         fds[2];
+    if( pair.ping == NULL || pair.pong == NULL || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0 ) {
+        fprintf(stderr, "unable to create the transports\n");
+        SharedChannel_unlink(pingName);
+        SharedChannel_unlink(pongName);
+        return 1;
+    }
+
+    pid_t       child   = fork();
+    if( child == 0 ) {
+        SharedChannel_close(pair.ping);
+        SharedChannel_close(pair.pong);
+        close(fds[0]);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        _exit(runChild(pingName, pongName, fds[1], threads));
+    }
+    close(fds[1]);
+
+    Transport   transports[]    = {
+        { "channel", channelSend, channelReceive, &pair },
+        { "socket",  socketSend,  socketReceive,  &fds[0] },
+    };
+    unsigned char   payload[MAX_PAYLOAD];
+    BenchHeader*    header  = (BenchHeader*)payload;
+    BenchHeader     reply;
+    Histogram*      latency = (Histogram*)malloc(sizeof(Histogram));
+    BenchTable      table;
+    memset(payload, 0xab, sizeof(payload));
+
+    benchTableBegin(&table, out, format, "transport,test,messages,payload,seconds,msgs_per_sec,p50_ns,p99_ns,p999_ns,max_ns", NULL);
+    for( size_t t = 0; t < sizeof(transports) / sizeof(transports[0]); ++t ) {
+        Transport*  tr  = &transports[t];
+
+        Histogram_init(latency);
+        uint64_t    start   = monotonicNs();
+        for( uint64_t m = 0; m < messages; ++m ) {
+            uint64_t    sent    = monotonicNs();
+            header->kind    = BK_PING;
+            header->seq     = (uint32_t)m;
+            tr->send(tr->ctx, payload, size);
+            tr->receive(tr->ctx, &reply);
+            Histogram_record(latency, monotonicNs() - sent);
+        }
+        report(&table, tr->name, "pingpong", messages, size, (double)(monotonicNs() - start) / 1e9, latency);
+
+        start   = monotonicNs();
+        header->kind    = BK_DATA;
+        for( uint64_t m = 0; m < messages; ++m ) {
+            tr->send(tr->ctx, payload, size);
+        }
+        header->kind    = BK_END;
+        tr->send(tr->ctx, payload, size);
+        tr->receive(tr->ctx, &reply);
+        if( reply.seq != (uint32_t)messages ) {
+            fprintf(stderr, "%s: %" PRIu32 " messages received out of %" PRIu64 "\n", tr->name, reply.seq, messages);
+        }
+        report(&table, tr->name, "stream", messages, size, (double)(monotonicNs() - start) / 1e9, NULL);
+
+        header->kind    = BK_QUIT;
+        tr->send(tr->ctx, payload, size);
+    }
+    benchTableEnd(&table);
+
+    int status  = 0;
+    waitpid(child, &status, 0);
+    free(latency);
+    SharedChannel_close(pair.ping);
+    SharedChannel_close(pair.pong);
+    SharedChannel_unlink(pingName);
+    SharedChannel_unlink(pongName);
+    close(fds[0]);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-signal-bench: Process_watchSignal delivery
+//
+//   roundtrip  -n SIGUSR1 raised with kill(), one at a time: latency until the
+//              routed process has the SignalInfo, sender checked
+//   child      children exiting with known statuses: SIGCHLD routed to a
+//              process that reaps them, none left behind
+//   unwatched  SIGUSR2 raised after Process_unwatchSignal: dropped, neither
+//              delivered nor fatal
+//
+// The signals are blocked before ProcessQueue_init so that the workers are
+// created with them blocked (see Process_watchSignal in the README). Any
+// violation makes the exit code 1.
+////////////////////////////////////////////////////////////////////////////////
+
+#define CHILD_MAX           100
+#define UNWATCHED_SIGNALS   100
+#define WAIT_NS             (5ull * 1000 * 1000 * 1000)
+
+typedef struct {
+    atomic_uint64_t received;
+    atomic_uint64_t receivedNs; // monotonic, when the last SIGUSR1 reached the process
+    atomic_uint64_t reaped;
+    atomic_uint64_t statusSum;  // exit statuses of the reaped children
+    atomic_uint64_t errors;     // wrong signal, code or sender
+    atomic_bool     stop;
+} Shared;
+
+typedef struct {
+    const char*     test;
+    uint64_t        count;
+    double          seconds;
+    uint64_t        errors;
+    uint64_t        lost;
+} Result;
+
+static
+ProcessContinuation
+signalReceiver(ProcessQueue* dq, void* state, void* msg) {
+    Shared*     s       = (Shared*)state;
+    (void)dq;
+    if( msg ) {
+        SignalInfo* info    = (SignalInfo*)msg;
+        if( info->signo == SIGCHLD ) {
+            // merged while pending: one SIGCHLD may stand for several children
+            int     status;
+            pid_t   child;
+            while( (child = waitpid(-1, &status, WNOHANG)) > 0 ) {
+                atomic_fetch_add(&s->statusSum, WIFEXITED(status) ? (uint64_t)WEXITSTATUS(status) : 1000);
+                atomic_fetch_add(&s->reaped, 1);
+            }
+        } else if( info->signo != SIGUSR1 || info->code != SI_USER
+                || info->senderPid != (uint32_t)getpid() || info->senderUid != (uint32_t)getuid() ) {
+            atomic_fetch_add(&s->errors, 1);
+        } else {
+            atomic_store(&s->receivedNs, monotonicNs());
+        }
+        atomic_fetch_add(&s->received, 1);
+        free(info);
+    }
+    return atomic_load(&s->stop) ? PCT_STOP : PCT_WAIT_MESSAGE;
+}
+
+static
+bool
+waitFor(atomic_uint64_t* counter, uint64_t target) {
+    uint64_t    deadline    = monotonicNs() + WAIT_NS;
+    while( atomic_load(counter) < target ) {
+        if( monotonicNs() > deadline ) {
+            return false;
+        }
+        sched_yield();
+    }
+    return true;
+}
+
+static
+void
+roundtrip(Shared* s, uint64_t count, Histogram* latency, Result* r) {
+    uint64_t    start   = monotonicNs();
+    uint64_t    lost    = 0;
+    atomic_store(&s->received, 0);
+    for( uint64_t i = 0; i < count; ++i ) {
+        uint64_t    sent    = monotonicNs();
+        kill(getpid(), SIGUSR1);
+        if( !waitFor(&s->received, i + 1) ) {
+            lost    = count - atomic_load(&s->received);
+            break;
+        }
+        // not when this thread notices: it may wait for a core behind the workers
+        Histogram_record(latency, atomic_load(&s->receivedNs) - sent);
+    }
+    *r  = (Result){ .test = "roundtrip", .count = count, .seconds = (double)(monotonicNs() - start) / 1e9,
+                    .errors = atomic_load(&s->errors), .lost = lost };
+}
+
+static
+void
+children(Shared* s, uint64_t count, Result* r) {
+    uint64_t    start       = monotonicNs();
+    uint64_t    expected    = 0;
+    atomic_store(&s->reaped, 0);
+    atomic_store(&s->statusSum, 0);
+    for( uint64_t c = 0; c < count; ++c ) {
+        pid_t   child   = fork();
+        if( child == 0 ) {
+            _exit((int)(c % 100));
+        }
+        if( child < 0 ) {
+            fprintf(stderr, "fork failed\n");
+            exit(1);
+        }
+        expected    += c % 100;
+    }
+    waitFor(&s->reaped, count);
+    uint64_t    reaped  = atomic_load(&s->reaped);
+    *r  = (Result){ .test = "child", .count = count, .seconds = (double)(monotonicNs() - start) / 1e9,
+                    .errors = reaped == count && atomic_load(&s->statusSum) != expected, .lost = count - reaped };
+}
+
+static
+void
+unwatched(ProcessQueue* dq, Shared* s, PID receiver, Result* r) {
+    uint64_t    start   = monotonicNs();
+    uint64_t    before  = atomic_load(&s->received);
+    Process_watchSignal(receiver, SIGUSR2);
+    Process_unwatchSignal(dq, SIGUSR2);
+    for( uint32_t i = 0; i < UNWATCHED_SIGNALS; ++i ) {
+        kill(getpid(), SIGUSR2);
+    }
+    // still pending until a worker reads it from the signalfd
+    uint64_t    deadline    = monotonicNs() + WAIT_NS;
+    sigset_t    pending;
+    do {
+        sched_yield();
+        sigpending(&pending);
+    } while( sigismember(&pending, SIGUSR2) && monotonicNs() < deadline );
+    *r  = (Result){ .test = "unwatched", .count = UNWATCHED_SIGNALS, .seconds = (double)(monotonicNs() - start) / 1e9,
+                    .errors = atomic_load(&s->received) - before, .lost = sigismember(&pending, SIGUSR2) };
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n signals] [-f csv|json] [-o file]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 1;
+    uint64_t    count       = 10000;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            count       = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || count == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // inherited by the workers: no window where a worker runs the default action
+    sigset_t        routed;
+    sigemptyset(&routed);
+    sigaddset(&routed, SIGUSR1);
+    sigaddset(&routed, SIGUSR2);
+    sigaddset(&routed, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &routed, NULL);
+
+    Shared          s       = { 0 };
+    Histogram*      latency = (Histogram*)malloc(sizeof(Histogram));
+    Histogram_init(latency);
+    ProcessQueue*   dq      = ProcessQueue_init(16, threads);
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = signalReceiver;
+    sp.initialState         = &s;
+    sp.messageCap           = 256;
+    sp.maxMessagePerCycle   = 256;
+    sp.messageRelease       = free;
+    PID             receiver    = ProcessQueue_spawn(dq, &sp);
+    if( !Process_watchSignal(receiver, SIGUSR1) || !Process_watchSignal(receiver, SIGCHLD) ) {
+        fprintf(stderr, "unable to watch signals\n");
+        return 1;
+    }
+
+    Result          results[3];
+    fprintf(stderr, "roundtrip...\n");
+    roundtrip(&s, count, latency, &results[0]);
+    fprintf(stderr, "child...\n");
+    children(&s, count < CHILD_MAX ? count : CHILD_MAX, &results[1]);
+    fprintf(stderr, "unwatched...\n");
+    unwatched(dq, &s, receiver, &results[2]);
+
+    atomic_store(&s.stop, true);
+    kill(getpid(), SIGUSR1);
+    while( atomic_load(&dq->procCount) ) {
+        sched_yield();
+    }
+    ProcessQueue_release(dq);
+
+    bool            failed  = false;
+    BenchTable      table;
+    benchTableBegin(&table, out, format, "test,threads,signals,seconds,ns_per_signal,p50_ns,p99_ns,errors,lost", NULL);
+    for( size_t i = 0; i < sizeof(results) / sizeof(results[0]); ++i ) {
+        Result*     r   = &results[i];
+        failed  = failed || r->errors || r->lost;
+        benchTableString(&table, r->test);
+        benchTableU64(&table, threads);
+        benchTableU64(&table, r->count);
+        benchTableDouble(&table, r->seconds, 6);
+        benchTableDouble(&table, r->seconds * 1e9 / (double)r->count, 1);
+        benchTableU64(&table, i == 0 ? Histogram_percentile(latency, 50.0) : 0);
+        benchTableU64(&table, i == 0 ? Histogram_percentile(latency, 99.0) : 0);
+        benchTableU64(&table, r->errors);
+        benchTableU64(&table, r->lost);
+        benchTableEndRow(&table);
+    }
+    benchTableEnd(&table);
+
+    free(latency);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return failed ? 1 : 0;
+}
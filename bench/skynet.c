@@ -0,0 +1,112 @@
+#include <stdlib.h>
+
+#include "bench.h"
+
+// skynet: every process spawns 10 children until the leaves are reached,
+// leaves send their number to their parent which sends the sum up
+
+#define SKYNET_FANOUT   10
+
+typedef struct {
+    PID                     parent;         // parent.pq == NULL for the root
+    uint64_t                number;         // first leaf number of the subtree
+    uint64_t                size;           // leaves in the subtree
+    uint64_t                sum;
+    uint32_t                spawned;
+    uint32_t                received;
+    uint64_t                sendFailures;
+    atomic_uint_fast64_t*   result;         // root only: sum + 1
+    atomic_uint_fast64_t*   sendFailuresTotal;
+} Node;
+
+static
+void
+nodeRelease(void* state) {
+    Node*   node    = (Node*)state;
+    atomic_fetch_add(node->sendFailuresTotal, node->sendFailures);
+    free(node);
+}
+
+static
+ProcessContinuation
+skynetHandler(ProcessQueue* dq, void* state, void* msg) {
+    Node*   node    = (Node*)state;
+
+    if( node->size == 1 ) {
+        node->sendFailures += benchSend(node->parent, BENCH_MSG(node->number));
+        return PCT_STOP;
+    }
+
+    if( msg == NULL ) {
+        // spawn the children, one cycle at a time if the process table is full
+        uint64_t    childSize   = node->size / SKYNET_FANOUT;
+        while( node->spawned < SKYNET_FANOUT ) {
+            Node*   child   = (Node*)calloc(1, sizeof(Node));
+            child->parent   = Process_self(dq);
+            child->number   = node->number + node->spawned * childSize;
+            child->size     = childSize;
+            child->sendFailuresTotal    = node->sendFailuresTotal;
+
+            ProcessSpawnParameters  sp  = { 0 };
+            sp.handler              = skynetHandler;
+            sp.initialState         = child;
+            sp.messageCap           = SKYNET_FANOUT;
+            sp.maxMessagePerCycle   = SKYNET_FANOUT;
+            sp.releaseState         = nodeRelease;
+            if( ProcessQueue_spawn(dq, &sp).pq == NULL ) {
+                // the child state was released by ProcessQueue_spawn
+                return PCT_CONTINUE;
+            }
+            ++node->spawned;
+        }
+        return PCT_WAIT_MESSAGE;
+    }
+
+    node->sum  += BENCH_VALUE(msg);
+    if( ++node->received < SKYNET_FANOUT ) {
+        return PCT_WAIT_MESSAGE;
+    }
+    if( node->parent.pq ) {
+        node->sendFailures += benchSend(node->parent, BENCH_MSG(node->sum));
+    } else {
+        atomic_store(node->result, node->sum + 1);
+    }
+    return PCT_STOP;
+}
+
+bool
+skynetRun(const BenchConfig* config, BenchResult* result) {
+    // round the leaves down to a power of 10
+    uint64_t    leaves      = 1;
+    uint64_t    processes   = 1;
+    while( leaves * SKYNET_FANOUT <= config->processes ) {
+        leaves     *= SKYNET_FANOUT;
+        processes  += leaves;
+    }
+    if( leaves == 1 ) {
+        return false;
+    }
+
+    ProcessQueue*           dq          = ProcessQueue_init((uint32_t)processes, config->threads);
+    atomic_uint_fast64_t    sum         = 0;
+    atomic_uint_fast64_t    sendFailures    = 0;
+    Node*                   root        = (Node*)calloc(1, sizeof(Node));
+    root->size              = leaves;
+    root->result            = &sum;
+    root->sendFailuresTotal = &sendFailures;
+
+    uint64_t    start   = benchNow();
+    benchSpawn(dq, skynetHandler, root, SKYNET_FANOUT, nodeRelease);
+    benchWait(&sum, 1);
+    uint64_t    end     = benchNow();
+
+    ProcessQueue_release(dq);
+    if( atomic_load(&sum) - 1 != leaves * (leaves - 1) / 2 ) {
+        return false;
+    }
+    result->sendFailures    = atomic_load(&sendFailures);
+    result->processes       = processes;
+    result->operations      = processes;
+    result->seconds         = (double)(end - start) / 1e9;
+    return true;
+}
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-stress: hammers the process lifetime / send protocol
+//
+// victims live for a few messages in a small process table, spawners refill
+// the table as soon as slots are released, blasters (processes and external
+// threads) send to PIDs picked from a table of recently spawned victims, most
+// of them dead or about to die. Every message names the generation it was
+// sent to: a victim receiving a message for another generation is a
+// misdelivery. Every message is counted once when freed, by its handler, by
+// MessageRelease when its mailbox is released, or by its sender on failure,
+// anything else is a leak (or a double free).
+////////////////////////////////////////////////////////////////////////////////
+
+#define VICTIM_MAILBOX      8
+#define VICTIM_LIFETIME     16      // messages, at most
+
+typedef struct {
+    uint64_t    id;
+    uint64_t    gen;
+} Message;
+
+typedef struct {
+    uint32_t    lifetime;
+    uint32_t    slot;
+} Victim;
+
+typedef struct {
+    ProcessQueue*           dq;
+    atomic_uint64_t*        table;          // (gen << 32) | (id + 1), 0 when empty
+    uint32_t                tableSize;
+    atomic_bool             stop;
+    atomic_uint32_t         running;        // blasters and spawners still running
+
+    atomic_uint64_t         allocated;
+    atomic_uint64_t         handled;
+    atomic_uint64_t         released;       // by MessageRelease
+    atomic_uint64_t         rejected;       // send failed, freed by the sender
+    atomic_uint64_t         dead;           // ACTOR_IS_DEAD
+    atomic_uint64_t         misdelivered;
+    atomic_uint64_t         spawned;
+    atomic_uint64_t         stopped;
+} Stress;
+
+static Stress   stress;
+
+static
+void
+messageRelease(void* msg) {
+    atomic_fetch_add_explicit(&stress.released, 1, memory_order_relaxed);
+    free(msg);
+}
+
+static
+void
+victimRelease(void* state) {
+    atomic_fetch_add_explicit(&stress.stopped, 1, memory_order_relaxed);
+    free(state);
+}
+
+static
+ProcessContinuation
+victimHandler(ProcessQueue* dq, void* state, void* msg) {
+    Victim*     victim  = (Victim*)state;
+    PID         self    = Process_self(dq);
+    if( msg == NULL ) {
+        atomic_store_explicit(&stress.table[victim->slot], (self.gen << 32) | (self.id + 1), memory_order_release);
+        return PCT_WAIT_MESSAGE;
+    }
+
+    Message*    m       = (Message*)msg;
+    if( m->id != self.id || m->gen != self.gen ) {
+        fprintf(stderr, "misdelivery: message for %" PRIu64 ".%" PRIu64 " received by %" PRIu64 ".%" PRIu64 "\n", m->id, m->gen, self.id, self.gen);
+        atomic_fetch_add(&stress.misdelivered, 1);
+    }
+    free(m);
+    atomic_fetch_add_explicit(&stress.handled, 1, memory_order_relaxed);
+    return --victim->lifetime == 0 ? PCT_STOP : PCT_WAIT_MESSAGE;
+}
+
+// one send to a random, probably stale, PID of the table
+static
+void
+blast(unsigned int* seed) {
+    uint64_t    entry   = atomic_load_explicit(&stress.table[(uint32_t)rand_r(seed) % stress.tableSize], memory_order_acquire);
+    if( entry == 0 ) {
+        return;
+    }
+    PID         dest    = { .pq = stress.dq, .id = (entry & 0xffffffffu) - 1, .gen = entry >> 32 };
+    Message*    m       = (Message*)malloc(sizeof(Message));
+    m->id   = dest.id;
+    m->gen  = dest.gen;
+    atomic_fetch_add_explicit(&stress.allocated, 1, memory_order_relaxed);
+    // MA_KEEP: on failure the message is still ours
+    SendResult  res = Process_sendMessage(dest, m, MA_KEEP);
+    if( res != SEND_SUCCESS ) {
+        if( res == ACTOR_IS_DEAD ) {
+            atomic_fetch_add_explicit(&stress.dead, 1, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&stress.rejected, 1, memory_order_relaxed);
+        free(m);
+    }
+}
+
+static
+ProcessContinuation
+blasterHandler(ProcessQueue* dq, void* state, void* msg) {
+    unsigned int*   seed    = (unsigned int*)state;
+    (void)dq;
+    (void)msg;
+    if( atomic_load_explicit(&stress.stop, memory_order_acquire) ) {
+        atomic_fetch_sub(&stress.running, 1);
+        return PCT_STOP;
+    }
+    for( int i = 0; i < 16; ++i ) {
+        blast(seed);
+    }
+    return PCT_CONTINUE;
+}
+
+static
+ProcessContinuation
+spawnerHandler(ProcessQueue* dq, void* state, void* msg) {
+    unsigned int*   seed    = (unsigned int*)state;
+    (void)msg;
+    if( atomic_load_explicit(&stress.stop, memory_order_acquire) ) {
+        atomic_fetch_sub(&stress.running, 1);
+        return PCT_STOP;
+    }
+    // fill every free slot, released ones are taken again right away
+    for( ;; ) {
+        Victim*     victim  = (Victim*)malloc(sizeof(Victim));
+        victim->lifetime    = 1 + (uint32_t)rand_r(seed) % VICTIM_LIFETIME;
+        victim->slot        = (uint32_t)rand_r(seed) % stress.tableSize;
+
+        ProcessSpawnParameters  sp  = { 0 };
+        sp.handler              = victimHandler;
+        sp.initialState         = victim;
+        sp.messageCap           = VICTIM_MAILBOX;
+        sp.maxMessagePerCycle   = VICTIM_MAILBOX;
+        sp.releaseState         = victimRelease;
+        sp.messageRelease       = messageRelease;
+        if( ProcessQueue_spawn(dq, &sp).pq == NULL ) {
+            // the state was released (and counted as stopped) by ProcessQueue_spawn
+            atomic_fetch_sub_explicit(&stress.stopped, 1, memory_order_relaxed);
+            return PCT_CONTINUE;
+        }
+        atomic_fetch_add_explicit(&stress.spawned, 1, memory_order_relaxed);
+    }
+}
+
+static
+void*
+externalBlaster(void* seed_) {
+    unsigned int    seed    = (unsigned int)(uintptr_t)seed_;
+    while( !atomic_load_explicit(&stress.stop, memory_order_acquire) ) {
+        blast(&seed);
+    }
+    return NULL;
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-d seconds] [-p process table size] [-b blaster processes] [-s spawner processes] [-x external threads]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 4;
+    uint32_t    seconds     = 5;
+    uint32_t    procCap     = 64;
+    uint32_t    blasters    = 4;
+    uint32_t    spawners    = 2;
+    uint32_t    externals   = 2;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 2;
+        }
+        uint32_t    value   = (uint32_t)strtoul(argv[a + 1], NULL, 10);
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = value;
+        } else if( strcmp(argv[a], "-d") == 0 ) {
+            seconds     = value;
+        } else if( strcmp(argv[a], "-p") == 0 ) {
+            procCap     = value;
+        } else if( strcmp(argv[a], "-b") == 0 ) {
+            blasters    = value;
+        } else if( strcmp(argv[a], "-s") == 0 ) {
+            spawners    = value;
+        } else if( strcmp(argv[a], "-x") == 0 ) {
+            externals   = value;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if( threads == 0 || spawners == 0 || procCap <= blasters + spawners ) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    stress.dq           = ProcessQueue_init(procCap, threads);
+    stress.tableSize    = procCap;
+    stress.table        = (atomic_uint64_t*)calloc(procCap, sizeof(atomic_uint64_t));
+    atomic_store(&stress.running, blasters + spawners);
+
+    unsigned int*   seeds   = (unsigned int*)calloc(blasters + spawners, sizeof(unsigned int));
+    for( uint32_t p = 0; p < blasters + spawners; ++p ) {
+        seeds[p]    = p + 1;
+        ProcessSpawnParameters  sp  = { 0 };
+        sp.handler              = p < blasters ? blasterHandler : spawnerHandler;
+        sp.initialState         = &seeds[p];
+        sp.messageCap           = 1;
+        sp.maxMessagePerCycle   = 1;
+        ProcessQueue_spawn(stress.dq, &sp);
+    }
+    pthread_t*  ext     = (pthread_t*)calloc(externals ? externals : 1, sizeof(pthread_t));
+    for( uint32_t x = 0; x < externals; ++x ) {
+        pthread_create(&ext[x], NULL, externalBlaster, (void*)(uintptr_t)(1000 + x));
+    }
+
+    sleep(seconds);
+    atomic_store_explicit(&stress.stop, true, memory_order_release);
+    for( uint32_t x = 0; x < externals; ++x ) {
+        pthread_join(ext[x], NULL);
+    }
+    while( atomic_load(&stress.running) ) {
+        sched_yield();
+    }
+    // victims still waiting are released with their mailboxes
+    ProcessQueue_release(stress.dq);
+
+    uint64_t    allocated   = atomic_load(&stress.allocated);
+    uint64_t    freed       = atomic_load(&stress.handled) + atomic_load(&stress.released) + atomic_load(&stress.rejected);
+    uint64_t    spawned     = atomic_load(&stress.spawned);
+    uint64_t    stopped     = atomic_load(&stress.stopped);
+    uint64_t    misdelivered    = atomic_load(&stress.misdelivered);
+    printf("spawned %" PRIu64 ", released %" PRIu64 ", messages %" PRIu64 ": handled %" PRIu64 ", released %" PRIu64
+           ", rejected %" PRIu64 " (dead %" PRIu64 "), misdelivered %" PRIu64 "\n",
+           spawned, stopped, allocated, atomic_load(&stress.handled), atomic_load(&stress.released),
+           atomic_load(&stress.rejected), atomic_load(&stress.dead), misdelivered);
+
+    bool    ok  = true;
+    if( misdelivered ) {
+        ok  = false;
+    }
+    if( allocated != freed ) {
+        fprintf(stderr, "FAIL: %" PRIu64 " messages allocated, %" PRIu64 " freed\n", allocated, freed);
+        ok  = false;
+    }
+    if( spawned != stopped ) {
+        fprintf(stderr, "FAIL: %" PRIu64 " victims spawned, %" PRIu64 " states released\n", spawned, stopped);
+        ok  = false;
+    }
+    printf("%s\n", ok ? "OK" : "FAIL");
+
+    free(ext);
+    free(seeds);
+    free(stress.table);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+#ifndef BENCH_TABLE__H
+#define BENCH_TABLE__H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Result tables, shared by every bench: a CSV header and one line per row, or
+// {"results":[ with one JSON object per line, the keys being the CSV columns
+////////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    BF_CSV,
+    BF_JSON,
+} BenchFormat;
+
+typedef struct {
+    FILE*           out;
+    BenchFormat     format;
+    const char*     columns;    // comma separated names
+    const char*     next;       // name of the next cell in columns
+    uint32_t        cells;      // written in the current row
+    uint64_t        rows;
+} BenchTable;
+
+// meta: JSON members written before "results" (with a trailing comma), or NULL
+void        benchTableBegin     (BenchTable* t, FILE* out, BenchFormat format, const char* columns, const char* meta);
+void        benchTableString    (BenchTable* t, const char* value);
+void        benchTableU64       (BenchTable* t, uint64_t value);
+void        benchTableDouble    (BenchTable* t, double value, int decimals);
+void        benchTableBool      (BenchTable* t, bool value);
+void        benchTableEndRow    (BenchTable* t);
+void        benchTableEnd       (BenchTable* t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,427 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-timer-bench: timing wheel costs and guarantees
+//
+//   insert    1M (-m) outstanding timers armed, due in 1 to 60s, from a worker
+//   cancel    the same timers cancelled, every cancel must succeed
+//   fire      -n timers due in 0 to 2s (cascading down from level 1) fire,
+//             none early, none lost, lateness percentiles
+//   race      -n short timers cancelled around their due time: each is either
+//             cancelled or delivered, never both, never neither
+//   dead      -n timers to a process that stopped: all go to their release
+//   timeout   Process_receiveTimeout waits, none early
+//
+// Timers left armed when the queue is released must be released too, checked
+// at exit. Any violation makes the exit code 1.
+////////////////////////////////////////////////////////////////////////////////
+
+#define FIRE_SPREAD_NS      (2000ull * 1000 * 1000)
+#define RACE_SPREAD_MS      20
+#define TIMEOUT_NS          (2ull * 1000 * 1000)
+#define LEFTOVER_TIMERS     1000
+#define DRAIN_GRACE_NS      (5ull * 1000 * 1000 * 1000)
+
+typedef enum {
+    TS_ARMED,
+    TS_DELIVERED,
+    TS_CANCELLED,
+} TickState;
+
+typedef struct {
+    uint64_t        due;        // monotonic ns
+    TimerHandle     handle;
+    atomic_int      state;
+} Tick;
+
+typedef struct {
+    Tick*           ticks;
+    uint64_t        count;
+    Histogram*      lateness;
+    atomic_uint64_t delivered;
+    atomic_uint64_t early;
+    atomic_uint64_t twice;      // delivered after a successful cancel, or the reverse
+    atomic_bool     armed;
+} Shared;
+
+static atomic_uint64_t  released;
+
+static
+void
+countRelease(void* message) {
+    (void)message;
+    atomic_fetch_add(&released, 1);
+}
+
+static
+uint64_t
+nextRandom(uint64_t* seed) {
+    *seed  ^= *seed << 13;
+    *seed  ^= *seed >> 7;
+    *seed  ^= *seed << 17;
+    return *seed;
+}
+
+static
+void
+waitFor(atomic_uint64_t* counter, uint64_t target, uint64_t deadline) {
+    while( atomic_load(counter) < target && monotonicNs() < deadline ) {
+        sched_yield();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// processes
+////////////////////////////////////////////////////////////////////////////////
+
+static
+ProcessContinuation
+receiver(ProcessQueue* dq, void* state, void* msg) {
+    Shared*     s   = (Shared*)state;
+    (void)dq;
+    if( msg == NULL ) {
+        return PCT_WAIT_MESSAGE;
+    }
+    Tick*       t       = (Tick*)msg;
+    uint64_t    now     = monotonicNs();
+    int         armed   = TS_ARMED;
+    if( !atomic_compare_exchange_strong(&t->state, &armed, TS_DELIVERED) ) {
+        atomic_fetch_add(&s->twice, 1);
+    }
+    if( now < t->due ) {
+        atomic_fetch_add(&s->early, 1);
+    } else {
+        Histogram_record(s->lateness, now - t->due);
+    }
+    atomic_fetch_add(&s->delivered, 1);
+    return PCT_WAIT_MESSAGE;
+}
+
+typedef struct {
+    Shared*         shared;
+    PID             dest;
+    uint64_t        spreadNs;
+    uint64_t        minNs;
+    MessageRelease  release;
+    double          seconds;    // arming time
+} Armer;
+
+// arms from a worker, into its own shard
+static
+ProcessContinuation
+armer(ProcessQueue* dq, void* state, void* msg) {
+    Armer*      a       = (Armer*)state;
+    uint64_t    seed    = 88172645463325252ull;
+    (void)dq;
+    (void)msg;
+    uint64_t    start   = monotonicNs();
+    for( uint64_t i = 0; i < a->shared->count; ++i ) {
+        Tick*       t       = &a->shared->ticks[i];
+        uint64_t    delay   = a->minNs + nextRandom(&seed) % a->spreadNs;
+        t->due      = monotonicNs() + delay;
+        atomic_store(&t->state, TS_ARMED);
+        t->handle   = Process_sendAfter(a->dest, delay, t, a->release);
+    }
+    a->seconds  = (double)(monotonicNs() - start) / 1e9;
+    atomic_store(&a->shared->armed, true);
+    return PCT_STOP;
+}
+
+typedef struct {
+    Shared*         shared;
+    uint64_t        remaining;
+    uint64_t        due;
+} Waiter;
+
+static
+ProcessContinuation
+waiter(ProcessQueue* dq, void* state, void* msg) {
+    Waiter*     w   = (Waiter*)state;
+    if( msg == PROCESS_TIMEOUT ) {
+        uint64_t    now = monotonicNs();
+        if( now < w->due ) {
+            atomic_fetch_add(&w->shared->early, 1);
+        } else {
+            Histogram_record(w->shared->lateness, now - w->due);
+        }
+        atomic_fetch_add(&w->shared->delivered, 1);
+        if( --w->remaining == 0 ) {
+            return PCT_STOP;
+        }
+    }
+    w->due  = monotonicNs() + TIMEOUT_NS;
+    Process_receiveTimeout(dq, TIMEOUT_NS);
+    return PCT_WAIT_MESSAGE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// tests
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const char*     test;
+    uint64_t        timers;
+    double          seconds;
+    uint64_t        early;
+    uint64_t        lost;
+    uint64_t        twice;
+} Result;
+
+static
+PID
+spawnProcess(ProcessQueue* dq, ProcessHandler handler, void* state, uint32_t messageCap) {
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = handler;
+    sp.initialState         = state;
+    sp.messageCap           = messageCap;
+    sp.maxMessagePerCycle   = messageCap;
+    return ProcessQueue_spawn(dq, &sp);
+}
+
+static
+void
+armFromWorker(ProcessQueue* dq, Armer* a) {
+    atomic_store(&a->shared->armed, false);
+    spawnProcess(dq, armer, a, 1);
+    while( !atomic_load(&a->shared->armed) ) {
+        sched_yield();
+    }
+}
+
+static
+void
+insertAndCancel(ProcessQueue* dq, Shared* s, PID dest, Result* insert, Result* cancel) {
+    Armer       a       = { .shared = s, .dest = dest, .minNs = 1000ull * 1000 * 1000, .spreadNs = 59000ull * 1000 * 1000 };
+    armFromWorker(dq, &a);
+    *insert     = (Result){ .test = "insert", .timers = s->count, .seconds = a.seconds };
+
+    uint64_t    failed  = 0;
+    uint64_t    start   = monotonicNs();
+    for( uint64_t i = 0; i < s->count; ++i ) {
+        failed     += !Process_cancelTimer(dq, s->ticks[i].handle);
+    }
+    *cancel     = (Result){ .test = "cancel", .timers = s->count, .seconds = (double)(monotonicNs() - start) / 1e9, .lost = failed };
+}
+
+static
+void
+fire(ProcessQueue* dq, Shared* s, PID dest, Result* r) {
+    Armer       a       = { .shared = s, .dest = dest, .minNs = 0, .spreadNs = FIRE_SPREAD_NS };
+    uint64_t    start   = monotonicNs();
+    armFromWorker(dq, &a);
+    waitFor(&s->delivered, s->count, monotonicNs() + FIRE_SPREAD_NS + DRAIN_GRACE_NS);
+    uint64_t    delivered   = atomic_load(&s->delivered);
+    *r  = (Result){ .test = "fire", .timers = s->count, .seconds = (double)(monotonicNs() - start) / 1e9,
+                    .early = atomic_load(&s->early), .lost = s->count - delivered, .twice = atomic_load(&s->twice) };
+}
+
+// armed and cancelled from this (non-worker) thread while the workers fire them
+static
+void
+race(ProcessQueue* dq, Shared* s, PID dest, Result* r) {
+    uint64_t    seed        = 2463534242ull;
+    uint64_t    start       = monotonicNs();
+    for( uint64_t i = 0; i < s->count; ++i ) {
+        Tick*       t       = &s->ticks[i];
+        uint64_t    delay   = (1 + i % RACE_SPREAD_MS) * TIMER_TICK_NS;
+        t->due      = monotonicNs() + delay;
+        atomic_store(&t->state, TS_ARMED);
+        t->handle   = Process_sendAfter(dest, delay, t, NULL);
+    }
+
+    // cancel each timer within a tick of its due time, in due order, pacing
+    // every 64 timers: a yield per timer can take longer than a tick
+    uint64_t    cancelled   = 0;
+    uint64_t    visited     = 0;
+    for( uint64_t ms = 1; ms <= RACE_SPREAD_MS; ++ms ) {
+        for( uint64_t i = ms - 1; i < s->count; i += RACE_SPREAD_MS ) {
+            Tick*       t       = &s->ticks[i];
+            uint64_t    target  = t->due - TIMER_TICK_NS + nextRandom(&seed) % (2 * TIMER_TICK_NS);
+            while( (visited & 63) == 0 && monotonicNs() < target ) {
+                sched_yield();
+            }
+            ++visited;
+            if( Process_cancelTimer(dq, t->handle) ) {
+                int     armed   = TS_ARMED;
+                if( !atomic_compare_exchange_strong(&t->state, &armed, TS_CANCELLED) ) {
+                    atomic_fetch_add(&s->twice, 1);
+                }
+                ++cancelled;
+            }
+        }
+    }
+    waitFor(&s->delivered, s->count - cancelled, monotonicNs() + DRAIN_GRACE_NS);
+    uint64_t    delivered   = atomic_load(&s->delivered);
+    *r  = (Result){ .test = "race", .timers = s->count, .seconds = (double)(monotonicNs() - start) / 1e9,
+                    .early = atomic_load(&s->early), .lost = s->count - cancelled - delivered, .twice = atomic_load(&s->twice) };
+    fprintf(stderr, "race: %" PRIu64 " cancelled, %" PRIu64 " delivered\n", cancelled, delivered);
+}
+
+static
+ProcessContinuation
+stopper(ProcessQueue* dq, void* state, void* msg) {
+    (void)dq;
+    (void)msg;
+    atomic_store((atomic_bool*)state, true);
+    return PCT_STOP;
+}
+
+static
+void
+dead(ProcessQueue* dq, Shared* s, Result* r) {
+    atomic_bool stopped = false;
+    PID         dest    = spawnProcess(dq, stopper, &stopped, 1);
+    while( !atomic_load(&stopped) ) {
+        sched_yield();
+    }
+    while( atomic_load(&dq->procCount) > 1 ) {     // the receiver stays
+        sched_yield();
+    }
+
+    atomic_store(&released, 0);
+    Armer       a       = { .shared = s, .dest = dest, .minNs = 0, .spreadNs = 100ull * 1000 * 1000, .release = countRelease };
+    uint64_t    start   = monotonicNs();
+    armFromWorker(dq, &a);
+    waitFor(&released, s->count, monotonicNs() + DRAIN_GRACE_NS);
+    *r  = (Result){ .test = "dead", .timers = s->count, .seconds = (double)(monotonicNs() - start) / 1e9,
+                    .lost = s->count - atomic_load(&released) };
+}
+
+static
+void
+timeout(ProcessQueue* dq, Shared* s, Result* r) {
+    Waiter      w       = { .shared = s, .remaining = s->count };
+    uint64_t    start   = monotonicNs();
+    spawnProcess(dq, waiter, &w, 1);
+    waitFor(&s->delivered, s->count, monotonicNs() + s->count * TIMEOUT_NS * 4 + DRAIN_GRACE_NS);
+    *r  = (Result){ .test = "timeout", .timers = s->count, .seconds = (double)(monotonicNs() - start) / 1e9,
+                    .early = atomic_load(&s->early), .lost = s->count - atomic_load(&s->delivered) };
+}
+
+static
+void
+reset(Shared* s, uint64_t count) {
+    s->count    = count;
+    Histogram_init(s->lateness);
+    atomic_store(&s->delivered, 0);
+    atomic_store(&s->early, 0);
+    atomic_store(&s->twice, 0);
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n fired timers] [-m outstanding timers] [-f csv|json] [-o file]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 1;
+    uint64_t    count       = 100000;
+    uint64_t    outstanding = 1000000;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            count       = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-m") == 0 ) {
+            outstanding = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || count == 0 || outstanding == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Shared          s       = { 0 };
+    s.ticks         = (Tick*)calloc(outstanding > count ? outstanding : count, sizeof(Tick));
+    s.lateness      = (Histogram*)malloc(sizeof(Histogram));
+    ProcessQueue*   dq      = ProcessQueue_init(16, threads);
+    PID             dest    = spawnProcess(dq, receiver, &s, 4096);
+
+    Result          results[6];
+    fprintf(stderr, "insert, cancel...\n");
+    reset(&s, outstanding);
+    insertAndCancel(dq, &s, dest, &results[0], &results[1]);
+    fprintf(stderr, "fire...\n");
+    reset(&s, count);
+    fire(dq, &s, dest, &results[2]);
+    Histogram       fireLateness    = *s.lateness;
+    fprintf(stderr, "race...\n");
+    reset(&s, count);
+    race(dq, &s, dest, &results[3]);
+    fprintf(stderr, "dead...\n");
+    reset(&s, count);
+    dead(dq, &s, &results[4]);
+    fprintf(stderr, "timeout...\n");
+    reset(&s, count < 500 ? count : 500);
+    timeout(dq, &s, &results[5]);
+    Histogram       timeoutLateness = *s.lateness;
+
+    // never due: the queue releases them
+    atomic_store(&released, 0);
+    for( uint32_t i = 0; i < LEFTOVER_TIMERS; ++i ) {
+        Process_sendAfter(dest, 3600ull * 1000 * 1000 * 1000, &s.ticks[i], countRelease);
+    }
+    ProcessQueue_release(dq);
+    uint64_t        leftovers   = LEFTOVER_TIMERS - atomic_load(&released);
+
+    bool            failed  = leftovers != 0;
+    BenchTable      table;
+    benchTableBegin(&table, out, format, "test,threads,timers,seconds,ns_per_timer,early,lost,twice,late_p50_ns,late_p99_ns,late_max_ns", NULL);
+    for( size_t i = 0; i < sizeof(results) / sizeof(results[0]); ++i ) {
+        Result*     r   = &results[i];
+        Histogram*  h   = i == 2 ? &fireLateness : i == 5 ? &timeoutLateness : NULL;
+        failed  = failed || r->early || r->lost || r->twice;
+        benchTableString(&table, r->test);
+        benchTableU64(&table, threads);
+        benchTableU64(&table, r->timers);
+        benchTableDouble(&table, r->seconds, 6);
+        benchTableDouble(&table, r->seconds * 1e9 / (double)r->timers, 1);
+        benchTableU64(&table, r->early);
+        benchTableU64(&table, r->lost);
+        benchTableU64(&table, r->twice);
+        benchTableU64(&table, h ? Histogram_percentile(h, 50.0) : 0);
+        benchTableU64(&table, h ? Histogram_percentile(h, 99.0) : 0);
+        benchTableU64(&table, h ? Histogram_max(h) : 0);
+        benchTableEndRow(&table);
+    }
+    benchTableEnd(&table);
+    if( leftovers ) {
+        fprintf(stderr, "%" PRIu64 " timers armed at release were not released\n", leftovers);
+    }
+
+    free(s.ticks);
+    free(s.lateness);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return failed ? 1 : 0;
+}
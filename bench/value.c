@@ -0,0 +1,248 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "table.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// tcpm-value-bench: by-value mailboxes against heap allocated messages
+//
+// P producers stream N small structs to one consumer, each test runs once with
+// malloc'd messages sent as pointers (freed by the consumer) and once with a
+// TCPM_MAILBOX of the struct itself:
+//   stream    one producer
+//   fanin     four producers, contending on the consumer mailbox
+////////////////////////////////////////////////////////////////////////////////
+
+#define BATCH           64      // sends per producer cycle
+#define MAILBOX_CAP     256
+
+typedef struct {
+    uint64_t        seq;
+    uint32_t        producer;
+    uint32_t        flags;
+    double          price;
+    uint64_t        quantity;
+} Sample;
+
+TCPM_MAILBOX(Samples, Sample)
+
+typedef struct {
+    uint64_t        count;      // per producer
+    uint32_t        producers;
+    uint64_t        received;
+    uint64_t        checksum;
+    atomic_bool     done;
+} Shared;
+
+typedef struct {
+    Shared*         shared;
+    PID             consumer;
+    uint32_t        id;
+    uint64_t        sent;
+    bool            byValue;
+} Producer;
+
+static
+void
+consume(Shared* s, const Sample* sample) {
+    s->checksum += sample->seq + sample->quantity;
+    ++s->received;
+}
+
+static
+ProcessContinuation
+finish(Shared* s) {
+    if( s->received == s->count * s->producers ) {
+        atomic_store(&s->done, true);
+        return PCT_STOP;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// consumers: the first message comes through the handler, the rest of the
+// mailbox is drained in place
+////////////////////////////////////////////////////////////////////////////////
+
+static
+ProcessContinuation
+heapConsumer(ProcessQueue* dq, void* state, void* msg) {
+    Shared*     s   = (Shared*)state;
+    while( msg ) {
+        consume(s, (Sample*)msg);
+        free(msg);
+        msg     = Process_receiveMessage(dq);
+    }
+    return finish(s);
+}
+
+static
+ProcessContinuation
+valueConsumer(ProcessQueue* dq, void* state, void* msg) {
+    Shared*         s       = (Shared*)state;
+    const Sample*   sample  = Samples_value(dq, msg);
+    Sample          next;
+    if( sample ) {
+        consume(s, sample);
+        while( Samples_receive(dq, &next) ) {
+            consume(s, &next);
+        }
+    }
+    return finish(s);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// producers: a full mailbox gives the consumer the cycle (single thread runs)
+////////////////////////////////////////////////////////////////////////////////
+
+static
+ProcessContinuation
+producer(ProcessQueue* dq, void* state, void* msg) {
+    Producer*   p   = (Producer*)state;
+    (void)dq;
+    (void)msg;
+    for( uint32_t b = 0; b < BATCH && p->sent < p->shared->count; ++b ) {
+        Sample      sample  = { .seq = p->sent, .producer = p->id, .price = 1.5, .quantity = p->id + 1 };
+        SendResult  res;
+        if( p->byValue ) {
+            res     = Samples_send(p->consumer, sample);
+        } else {
+            Sample* heap    = (Sample*)malloc(sizeof(Sample));
+            *heap   = sample;
+            if( (res = Process_sendMessage(p->consumer, heap, MA_KEEP)) != SEND_SUCCESS ) {
+                free(heap);
+            }
+        }
+        if( res != SEND_SUCCESS ) {
+            break;
+        }
+        ++p->sent;
+    }
+    return p->sent < p->shared->count ? PCT_CONTINUE : PCT_STOP;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// driver
+////////////////////////////////////////////////////////////////////////////////
+
+static
+double
+runTest(ProcessQueue* dq, uint32_t producers, bool byValue, uint64_t count) {
+    Shared      s       = { .count = count, .producers = producers };
+    Producer*   ps      = (Producer*)calloc(producers, sizeof(Producer));
+    uint64_t    start   = monotonicNs();
+
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.initialState         = &s;
+    sp.messageCap           = MAILBOX_CAP;
+    sp.maxMessagePerCycle   = 1;
+    sp.messageRelease       = free;
+    PID     consumer;
+    if( byValue ) {
+        sp.handler  = valueConsumer;
+        consumer    = Samples_spawn(dq, &sp);
+    } else {
+        sp.handler  = heapConsumer;
+        consumer    = ProcessQueue_spawn(dq, &sp);
+    }
+
+    for( uint32_t p = 0; p < producers; ++p ) {
+        ps[p]       = (Producer){ .shared = &s, .consumer = consumer, .id = p, .byValue = byValue };
+        sp          = (ProcessSpawnParameters){ 0 };
+        sp.handler              = producer;
+        sp.initialState         = &ps[p];
+        sp.messageCap           = 1;
+        sp.maxMessagePerCycle   = 1;
+        ProcessQueue_spawn(dq, &sp);
+    }
+    while( !atomic_load(&s.done) ) {
+        sched_yield();
+    }
+    double      seconds = (double)(monotonicNs() - start) / 1e9;
+    while( atomic_load(&dq->procCount) ) {
+        sched_yield();
+    }
+
+    uint64_t    expected    = 0;
+    for( uint32_t p = 0; p < producers; ++p ) {
+        expected    += count * (count - 1) / 2 + count * (p + 1);
+    }
+    if( s.checksum != expected ) {
+        fprintf(stderr, "checksum mismatch: %" PRIu64 " != %" PRIu64 "\n", s.checksum, expected);
+        exit(1);
+    }
+    free(ps);
+    return seconds;
+}
+
+static
+void
+usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-t threads] [-n messages per producer] [-f csv|json] [-o file]\n", argv0);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t    threads     = 1;
+    uint64_t    count       = 1000000;
+    BenchFormat format      = BF_CSV;
+    FILE*       out         = stdout;
+
+    for( int a = 1; a < argc; a += 2 ) {
+        if( a + 1 >= argc ) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[a + 1];
+        if( strcmp(argv[a], "-t") == 0 ) {
+            threads     = (uint32_t)strtoul(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-n") == 0 ) {
+            count       = strtoull(arg, NULL, 10);
+        } else if( strcmp(argv[a], "-f") == 0 ) {
+            format      = strcmp(arg, "json") == 0 ? BF_JSON : BF_CSV;
+        } else if( strcmp(argv[a], "-o") == 0 ) {
+            out         = fopen(arg, "w");
+            if( out == NULL ) {
+                fprintf(stderr, "unable to open %s\n", arg);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if( threads == 0 || count == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ProcessQueue*   dq          = ProcessQueue_init(64, threads);
+    const char*     tests[]     = { "stream", "fanin" };
+    uint32_t        producers[] = { 1, 4 };
+    BenchTable      table;
+    benchTableBegin(&table, out, format, "test,kind,threads,messages,seconds,ns_per_message", NULL);
+    for( size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); ++t ) {
+        for( int byValue = 0; byValue < 2; ++byValue ) {
+            double      seconds = runTest(dq, producers[t], byValue, count);
+            uint64_t    total   = count * producers[t];
+            benchTableString(&table, tests[t]);
+            benchTableString(&table, byValue ? "value" : "heap");
+            benchTableU64(&table, threads);
+            benchTableU64(&table, total);
+            benchTableDouble(&table, seconds, 6);
+            benchTableDouble(&table, seconds * 1e9 / (double)total, 1);
+            benchTableEndRow(&table);
+        }
+    }
+    benchTableEnd(&table);
+
+    ProcessQueue_release(dq);
+    if( out != stdout ) {
+        fclose(out);
+    }
+    return 0;
+}
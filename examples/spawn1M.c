@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <stdatomic.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include <tcpm.h>
 
@@ -69,7 +70,7 @@ main() {
     for( uint32_t a = 0; a < MAX_ACTOR_COUNT; ++a ) {
         PID    ac = { 0 };
         while( ac.pq == NULL ) {
-            ProcessSpawnParameters  sp;
+            ProcessSpawnParameters  sp = { 0 };
             sp.handler          = actorHandler;
             sp.messageCap       = 2;
             sp.maxMessagePerCycle   = 1;
@@ -87,8 +88,8 @@ main() {
     }
 
     while((atomic_load(&sum)) < MAX_ACTOR_COUNT) {
-        pthread_yield();
-        fprintf(stderr, "-->> %u <<--\n", sum);
+        sched_yield();
+        ProcessQueue_log(dq, LL_INFO, "-->> %u <<--", sum);
     }
 
     clock_gettime(CLOCK_MONOTONIC, &end);
@@ -26,7 +26,13 @@
     SOFTWARE.
 */
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef enum {
     PCT_STOP,
@@ -34,21 +40,31 @@ typedef enum {
     PCT_WAIT_MESSAGE,
 } ProcessContinuation;
 
+// message received when a wait set up with Process_receiveTimeout expires
+#define PROCESS_TIMEOUT     ((void*)~(uintptr_t)0)
+
+// Process_sendAfter handle, 0 is never a valid timer
+typedef uint64_t                    TimerHandle;
+
 typedef struct ProcessQueue         ProcessQueue;
+typedef struct SharedChannel        SharedChannel;     // fixed-size messages between OS processes
 typedef ProcessContinuation         (*ProcessHandler)       (ProcessQueue*, void* localState, void* msg);
 typedef void                        (*ProcessReleaseState)  (void* state);
 typedef void                        (*MessageRelease)       (void* message);
+typedef void                        (*CoroutineBody)        (ProcessQueue*, void* localState);
 
 typedef struct {
     ProcessQueue*       pq;
     uint64_t            id;
     uint64_t            gen;
+    uint32_t            node;       // 0: local, else a remote node reached through pq
 } PID;
 
 typedef enum {
-    ACTOR_IS_DEAD   = -1,
-    SEND_FAIL       = 0,
-    SEND_SUCCESS    = 1,
+    SEND_UNSUPPORTED    = -2,   // Process_sendValue: no by-value mailbox (or too small), remote PID
+    ACTOR_IS_DEAD       = -1,
+    SEND_FAIL           = 0,
+    SEND_SUCCESS        = 1,
 } SendResult;
 
 // on send failure, what to do ?
@@ -57,23 +73,231 @@ typedef enum {
     MA_REMOVE,
 } MessageAction;
 
+// file descriptor readiness to wait on, errors and hang ups are always reported
+typedef enum {
+    FE_READ         = 1,
+    FE_WRITE        = 2,
+} FdEvents;
+
+typedef enum {
+    IO_READ,
+    IO_WRITE,
+    IO_ACCEPT,          // accepted sockets are non-blocking and close-on-exec
+    IO_FSYNC,
+} IoOp;
+
+// user supplied encoding of the messages sent to remote PIDs
+typedef struct {
+    // write message into buffer and return its size, called again with a bigger buffer if above cap
+    uint32_t        (*serialize)    (ProcessQueue* dq, void* message, void* buffer, uint32_t cap, void* ctx);
+    // rebuild a message from a frame payload, NULL drops it
+    void*           (*deserialize)  (ProcessQueue* dq, const void* buffer, uint32_t size, void* ctx);
+    // release a message once serialized, or when it cannot be delivered, may be NULL
+    void            (*release)      (void* message, void* ctx);
+    void*           ctx;
+} NodeSerializer;
+
+// message sent for a signal routed with Process_watchSignal, released with
+// free() by the receiver
+typedef struct {
+    int             signo;
+    int32_t         code;           // si_code
+    uint32_t        senderPid;
+    uint32_t        senderUid;
+    int32_t         status;         // SIGCHLD exit status or signal
+} SignalInfo;
+
+#define IO_OFFSET_NONE      UINT64_MAX  // sockets, pipes, or the current file position
+
+// asynchronous I/O request: belongs to the caller until it comes back, as
+// the message itself, into the owner mailbox
+typedef struct {
+    IoOp            op;
+    int             fd;
+    void*           buffer;
+    uint32_t        length;
+    uint64_t        offset;
+    int64_t         result;         // on completion: bytes, accepted fd or -errno
+    PID             owner;          // set by Process_submitIo
+    void*           userData;
+} IoRequest;
+
+////////////////////////////////////////////////////////////////////////////////
+// Log-bucketed latency histogram (HDR style)
+//
+// Values below 2^(HISTOGRAM_SUB_BUCKET_BITS + 1) are recorded exactly, larger
+// values land in buckets whose width is 1/2^HISTOGRAM_SUB_BUCKET_BITS of their
+// magnitude (~3% relative error). Recording is lock-free, histograms can be
+// merged and queried while other threads are still recording.
+////////////////////////////////////////////////////////////////////////////////
+
+#define HISTOGRAM_SUB_BUCKET_BITS   5
+#define HISTOGRAM_BUCKET_COUNT      ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS)
+
+typedef struct {
+    uint64_t        count;
+    uint64_t        sum;
+    uint64_t        max;
+    uint64_t        buckets[HISTOGRAM_BUCKET_COUNT];
+} Histogram;
+
 typedef struct {
     void*           initialState;
     uint32_t        maxMessagePerCycle;
     uint32_t        messageCap;
+    uint32_t        messageSize;        // > 0: also a by-value mailbox of messageCap values, see TCPM_MAILBOX
     ProcessHandler  handler;
     ProcessReleaseState     releaseState;
     MessageRelease  messageRelease;
+    Histogram*      latencyHistogram;   // optional, shared by a class of processes, must outlive them
 } ProcessSpawnParameters;
 
+typedef enum {
+    LL_DEBUG,
+    LL_INFO,
+    LL_WARNING,
+    LL_ERROR,
+} LogLevel;
+
+// BoundedQueue contention counters (TCPM_QUEUE_STATS)
+typedef enum {
+    QS_RUN_QUEUE,
+    QS_PROCESS_POOL,
+    QS_MAILBOXES,       // all the mailboxes aggregated
+    QS_COUNT,
+} QueueStatsKind;
+
+typedef struct {
+    uint64_t        pushes;
+    uint64_t        pops;
+    uint64_t        pushFull;           // push failed, queue full
+    uint64_t        popEmpty;           // pop failed, queue empty
+    uint64_t        pushCasFailures;
+    uint64_t        popCasFailures;
+    uint64_t        pushSpins;          // extra iterations of the push loop
+    uint64_t        popSpins;           // extra iterations of the pop loop
+} QueueStats;
+
+// scheduler counters (TCPM_METRICS)
+typedef struct {
+    uint64_t        spawns;
+    uint64_t        releases;
+    uint64_t        messagesHandled;
+    uint64_t        sends;              // successful sends
+    uint64_t        sendFull;           // SEND_FAIL, mailbox full
+    uint64_t        sendBusy;           // SEND_FAIL, release lock taken
+    uint64_t        sendDead;           // ACTOR_IS_DEAD
+    uint64_t        idleLoops;          // worker found the run queue empty
+} ProcessQueueCounters;
+
+// snapshot of a live process, see ProcessQueue_forEach
+typedef struct {
+    uint64_t        id;
+    uint64_t        gen;
+    bool            waiting;            // waiting on a message (PCT_WAIT_MESSAGE)
+    uint32_t        mailboxDepth;
+    uint32_t        mailboxCap;
+    uint32_t        maxMessagePerCycle;
+    ProcessHandler  handler;
+    PID             parent;             // parent.pq is NULL for root processes
+} ProcessInfo;
+
+// return false to stop the iteration
+typedef bool                        (*ProcessVisitor)       (const ProcessInfo* info, void* ctx);
+
 ////////////////////////////////////////////////////////////////////////////////
 // API
 ////////////////////////////////////////////////////////////////////////////////
 ProcessQueue*       ProcessQueue_init       (uint32_t procCap, uint32_t threadCount);
 void                ProcessQueue_release    (ProcessQueue* dq);
 SendResult          Process_sendMessage     (PID dest, void* message, MessageAction ma);
+bool                Process_watchFd         (PID pid, int fd, uint32_t events, void* message);
+void                Process_unwatchFd       (PID pid, int fd);
+bool                Process_watchSignal     (PID pid, int signo);
+void                Process_unwatchSignal   (ProcessQueue* dq, int signo);
+bool                Process_submitIo        (PID pid, IoRequest* request);
+TimerHandle         Process_sendAfter       (PID dest, uint64_t delayNs, void* message, MessageRelease release);
+bool                Process_cancelTimer     (ProcessQueue* dq, TimerHandle timer);
+void                Process_receiveTimeout  (ProcessQueue* dq, uint64_t timeoutNs);
+const char*         ProcessQueue_ioBackend  (ProcessQueue* dq);
+PID                 Process_remote          (ProcessQueue* dq, uint32_t node, uint64_t id, uint64_t gen);
+bool                ProcessQueue_setNode    (ProcessQueue* dq, uint32_t node, const NodeSerializer* serializer);
+uint32_t            ProcessQueue_node       (ProcessQueue* dq);
+uint16_t            ProcessQueue_listen     (ProcessQueue* dq, const char* address, uint16_t port);
+bool                ProcessQueue_connect    (ProcessQueue* dq, uint32_t node, const char* address, uint16_t port);
+bool                Process_watchChannel    (PID pid, SharedChannel* channel, void* message);
+void                Process_unwatchChannel  (PID pid, SharedChannel* channel);
 void*               Process_receiveMessage  (ProcessQueue* dq);
+SendResult          Process_sendValue       (PID dest, const void* value, uint32_t size);
+bool                Process_receiveValue    (ProcessQueue* dq, void* value, uint32_t size);
+void*               Process_valueBuffer     (ProcessQueue* dq);
 PID                 Process_self            (ProcessQueue* dq);
 PID                 ProcessQueue_spawn      (ProcessQueue* dq, ProcessSpawnParameters* parameters);
+PID                 ProcessQueue_spawnCoroutine (ProcessQueue* dq, ProcessSpawnParameters* parameters, CoroutineBody body, uint32_t stackSize);
+void*               Process_receiveBlocking (ProcessQueue* dq);
+void                Process_yield           (ProcessQueue* dq);
+bool                ProcessQueue_mailboxLatency (ProcessQueue* dq, Histogram* out);
+bool                ProcessQueue_traceDump  (ProcessQueue* dq, FILE* out);
+uint32_t            ProcessQueue_forEach    (ProcessQueue* dq, ProcessVisitor visitor, void* ctx);
+void                ProcessQueue_dump       (ProcessQueue* dq, FILE* out);
+bool                ProcessQueue_queueStats (ProcessQueue* dq, QueueStatsKind kind, QueueStats* out);
+bool                ProcessQueue_counters   (ProcessQueue* dq, ProcessQueueCounters* out);
+const char*         ProcessQueue_metricsName(ProcessQueue* dq);
+bool                ProcessQueue_profileStart   (ProcessQueue* dq, uint32_t hz);
+void                ProcessQueue_profileStop    (ProcessQueue* dq);
+void                ProcessQueue_profileDump    (ProcessQueue* dq, FILE* out, uint32_t maxRows);
+void                ProcessQueue_log        (ProcessQueue* dq, LogLevel level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+void                ProcessQueue_setLogOutput   (ProcessQueue* dq, FILE* out, LogLevel minLevel);
+uint64_t            ProcessQueue_logDropped (ProcessQueue* dq);
+
+SharedChannel*      SharedChannel_create    (const char* name, uint32_t cap, uint32_t payloadSize);
+SharedChannel*      SharedChannel_open      (const char* name);
+void                SharedChannel_close     (SharedChannel* channel);
+void                SharedChannel_unlink    (const char* name);
+bool                SharedChannel_send      (SharedChannel* channel, const void* payload, uint32_t size);
+bool                SharedChannel_receive   (SharedChannel* channel, void* payload, uint32_t* size);
+uint32_t            SharedChannel_size      (SharedChannel* channel);
+uint32_t            SharedChannel_payloadSize   (SharedChannel* channel);
+
+void                Histogram_init          (Histogram* h);
+void                Histogram_record        (Histogram* h, uint64_t value);
+void                Histogram_merge         (Histogram* dst, const Histogram* src);
+uint64_t            Histogram_count         (const Histogram* h);
+uint64_t            Histogram_max           (const Histogram* h);
+double              Histogram_mean          (const Histogram* h);
+uint64_t            Histogram_percentile    (const Histogram* h, double percentile);
+
+////////////////////////////////////////////////////////////////////////////////
+// Typed by-value mailboxes
+//
+// TCPM_MAILBOX(Name, Type) declares, for a trivially copyable Type:
+//   PID         Name_spawn  (dq, parameters)   spawn with a mailbox of Type values
+//   SendResult  Name_send   (dest, value)      copy value into the slot, no allocation
+//   bool        Name_receive(dq, &value)       copy the next value out, false if none
+//   const Type* Name_value  (dq, msg)          msg as a Type if the handler got a value
+//
+// Values reach handlers (and Process_receiveMessage) as a pointer to a
+// per-process buffer, valid until the next receive and never to be freed.
+// Pointer messages are still accepted and delivered first. Local PIDs only.
+////////////////////////////////////////////////////////////////////////////////
+
+#define TCPM_MAILBOX(Name, Type)                                                    \
+    static inline PID Name##_spawn(ProcessQueue* dq, ProcessSpawnParameters* parameters) { \
+        parameters->messageSize = (uint32_t)sizeof(Type);                           \
+        return ProcessQueue_spawn(dq, parameters);                                  \
+    }                                                                               \
+    static inline SendResult Name##_send(PID dest, Type value) {                    \
+        return Process_sendValue(dest, &value, (uint32_t)sizeof(Type));             \
+    }                                                                               \
+    static inline bool Name##_receive(ProcessQueue* dq, Type* value) {              \
+        return Process_receiveValue(dq, value, (uint32_t)sizeof(Type));             \
+    }                                                                               \
+    static inline const Type* Name##_value(ProcessQueue* dq, const void* msg) {     \
+        return msg && msg == Process_valueBuffer(dq) ? (const Type*)msg : NULL;     \
+    }
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
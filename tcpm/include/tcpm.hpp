@@ -0,0 +1,391 @@
+#ifndef TCPM__HPP
+#define TCPM__HPP
+
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <bit>
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <tcpm.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Header-only C++20 layer over the C API
+//
+// Typed PIDs and actors, messages moved in and out of mailboxes, and actors
+// written as stackless coroutines awaiting their messages. Everything maps to
+// plain ProcessHandler callbacks: nothing is added to the scheduler.
+////////////////////////////////////////////////////////////////////////////////
+
+namespace tcpm {
+
+////////////////////////////////////////////////////////////////////////////////
+// Mail: a message as a mailbox pointer
+//
+// Trivially copyable types smaller than a pointer travel inside the pointer
+// itself, shifted above a tag byte so that it is never NULL nor
+// PROCESS_TIMEOUT. Larger ones, up to TCPM_VALUE_MAX bytes, are copied in the
+// slots of a by-value mailbox (see TCPM_MAILBOX) when the receiver has one, as
+// actors and tasks do. Anything else is moved to the heap and back.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef TCPM_VALUE_MAX
+#define TCPM_VALUE_MAX  256     // bytes per slot, times messageCap per process
+#endif
+
+template <typename Msg>
+struct Mail {
+    static_assert(std::is_move_constructible_v<Msg>, "messages must be movable");
+
+    static constexpr bool inlined   = std::is_trivially_copyable_v<Msg> && sizeof(Msg) < sizeof(void*);
+    static constexpr bool byValue   = std::is_trivially_copyable_v<Msg> && !inlined && sizeof(Msg) <= TCPM_VALUE_MAX;
+
+    // ProcessSpawnParameters::messageSize
+    static constexpr uint32_t messageSize = byValue ? uint32_t(sizeof(Msg)) : 0;
+
+    static void* pack(Msg&& msg) {
+        if constexpr( inlined ) {
+            uintptr_t   bits    = 0;
+            std::memcpy(&bits, &msg, sizeof(Msg));
+            return reinterpret_cast<void*>((bits << 8) | 1);
+        } else {
+            return new Msg(std::move(msg));
+        }
+    }
+
+    // msg is only moved from on SEND_SUCCESS
+    static SendResult send(PID pid, Msg& msg) {
+        if constexpr( byValue ) {
+            SendResult  res = Process_sendValue(pid, &msg, uint32_t(sizeof(Msg)));
+            if( res != SEND_UNSUPPORTED ) {
+                return res;
+            }
+            // a C process or a remote PID: through the heap
+        }
+        void*       raw = pack(std::move(msg));
+        SendResult  res = Process_sendMessage(pid, raw, MA_KEEP);
+        if( res != SEND_SUCCESS ) {
+            restore(raw, msg);
+        }
+        return res;
+    }
+
+    // takes ownership of raw, by-value messages are copied out of the process buffer
+    static Msg unpack(ProcessQueue* dq, void* raw) {
+        if constexpr( inlined ) {
+            (void)dq;
+            struct Bytes { unsigned char b[sizeof(Msg)]; } bytes;
+            uintptr_t   bits    = reinterpret_cast<uintptr_t>(raw) >> 8;
+            std::memcpy(bytes.b, &bits, sizeof(Msg));
+            return std::bit_cast<Msg>(bytes);
+        } else {
+            if constexpr( byValue ) {
+                if( raw == Process_valueBuffer(dq) ) {
+                    struct Bytes { unsigned char b[sizeof(Msg)]; } bytes;
+                    std::memcpy(bytes.b, raw, sizeof(Msg));
+                    return std::bit_cast<Msg>(bytes);
+                }
+            }
+            Msg*    heap    = static_cast<Msg*>(raw);
+            Msg     msg(std::move(*heap));
+            delete heap;
+            return msg;
+        }
+    }
+
+    // a failed send gives the message back
+    static void restore(void* raw, Msg& msg) {
+        if constexpr( !inlined ) {
+            Msg*    heap    = static_cast<Msg*>(raw);
+            msg     = std::move(*heap);
+            delete heap;
+        } else {
+            (void)raw;
+            (void)msg;
+        }
+    }
+
+    static void release(void* raw) {
+        if constexpr( !inlined ) {
+            delete static_cast<Msg*>(raw);
+        } else {
+            (void)raw;
+        }
+    }
+
+    // mailbox release function, none for inlined messages (values are never released)
+    static constexpr MessageRelease releaseFunction() {
+        return inlined ? nullptr : &Mail::release;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Pid: a PID accepting one message type
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Msg>
+class Pid {
+public:
+    Pid() = default;
+    explicit Pid(PID pid) : pid(pid) {}
+
+    // msg is only moved from on SEND_SUCCESS
+    SendResult send(Msg&& msg) const {
+        return Mail<Msg>::send(pid, msg);
+    }
+
+    PID raw() const { return pid; }
+    explicit operator bool() const { return pid.pq != nullptr; }
+
+private:
+    PID     pid = {};
+};
+
+struct SpawnOptions {
+    uint32_t    messageCap          = 64;
+    uint32_t    maxMessagePerCycle  = 16;
+    Histogram*  latencyHistogram    = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Task: an actor as a coroutine
+//
+// The process handler resumes the coroutine with its message, the coroutine
+// runs until it awaits the next one (or yields, or returns) and the handler
+// returns PCT_WAIT_MESSAGE (PCT_CONTINUE, PCT_STOP) to the worker.
+////////////////////////////////////////////////////////////////////////////////
+
+struct TaskPromiseBase {
+    void*               message = nullptr;  // handed over by the handler
+    ProcessContinuation pct     = PCT_WAIT_MESSAGE;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    // an exception cannot cross the C scheduler
+    void unhandled_exception() noexcept { std::terminate(); }
+};
+
+template <typename Msg>
+class Task {
+public:
+    struct promise_type : TaskPromiseBase {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if( handle ) {
+            handle.destroy();
+        }
+    }
+
+    // the process owns the coroutine from now on
+    Pid<Msg> spawn(ProcessQueue* dq, const SpawnOptions& options = {}) && {
+        ProcessSpawnParameters  sp  = {};
+        sp.handler              = &Task::handler;
+        sp.initialState         = std::exchange(handle, {}).address();
+        sp.releaseState         = &Task::release;
+        sp.messageRelease       = Mail<Msg>::releaseFunction();
+        sp.messageSize          = Mail<Msg>::messageSize;
+        sp.messageCap           = options.messageCap;
+        sp.maxMessagePerCycle   = options.maxMessagePerCycle;
+        sp.latencyHistogram     = options.latencyHistogram;
+        return Pid<Msg>(ProcessQueue_spawn(dq, &sp));
+    }
+
+private:
+    using Handle    = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle handle) : handle(handle) {}
+
+    static ProcessContinuation handler(ProcessQueue* dq, void* state, void* msg) noexcept {
+        (void)dq;
+        Handle  h   = Handle::from_address(state);
+        h.promise().message = msg;
+        h.resume();
+        return h.done() ? PCT_STOP : h.promise().pct;
+    }
+
+    static void release(void* state) {
+        Handle::from_address(state).destroy();
+    }
+
+    Handle  handle;
+};
+
+template <typename Msg>
+class ReceiveAwaiter {
+public:
+    explicit ReceiveAwaiter(ProcessQueue* dq) : dq(dq) {}
+
+    // no suspension when a message is already there
+    bool await_ready() {
+        raw = Process_receiveMessage(dq);
+        return raw != nullptr;
+    }
+    void await_suspend(std::coroutine_handle<typename Task<Msg>::promise_type> h) {
+        promise = &h.promise();
+        promise->pct    = PCT_WAIT_MESSAGE;
+    }
+    Msg await_resume() {
+        return Mail<Msg>::unpack(dq, promise ? promise->message : raw);
+    }
+
+private:
+    ProcessQueue*       dq;
+    void*               raw     = nullptr;
+    TaskPromiseBase*    promise = nullptr;
+};
+
+template <typename Msg>
+class TimedReceiveAwaiter {
+public:
+    TimedReceiveAwaiter(ProcessQueue* dq, uint64_t timeoutNs) : dq(dq), timeoutNs(timeoutNs) {}
+
+    bool await_ready() {
+        raw = Process_receiveMessage(dq);
+        return raw != nullptr;
+    }
+    void await_suspend(std::coroutine_handle<typename Task<Msg>::promise_type> h) {
+        promise = &h.promise();
+        promise->pct    = PCT_WAIT_MESSAGE;
+        Process_receiveTimeout(dq, timeoutNs);
+    }
+    // std::nullopt on timeout
+    std::optional<Msg> await_resume() {
+        void*   msg = promise ? promise->message : raw;
+        if( msg == PROCESS_TIMEOUT ) {
+            return std::nullopt;
+        }
+        return Mail<Msg>::unpack(dq, msg);
+    }
+
+private:
+    ProcessQueue*       dq;
+    uint64_t            timeoutNs;
+    void*               raw     = nullptr;
+    TaskPromiseBase*    promise = nullptr;
+};
+
+struct YieldAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> h) const noexcept {
+        h.promise().pct = PCT_CONTINUE;
+    }
+    void await_resume() const noexcept {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Context: what a handler or a task knows about its process
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Msg>
+class Context {
+public:
+    explicit Context(ProcessQueue* dq) : dq(dq) {}
+
+    ProcessQueue* queue() const { return dq; }
+    Pid<Msg> self() const { return Pid<Msg>(Process_self(dq)); }
+
+    // handlers: ask for a timeout() call if nothing arrives, see Process_receiveTimeout
+    void receiveTimeout(uint64_t timeoutNs) const { Process_receiveTimeout(dq, timeoutNs); }
+
+    // tasks: co_await ctx.receive(), ctx.receiveFor(ns), ctx.yield()
+    ReceiveAwaiter<Msg> receive() const { return ReceiveAwaiter<Msg>(dq); }
+    TimedReceiveAwaiter<Msg> receiveFor(uint64_t timeoutNs) const { return TimedReceiveAwaiter<Msg>(dq, timeoutNs); }
+    YieldAwaiter yield() const { return {}; }
+
+private:
+    ProcessQueue*   dq;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Actor: a process whose state is a State object
+//
+// State is called as state(ctx, msg) for each message, and if it has them,
+// state.start(ctx) on the first call and state.timeout(ctx) on a timeout;
+// all return the ProcessContinuation. Without start() the process waits for
+// its first message. The State is destroyed with the process.
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename State, typename Msg>
+class Actor {
+    static_assert(std::is_invocable_r_v<ProcessContinuation, State&, Context<Msg>&, Msg&&>,
+                  "State must be callable as ProcessContinuation(Context<Msg>&, Msg&&)");
+
+public:
+    static Pid<Msg> spawn(ProcessQueue* dq, State state, const SpawnOptions& options = {}) {
+        ProcessSpawnParameters  sp  = {};
+        sp.handler              = &Actor::handler;
+        sp.initialState         = new State(std::move(state));
+        sp.releaseState         = &Actor::release;
+        sp.messageRelease       = Mail<Msg>::releaseFunction();
+        sp.messageSize          = Mail<Msg>::messageSize;
+        sp.messageCap           = options.messageCap;
+        sp.maxMessagePerCycle   = options.maxMessagePerCycle;
+        sp.latencyHistogram     = options.latencyHistogram;
+        return Pid<Msg>(ProcessQueue_spawn(dq, &sp));
+    }
+
+private:
+    static ProcessContinuation handler(ProcessQueue* dq, void* state, void* msg) noexcept {
+        State&          s   = *static_cast<State*>(state);
+        Context<Msg>    ctx(dq);
+        if( msg == nullptr ) {
+            if constexpr( requires { { s.start(ctx) } -> std::same_as<ProcessContinuation>; } ) {
+                return s.start(ctx);
+            } else {
+                return PCT_WAIT_MESSAGE;
+            }
+        }
+        if( msg == PROCESS_TIMEOUT ) {
+            if constexpr( requires { { s.timeout(ctx) } -> std::same_as<ProcessContinuation>; } ) {
+                return s.timeout(ctx);
+            } else {
+                return PCT_WAIT_MESSAGE;
+            }
+        }
+        return s(ctx, Mail<Msg>::unpack(dq, msg));
+    }
+
+    static void release(void* state) {
+        delete static_cast<State*>(state);
+    }
+};
+
+} // namespace tcpm
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef TCPM_METRICS__H
+#define TCPM_METRICS__H
+
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <tcpm.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Layout of the shared memory segment published by a process queue built
+// with TCPM_METRICS (/dev/shm/tcpm.<pid>.<n>, or $TCPM_METRICS_NAME).
+//
+// Every worker copies its counters into its own slot every few milliseconds,
+// readers must tolerate values being updated while they read them.
+////////////////////////////////////////////////////////////////////////////////
+
+#define METRICS_MAGIC           0x6d7063742d6d7074ull
+#define METRICS_VERSION         1
+
+typedef struct {
+    ProcessQueueCounters    counters;
+    Histogram               mailboxLatency;     // empty without TCPM_LATENCY_HISTOGRAMS
+} WorkerMetrics;
+
+struct MetricsSegment {
+    uint64_t                magic;
+    uint32_t                version;
+    uint32_t                pid;                // OS process id of the publisher
+    uint32_t                threadCount;
+    uint32_t                processCap;
+    uint64_t                publishNs;          // CLOCK_MONOTONIC of the last publication
+    uint64_t                processCount;
+    uint64_t                runQueueDepth;
+    WorkerMetrics           workers[];          // threadCount + 1, the last one for non-worker threads
+};
+
+typedef struct MetricsSegment       MetricsSegment;
+
+#endif
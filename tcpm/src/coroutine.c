@@ -0,0 +1,314 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+#ifdef __SANITIZE_THREAD__
+#include <sanitizer/tsan_interface.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Coroutines: stackful processes with blocking receive
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define COROUTINE_STACK_MIN     (16 * 1024)
+
+#if defined(__x86_64__)
+#define COROUTINE_SUPPORTED
+
+// void* tcpmCoSwitch(void** saveSp, void* loadSp, void* value)
+//
+// saves the callee-saved registers and the SSE/x87 control words on the
+// current stack, stores its pointer in saveSp, then restores the ones saved
+// on loadSp and returns value there. A new stack is prepared to return to
+// tcpmCoStart with the Coroutine in r12.
+__asm__(
+    ".text\n"
+    ".globl tcpmCoSwitch\n"
+    ".hidden tcpmCoSwitch\n"
+    ".type tcpmCoSwitch, @function\n"
+    ".p2align 4\n"
+    "tcpmCoSwitch:\n"
+    "    pushq   %rbp\n"
+    "    pushq   %rbx\n"
+    "    pushq   %r12\n"
+    "    pushq   %r13\n"
+    "    pushq   %r14\n"
+    "    pushq   %r15\n"
+    "    subq    $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw  4(%rsp)\n"
+    "    movq    %rsp, (%rdi)\n"
+    "    movq    %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw   4(%rsp)\n"
+    "    addq    $8, %rsp\n"
+    "    popq    %r15\n"
+    "    popq    %r14\n"
+    "    popq    %r13\n"
+    "    popq    %r12\n"
+    "    popq    %rbx\n"
+    "    popq    %rbp\n"
+    "    movq    %rdx, %rax\n"
+    "    ret\n"
+    ".size tcpmCoSwitch, .-tcpmCoSwitch\n"
+    ".globl tcpmCoStart\n"
+    ".hidden tcpmCoStart\n"
+    ".type tcpmCoStart, @function\n"
+    ".p2align 4\n"
+    "tcpmCoStart:\n"
+    "    movq    %r12, %rdi\n"
+    "    movq    %rax, %rsi\n"
+    "    call    tcpmCoroutineMain\n"
+    "    ud2\n"
+    ".size tcpmCoStart, .-tcpmCoStart\n"
+);
+
+void*   tcpmCoSwitch        (void** saveSp, void* loadSp, void* value)  __attribute__((visibility("hidden")));
+void    tcpmCoStart         (void)                                      __attribute__((visibility("hidden")));
+void    tcpmCoroutineMain   (Coroutine* co, void* msg)                  __attribute__((visibility("hidden"), used, noreturn));
+
+// frame popped by tcpmCoSwitch on the first switch to the coroutine
+static
+void*
+initialFrame(Coroutine* co) {
+    uint32_t    mxcsr   = 0;
+    uint16_t    fpucw   = 0;
+    __asm__ volatile( "stmxcsr %0" : "=m"(mxcsr) );
+    __asm__ volatile( "fnstcw %0" : "=m"(fpucw) );
+
+    // 16 bytes aligned once tcpmCoStart is returned to
+    void**      sp      = (void**)((uintptr_t)co & ~(uintptr_t)15);
+    *--sp   = (void*)tcpmCoStart;
+    *--sp   = NULL;                 // rbp
+    *--sp   = NULL;                 // rbx
+    *--sp   = co;                   // r12
+    *--sp   = NULL;                 // r13
+    *--sp   = NULL;                 // r14
+    *--sp   = NULL;                 // r15
+    --sp;
+    memcpy(sp, &mxcsr, sizeof(mxcsr));
+    memcpy((char*)sp + 4, &fpucw, sizeof(fpucw));
+    return sp;
+}
+#endif
+
+static
+size_t
+pageSize(void) {
+    static size_t   size    = 0;
+    if( size == 0 ) {
+        size    = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return size;
+}
+
+static
+size_t
+mappingSize(uint32_t stackSize) {
+    size_t  page    = pageSize();
+    size_t  size    = stackSize < COROUTINE_STACK_MIN ? COROUTINE_STACK_MIN : stackSize;
+    return ((size + sizeof(Coroutine) + page - 1) & ~(page - 1)) + page;
+}
+
+// the lowest page is the guard, the Coroutine is at the top
+static
+Coroutine*
+newCoroutine(uint32_t stackSize) {
+    size_t  size    = mappingSize(stackSize);
+    void*   base    = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if( base == MAP_FAILED ) {
+        return NULL;
+    }
+    if( mprotect(base, pageSize(), PROT_NONE) != 0 ) {
+        munmap(base, size);
+        return NULL;
+    }
+    Coroutine*  co  = (Coroutine*)(((uintptr_t)base + size - sizeof(Coroutine)) & ~(uintptr_t)63);
+    co->base        = base;
+    co->mappedSize  = size;
+    return co;
+}
+
+static
+void
+unmapCoroutine(void* element) {
+    Coroutine*  co  = (Coroutine*)element;
+    munmap(co->base, co->mappedSize);
+}
+
+void
+Coroutine_init(ProcessQueue* dq) {
+    BoundedQueue_init(&dq->coroutinePool, COROUTINE_POOL_SIZE, unmapCoroutine);
+}
+
+void
+Coroutine_release(ProcessQueue* dq) {
+    BoundedQueue_release(&dq->coroutinePool);
+}
+
+#ifdef COROUTINE_SUPPORTED
+
+static
+ProcessContinuation
+coroutineHandler(ProcessQueue* dq, void* state, void* msg) {
+    Coroutine*  co  = (Coroutine*)state;
+    (void)dq;
+#ifdef __SANITIZE_THREAD__
+    co->workerFiber = __tsan_get_current_fiber();
+    __tsan_switch_to_fiber(co->fiber, 0);
+#endif
+    tcpmCoSwitch(&co->workerSp, co->sp, msg);
+    return co->pct;
+}
+
+// back to the worker, returns the message the coroutine is resumed with
+static
+void*
+suspend(Coroutine* co, ProcessContinuation pct) {
+    co->pct = pct;
+#ifdef __SANITIZE_THREAD__
+    __tsan_switch_to_fiber(co->workerFiber, 0);
+#endif
+    return tcpmCoSwitch(&co->sp, co->workerSp, NULL);
+}
+
+void
+tcpmCoroutineMain(Coroutine* co, void* msg) {
+    (void)msg;  // the first call of a process has no message
+    co->body(co->dq, co->state);
+    suspend(co, PCT_STOP);
+    abort();    // a stopped process is never resumed
+}
+
+static
+void
+coroutineRelease(void* state) {
+    Coroutine*      co  = (Coroutine*)state;
+    ProcessQueue*   dq  = co->dq;
+    if( co->releaseState ) {
+        co->releaseState(co->state);
+    }
+#ifdef __SANITIZE_THREAD__
+    __tsan_destroy_fiber(co->fiber);
+#endif
+    // frames left on a stopped coroutine stack are dropped, nothing unwinds them
+    if( co->mappedSize != mappingSize(COROUTINE_STACK_SIZE) || !BoundedQueue_push(&dq->coroutinePool, co) ) {
+        unmapCoroutine(co);
+    }
+}
+
+static
+Coroutine*
+currentCoroutine(ProcessQueue* dq, Process** proc) {
+    *proc   = (Process*)pthread_getspecific(dq->currentProcess);
+    return *proc && (*proc)->handler == coroutineHandler ? (Coroutine*)(*proc)->state : NULL;
+}
+
+PID
+ProcessQueue_spawnCoroutine(ProcessQueue* dq, ProcessSpawnParameters* parameters, CoroutineBody body, uint32_t stackSize) {
+    stackSize   = stackSize ? stackSize : COROUTINE_STACK_SIZE;
+    Coroutine*  co  = NULL;
+    if( mappingSize(stackSize) == mappingSize(COROUTINE_STACK_SIZE) ) {
+        co  = (Coroutine*)BoundedQueue_pop(&dq->coroutinePool);
+    }
+    if( co == NULL && (co = newCoroutine(stackSize)) == NULL ) {
+        if( parameters->releaseState ) {
+            parameters->releaseState(parameters->initialState);
+        }
+        return (PID){ .pq = NULL, .id = 0, .gen = 0 };
+    }
+
+    co->body            = body;
+    co->state           = parameters->initialState;
+    co->releaseState    = parameters->releaseState;
+    co->dq              = dq;
+    co->sp              = initialFrame(co);
+#ifdef __SANITIZE_THREAD__
+    co->fiber           = __tsan_create_fiber(0);
+#endif
+
+    ProcessSpawnParameters  sp  = *parameters;
+    sp.handler          = coroutineHandler;
+    sp.initialState     = co;
+    sp.releaseState     = coroutineRelease;
+    return ProcessQueue_spawn(dq, &sp);     // releases co on failure
+}
+
+void*
+Process_receiveBlocking(ProcessQueue* dq) {
+    Process*    proc    = NULL;
+    Coroutine*  co      = currentCoroutine(dq, &proc);
+    if( co == NULL ) {
+        return NULL;
+    }
+    // no switch when a message is already there
+    void*       msg     = Process_receiveMessage(dq);
+    if( msg ) {
+        proc->deadline  = 0;
+        return msg;
+    }
+    return suspend(co, PCT_WAIT_MESSAGE);
+}
+
+void
+Process_yield(ProcessQueue* dq) {
+    Process*    proc    = NULL;
+    Coroutine*  co      = currentCoroutine(dq, &proc);
+    if( co ) {
+        suspend(co, PCT_CONTINUE);
+    }
+}
+
+#else
+
+PID
+ProcessQueue_spawnCoroutine(ProcessQueue* dq, ProcessSpawnParameters* parameters, CoroutineBody body, uint32_t stackSize) {
+    (void)dq;
+    (void)body;
+    (void)stackSize;
+    if( parameters->releaseState ) {
+        parameters->releaseState(parameters->initialState);
+    }
+    return (PID){ .pq = NULL, .id = 0, .gen = 0 };
+}
+
+void*
+Process_receiveBlocking(ProcessQueue* dq) {
+    (void)dq;
+    return NULL;
+}
+
+void
+Process_yield(ProcessQueue* dq) {
+    (void)dq;
+}
+
+#endif
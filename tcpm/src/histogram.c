@@ -0,0 +1,135 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <memory.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Log-bucketed histogram
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define SUB_BUCKET_COUNT    (1u << HISTOGRAM_SUB_BUCKET_BITS)
+#define LINEAR_LIMIT        (2u << HISTOGRAM_SUB_BUCKET_BITS)
+
+static inline
+uint32_t
+bucketIndex(uint64_t value) {
+    if( value < LINEAR_LIMIT ) {
+        return (uint32_t)value;
+    }
+    uint32_t shift  = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BUCKET_BITS;
+    return (shift << HISTOGRAM_SUB_BUCKET_BITS) + (uint32_t)(value >> shift);
+}
+
+// highest value that maps to the same bucket
+static inline
+uint64_t
+bucketValue(uint32_t index) {
+    if( index < LINEAR_LIMIT ) {
+        return index;
+    }
+    uint32_t shift  = (index >> HISTOGRAM_SUB_BUCKET_BITS) - 1;
+    uint64_t mant   = index - (shift << HISTOGRAM_SUB_BUCKET_BITS);
+    return ((mant + 1) << shift) - 1;
+}
+
+void
+Histogram_init(Histogram* h) {
+    memset(h, 0, sizeof(Histogram));
+}
+
+void
+Histogram_record(Histogram* h, uint64_t value) {
+    atomic_fetch_add_explicit((atomic_uint64_t*)&h->buckets[bucketIndex(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit((atomic_uint64_t*)&h->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit((atomic_uint64_t*)&h->count, 1, memory_order_relaxed);
+
+    uint64_t    max = atomic_load_explicit((atomic_uint64_t*)&h->max, memory_order_relaxed);
+    while( value > max && !atomic_compare_exchange_weak((atomic_uint64_t*)&h->max, &max, value) );
+}
+
+void
+Histogram_merge(Histogram* dst, const Histogram* src) {
+    for( uint32_t b = 0; b < HISTOGRAM_BUCKET_COUNT; ++b ) {
+        uint64_t    n   = atomic_load_explicit((atomic_uint64_t*)&src->buckets[b], memory_order_relaxed);
+        if( n ) {
+            atomic_fetch_add_explicit((atomic_uint64_t*)&dst->buckets[b], n, memory_order_relaxed);
+        }
+    }
+    atomic_fetch_add_explicit((atomic_uint64_t*)&dst->sum, atomic_load_explicit((atomic_uint64_t*)&src->sum, memory_order_relaxed), memory_order_relaxed);
+    atomic_fetch_add_explicit((atomic_uint64_t*)&dst->count, Histogram_count(src), memory_order_relaxed);
+
+    uint64_t    value   = Histogram_max(src);
+    uint64_t    max     = atomic_load_explicit((atomic_uint64_t*)&dst->max, memory_order_relaxed);
+    while( value > max && !atomic_compare_exchange_weak((atomic_uint64_t*)&dst->max, &max, value) );
+}
+
+uint64_t
+Histogram_count(const Histogram* h) {
+    return atomic_load_explicit((atomic_uint64_t*)&h->count, memory_order_relaxed);
+}
+
+uint64_t
+Histogram_max(const Histogram* h) {
+    return atomic_load_explicit((atomic_uint64_t*)&h->max, memory_order_relaxed);
+}
+
+double
+Histogram_mean(const Histogram* h) {
+    uint64_t    count   = Histogram_count(h);
+    return count ? (double)atomic_load_explicit((atomic_uint64_t*)&h->sum, memory_order_relaxed) / (double)count : 0.0;
+}
+
+// percentile in [0, 100], e.g. 99.9 for p999
+uint64_t
+Histogram_percentile(const Histogram* h, double percentile) {
+    // the total is summed from the buckets so that concurrent recording
+    // cannot make the target rank unreachable
+    uint64_t    total   = 0;
+    for( uint32_t b = 0; b < HISTOGRAM_BUCKET_COUNT; ++b ) {
+        total  += atomic_load_explicit((atomic_uint64_t*)&h->buckets[b], memory_order_relaxed);
+    }
+    if( total == 0 ) {
+        return 0;
+    }
+
+    if( percentile > 100.0 ) { percentile = 100.0; }
+    if( percentile < 0.0 )   { percentile = 0.0; }
+    uint64_t    rank    = (uint64_t)((percentile / 100.0) * (double)total + 0.5);
+    if( rank == 0 ) { rank = 1; }
+
+    uint64_t    seen    = 0;
+    for( uint32_t b = 0; b < HISTOGRAM_BUCKET_COUNT; ++b ) {
+        seen   += atomic_load_explicit((atomic_uint64_t*)&h->buckets[b], memory_order_relaxed);
+        if( seen >= rank ) {
+            uint64_t    value   = bucketValue(b);
+            uint64_t    max     = Histogram_max(h);
+            return (max && value > max) ? max : value;
+        }
+    }
+    return Histogram_max(h);
+}
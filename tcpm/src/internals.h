@@ -26,16 +26,86 @@
     SOFTWARE.
 */
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
 #include <tcpm.h>
 
 #define _GNU_SOURCE
 #include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/types.h>
 
 typedef _Atomic uint32_t atomic_uint32_t;
 typedef _Atomic uint64_t atomic_uint64_t;
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline
+uint64_t
+monotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// cheapest monotonic tick counter available (TSC on x86), see monotonicNs for conversion
+static inline
+uint64_t
+readTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t    ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return monotonicNs();
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// spinlock
+////////////////////////////////////////////////////////////////////////////////
+
+static inline
+void
+spinLock(atomic_bool* lock) {
+    bool expected   = false;
+    while( !atomic_compare_exchange_weak(lock, &expected, true) ) {
+        expected    = false;
+    }
+}
+
+static inline
+void
+unlock(atomic_bool* lock) {
+    bool expected   = true;
+    bool current    = atomic_load(lock);
+    if( expected != current ) {
+        fprintf(stderr, "current: %u - expected: %u\n", current, expected);
+        assert(expected == current);
+    }
+    if( !atomic_compare_exchange_strong(lock, &expected, false) ) {
+        fprintf(stderr, "atomic_compare_exchange_strong failed in unlock! will die!\n");
+        exit(1);
+    }
+}
+
+static inline
+bool
+tryLock(atomic_bool* lock) {
+    bool expected   = false;
+    return atomic_compare_exchange_strong(lock, &expected, true);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Lock-free bounded queue
 //
@@ -47,6 +117,9 @@ typedef _Atomic uint64_t atomic_uint64_t;
 typedef struct {
     atomic_uint32_t     seq;
     void*               data;
+#ifdef TCPM_LATENCY_HISTOGRAMS
+    uint64_t            stamp;      // enqueue time (ns), only set when the queue is timestamped
+#endif
 } Element;
 
 typedef void            (*ElementRelease)   (void* element);
@@ -57,18 +130,93 @@ typedef struct {
     uint32_t            cap;
     Element*            elements;
     ElementRelease      elementRelease;
+#ifdef TCPM_LATENCY_HISTOGRAMS
+    bool                timestamped;
+#endif
+#ifdef TCPM_QUEUE_STATS
+    ProcessQueue*       statsQueue; // counted per worker of this queue, NULL if not counted
+    QueueStatsKind      statsKind;  // shared by all the queues of the same kind
+#endif
 } BoundedQueue;
 
+#ifdef TCPM_QUEUE_STATS
+#define QUEUE_STAT(...)     __VA_ARGS__
+#else
+#define QUEUE_STAT(...)
+#endif
+
 BoundedQueue*   BoundedQueue_init   (BoundedQueue* bq, uint32_t cap, ElementRelease elementRelease);
 void            BoundedQueue_release(BoundedQueue* bq);
 bool            BoundedQueue_push   (BoundedQueue* bq, void* data);
 void*           BoundedQueue_pop    (BoundedQueue* bq); // up to the receiver to free the message
+#ifdef TCPM_LATENCY_HISTOGRAMS
+void*           BoundedQueue_popStamped(BoundedQueue* bq, uint64_t* stamp);
+#endif
+
+// approximate number of queued elements, racy by nature
+static inline
+uint32_t
+BoundedQueue_size(BoundedQueue* bq) {
+    uint32_t    first   = atomic_load_explicit(&bq->first, memory_order_relaxed);
+    uint32_t    last    = atomic_load_explicit(&bq->last, memory_order_relaxed);
+    int32_t     size    = (int32_t)(last - first);
+    if( size < 0 ) { return 0; }
+    return (uint32_t)size > bq->cap ? bq->cap : (uint32_t)size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Lock-free bounded queue of values
+//
+// The BoundedQueue algorithm, with values of up to valueSize bytes copied in
+// and out of the slots. Nothing in a ring is a pointer (slots are found by
+// offset from the ring) so it can live in shared memory.
+////////////////////////////////////////////////////////////////////////////////
+
+#define VALUE_RING_LINE     64      // first and last on their own cache lines
+
+typedef struct {
+    uint64_t            magic;      // shared channels: written last by the creator
+    uint32_t            version;
+    uint32_t            cap;
+    uint32_t            valueSize;
+    uint32_t            slotSize;   // stride
+    uint64_t            slotsOffset;    // from the ring
+    uint8_t             pad0[VALUE_RING_LINE - 32];
+    atomic_uint32_t     first;
+    uint8_t             pad1[VALUE_RING_LINE - sizeof(atomic_uint32_t)];
+    atomic_uint32_t     last;
+    uint8_t             pad2[VALUE_RING_LINE - sizeof(atomic_uint32_t)];
+} ValueRing;
+
+typedef struct {
+    atomic_uint32_t     seq;
+    uint32_t            size;
+    unsigned char       value[];
+} ValueSlot;
+
+size_t      ValueRing_footprint (uint32_t cap, uint32_t valueSize, uint32_t slotAlign);
+ValueRing*  ValueRing_init      (void* memory, uint32_t cap, uint32_t valueSize, uint32_t slotAlign);
+bool        ValueRing_push      (ValueRing* vr, const void* value, uint32_t size);
+bool        ValueRing_pop       (ValueRing* vr, void* value, uint32_t* size);   // value holds valueSize bytes
+
+// approximate number of queued values, racy by nature
+static inline
+uint32_t
+ValueRing_size(ValueRing* vr) {
+    uint32_t    first   = atomic_load_explicit(&vr->first, memory_order_relaxed);
+    uint32_t    last    = atomic_load_explicit(&vr->last, memory_order_relaxed);
+    int32_t     size    = (int32_t)(last - first);
+    if( size < 0 ) { return 0; }
+    return (uint32_t)size > vr->cap ? vr->cap : (uint32_t)size;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // Process Management
 ////////////////////////////////////////////////////////////////////////////////
 
 typedef struct Process              Process;
+typedef struct MetricsSegment       MetricsSegment;
+typedef struct Profile              Profile;
 
 typedef enum {
     PS_RUNNING,
@@ -77,6 +225,7 @@ typedef enum {
 
 struct Process {
     atomic_bool         releaseLock;
+    atomic_bool         alive;              // published last on spawn, for introspection
     uint64_t            id;                 // index
     atomic_uint64_t     gen;                // generation
     void*               state;
@@ -87,8 +236,325 @@ struct Process {
     ProcessReleaseState releaseState;
     ProcessQueue*       processQueue;
     Process*            parent;
+    uint64_t            parentGen;          // parent generation at spawn time
+    Histogram*          latencyHistogram;   // per process class (optional)
+    uint64_t            deadline;           // receive timeout (monotonic ns), 0 if none
+    ValueRing*          values;             // by-value mailbox (messageSize), NULL if none
+    void*               valueBuffer;        // last value popped, handed to the handler
+    void*               valuesMemory;       // kept across spawns, only freed once outgrown
+    size_t              valuesFootprint;
+    atomic_uint32_t     valueCount;         // values queued, what introspection reads
+    atomic_int          watchedFds;         // first armed fd watch (linked in the reactor), -1 if none
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Scheduling event tracer
+//
+// Every worker owns a ring buffer it is the only writer of, events emitted
+// from other threads go to a shared ring. Rings overwrite their oldest events.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef TCPM_TRACE_RING_SIZE
+#define TCPM_TRACE_RING_SIZE    (1u << 16)  // events per ring, power of 2
+#endif
+
+typedef enum {
+    TE_SPAWN,
+    TE_SCHEDULE,        // popped from the run queue
+    TE_HANDLER_START,
+    TE_HANDLER_STOP,
+    TE_PARK,            // waiting process put back with an empty mailbox
+    TE_SEND_FAIL,
+    TE_RELEASE,
+} TraceEventType;
+
+typedef struct {
+    atomic_uint64_t     seq;        // index + 1 once written, 0 while being written
+    uint64_t            ticks;
+    uint64_t            id;
+    uint64_t            gen;
+    uint64_t            arg;
+    uint32_t            type;
+} TraceEvent;
+
+typedef struct {
+    atomic_uint64_t     head;
+    TraceEvent*         events;
+} TraceRing;
+
+////////////////////////////////////////////////////////////////////////////////
+// Asynchronous logging
+//
+// Single producer / single consumer rings of formatted records, drained by
+// a background thread. A full ring drops the record instead of blocking.
+////////////////////////////////////////////////////////////////////////////////
+
+#define LOG_RING_SIZE       1024    // records per ring, power of 2
+#define LOG_TEXT_SIZE       200
+
+typedef struct {
+    uint64_t            ns;         // CLOCK_REALTIME
+    uint64_t            id;         // running process, UINT64_MAX if none
+    uint64_t            gen;
+    uint32_t            level;
+    uint32_t            length;
+    char                text[LOG_TEXT_SIZE];
+} LogRecord;
+
+typedef struct {
+    atomic_uint64_t     head;       // written by the producer
+    atomic_uint64_t     tail;       // written by the drain thread
+    atomic_uint64_t     dropped;
+    uint64_t            reportedDrops;  // drain thread only
+    LogRecord*          records;
+} LogRing;
+
+////////////////////////////////////////////////////////////////////////////////
+// Reactor
+//
+// One epoll instance per queue, polled without blocking by whichever worker
+// takes the lock: when idle and every REACTOR_POLL_INTERVAL scheduling loops.
+// Interests are oneshot, a readiness event is delivered as a message to the
+// watching process and has to be re-armed.
+////////////////////////////////////////////////////////////////////////////////
+
+#define REACTOR_POLL_INTERVAL   64      // worker loops between two polls
+#define REACTOR_EVENTS          256     // events per epoll_wait
+
+typedef struct {
+    PID                 owner;      // owner.pq == NULL when not armed
+    void*               message;
+    int                 next;       // armed watches of the owner process slot, -1 at the ends
+    int                 prev;
+} FdWatch;
+
+typedef struct {
+    PID                 dest;
+    void*               message;
+    MessageRelease      release;    // if the destination died, NULL if not ours
+} PendingDelivery;
+
+#define SIGNAL_MAX          65      // signal numbers are below
+
+typedef struct {
+    SharedChannel*      channel;
+    PID                 owner;      // owner.pq == NULL when not armed
+    void*               message;
+} ChannelWatch;
+
+typedef struct {
+    int                 epollFd;
+    atomic_bool         lock;
+    atomic_uint32_t     active;     // armed watches + pending deliveries + I/O requests, no poll when 0
+    uint32_t            armed;      // armed watches
+    FdWatch*            watches;    // indexed by fd
+    uint32_t            watchCap;
+    PendingDelivery*    pending;    // mailbox was full or busy, retried on next poll
+    uint32_t            pendingCount;
+    uint32_t            pendingCap;
+    int                 signalFd;   // -1 until a signal is watched
+    sigset_t            signalMask;
+    PID                 signalRoutes[SIGNAL_MAX];
+    atomic_uint32_t     signalMaskGen;  // workers block signalMask when it changes
+    ChannelWatch*       channels;   // shared channels polled for messages
+    uint32_t            channelCount;
+    uint32_t            channelCap;
+} Reactor;
+
+////////////////////////////////////////////////////////////////////////////////
+// Asynchronous I/O
+//
+// Requests are staged in a lock-free queue. With io_uring, the worker holding
+// the reactor lock moves all of them into the submission ring with a single
+// io_uring_enter, after each scheduling cycle that staged some; completions
+// are reaped on every reactor poll. Otherwise a small thread pool runs the
+// blocking calls, after polling the fd along with a stop eventfd so that a
+// request waiting for data does not hold the release. The backend is started
+// on the first submission, in-flight requests are cancelled at release.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef TCPM_IO_THREADS
+#define TCPM_IO_THREADS     4       // fallback pool size
+#endif
+#define IO_QUEUE_SIZE       4096    // staged and completed requests
+#define IO_URING_ENTRIES    256
+
+typedef enum {
+    IOB_NONE,
+    IOB_URING,
+    IOB_THREADS,
+} IoBackend;
+
+typedef struct {
+    atomic_int          backend;
+    atomic_bool         initLock;
+    BoundedQueue        staged;
+    atomic_uint32_t     stagedCount;
+#ifdef TCPM_IO_URING
+    int                 ringFd;
+    uint32_t            inflight;
+    IoRequest**         submitted;  // cqEntries, by slot (the sqe user_data)
+    uint32_t*           freeSlots;
+    uint32_t            freeCount;
+    uint32_t            sqEntries;
+    uint32_t            cqEntries;
+    void*               sqRing;
+    void*               cqRing;
+    size_t              sqRingSize;
+    size_t              cqRingSize;
+    void*               sqes;
+    atomic_uint32_t*    sqHead;
+    atomic_uint32_t*    sqTail;
+    uint32_t            sqMask;
+    uint32_t*           sqArray;
+    atomic_uint32_t*    cqHead;
+    atomic_uint32_t*    cqTail;
+    uint32_t            cqMask;
+    void*               cqes;
+#endif
+    BoundedQueue        completed;  // thread pool only
+    int                 stopFd;     // eventfd, readable once the pool stops
+    sem_t               work;
+    atomic_bool         running;
+    pthread_t           threads[TCPM_IO_THREADS];
+} IoService;
+
+////////////////////////////////////////////////////////////////////////////////
+// Timers
+//
+// Hierarchical timing wheel (TIMER_LEVELS levels of TIMER_SLOTS slots, ticks
+// of TIMER_TICK_NS), sharded: one shard per worker, where its processes
+// insert, plus one for the other threads. Nodes live in a per-shard array and
+// are linked by index, insert and cancel are O(1). A worker advances its own
+// shard and the external one along with the reactor, an idle worker every
+// shard it can lock.
+////////////////////////////////////////////////////////////////////////////////
+
+#define TIMER_TICK_NS       (1000 * 1000)
+#define TIMER_SLOT_BITS     8
+#define TIMER_SLOTS         (1u << TIMER_SLOT_BITS)
+#define TIMER_LEVELS        4
+#define TIMER_NIL           UINT32_MAX
+
+typedef struct {
+    uint64_t            expiry;     // tick
+    PID                 dest;
+    void*               message;
+    MessageRelease      release;    // if the destination died, may be NULL
+    uint32_t            next;       // slot list, or free list
+    uint32_t            prev;
+    uint32_t            slot;       // level * TIMER_SLOTS + slot, TIMER_NIL when free
+    uint32_t            gen;        // 24 bits, part of the handle
+} TimerNode;
+
+typedef struct {
+    atomic_bool         lock;
+    atomic_uint32_t     count;      // armed timers
+    uint64_t            now;        // last processed tick
+    uint32_t            heads[TIMER_LEVELS * TIMER_SLOTS];
+    TimerNode*          nodes;
+    uint32_t            nodeCap;
+    uint32_t            freeHead;
+} TimerShard;
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared channels
+//
+// A ValueRing in a POSIX shared memory segment, mapped at a different address
+// in every OS process.
+////////////////////////////////////////////////////////////////////////////////
+
+#define SHARED_CHANNEL_MAGIC    0x6d7063742d636873ull
+#define SHARED_CHANNEL_VERSION  1
+
+struct SharedChannel {
+    ValueRing*          ring;       // start of the mapping
+    size_t              mappedSize;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Distribution
+//
+// A message to a remote PID is wrapped in an envelope and sent to the
+// transport process of its node, which owns the TCP connection: it serializes
+// the envelopes of a cycle into frames written at once, and turns incoming
+// frames into messages to local PIDs. Frames are a NodeFrameHeader followed
+// by the payload, in host byte order.
+////////////////////////////////////////////////////////////////////////////////
+
+#define NODE_MAX            256             // node ids are below
+#define NODE_HELLO          UINT64_MAX      // first frame on a connection: the sender node id
+#define NODE_FRAME_MAX      (16u << 20)     // payload
+#define NODE_BATCH          256             // envelopes written per cycle
+#define NODE_BUFFER         65536           // initial in/out buffer size
+#define NODE_OUT_HIGH       (4u << 20)      // unflushed bytes above which the mailbox is left alone
+
+typedef struct {
+    uint32_t            length;     // payload bytes
+    uint32_t            reserved;
+    uint64_t            id;
+    uint64_t            gen;
+} NodeFrameHeader;
+
+typedef struct {
+    uint32_t            nodeId;     // 0 until ProcessQueue_setNode
+    NodeSerializer      serializer;
+    atomic_bool         lock;
+    PID                 routes[NODE_MAX];   // transport process per node, pq NULL if none
+} Distribution;
+
+////////////////////////////////////////////////////////////////////////////////
+// Coroutines
+//
+// A coroutine process is a regular process whose handler switches to the
+// coroutine stack and back: Process_receiveBlocking saves the coroutine
+// registers and returns PCT_WAIT_MESSAGE from the handler, the next message
+// is handed over by switching to it again. Stacks are mmap'd with a guard
+// page, the Coroutine sits at their top, and default sized ones are pooled.
+////////////////////////////////////////////////////////////////////////////////
+
+#define COROUTINE_STACK_SIZE    (64 * 1024)
+#define COROUTINE_POOL_SIZE     1024        // free default sized stacks kept
+
+typedef struct {
+    void*               sp;         // saved stack pointer of the coroutine
+    void*               workerSp;   // of the worker running it, while it runs
+    void*               base;       // mapping, guard page included
+    size_t              mappedSize;
+    CoroutineBody       body;
+    void*               state;
+    ProcessReleaseState releaseState;
+    ProcessQueue*       dq;
+    ProcessContinuation pct;        // handed back to the worker on a switch
+#ifdef __SANITIZE_THREAD__
+    void*               fiber;
+    void*               workerFiber;
+#endif
+} Coroutine;
+
+typedef struct {
+    uint32_t            threadId;
+    ProcessQueue*       queue;
+    LogRing             log;
+    _Atomic(pid_t)      tid;                // kernel thread id, 0 until the worker started
+    _Atomic(Process*)   current;            // process whose handler is running, read by the profiler
+    uint32_t            signalMaskGen;      // last Reactor.signalMaskGen applied
+#ifdef TCPM_TRACE
+    TraceRing           trace;
+#endif
+#ifdef TCPM_LATENCY_HISTOGRAMS
+    Histogram           mailboxLatency;     // enqueue to dequeue, recorded by this worker only
+#endif
+#ifdef TCPM_QUEUE_STATS
+    QueueStats          queueStats[QS_COUNT];   // written by this worker only
+#endif
+#ifdef TCPM_METRICS
+    ProcessQueueCounters    counters;       // written by this worker only
+    uint32_t            publishTick;
+    uint64_t            lastPublishNs;
+#endif
+} Worker;
+
 typedef enum {
     DQS_RUNNING,
     DQS_STOPPED,
@@ -99,11 +565,164 @@ struct ProcessQueue {
     BoundedQueue        procPool;   // process pool
     uint32_t            threadCount;
     pthread_t*          threads;
+    Worker*             workers;
     uint32_t            processCap;
     ProcessQueueState   state;
     atomic_uint32_t     procCount;
     pthread_key_t       currentProcess;   // (TLS) per thread, current running process
+    pthread_key_t       currentWorker;    // (TLS) per thread, NULL outside worker threads
     Process*            processes;  // Process array
+#ifdef TCPM_QUEUE_STATS
+    QueueStats          externalQueueStats[QS_COUNT];   // operations from non-worker threads
+#endif
+#ifdef TCPM_TRACE
+    TraceRing           externalTrace;  // events from non-worker threads
+    uint64_t            traceStartTicks;
+    uint64_t            traceStartNs;
+#endif
+#ifdef TCPM_METRICS
+    ProcessQueueCounters    externalCounters;   // events from non-worker threads
+    MetricsSegment*     metrics;            // shared memory segment, NULL if unavailable
+    size_t              metricsSize;
+    char                metricsName[64];
+#endif
+    Profile*            profile;            // sampling profiler, NULL if never started
+    LogRing             externalLog;        // records from non-worker threads
+    atomic_bool         externalLogLock;
+    pthread_t           logThread;
+    atomic_bool         logRunning;
+    _Atomic(FILE*)      logOut;
+    atomic_int          logLevel;
+    Reactor             reactor;
+    IoService           io;
+    TimerShard*         timers;     // threadCount + 1, the last one for non-worker threads
+    uint64_t            timerStartNs;
+    Distribution        node;
+    BoundedQueue        coroutinePool;  // free stacks of COROUTINE_STACK_SIZE
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Metrics: per-worker counters, published periodically into shared memory
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef TCPM_METRICS
+#define METRICS_PUBLISH_PERIOD_NS   (10 * 1000 * 1000)
+#define METRICS_PUBLISH_TICKS       256     // worker loops between two clock reads
+
+void    Metrics_init        (ProcessQueue* dq);
+void    Metrics_release     (ProcessQueue* dq);
+void    Metrics_publish     (ProcessQueue* dq, Worker* worker);
+
+static inline
+void
+countEvent(ProcessQueue* dq, Worker* worker, size_t offset) {
+    if( worker ) {
+        // single writer: no need for an atomic read-modify-write
+        atomic_uint64_t*    c   = (atomic_uint64_t*)((char*)&worker->counters + offset);
+        atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit((atomic_uint64_t*)((char*)&dq->externalCounters + offset), 1, memory_order_relaxed);
+    }
+}
+
+static inline
+void
+metricsTick(ProcessQueue* dq, Worker* worker) {
+    if( ++worker->publishTick >= METRICS_PUBLISH_TICKS ) {
+        worker->publishTick = 0;
+        uint64_t    now = monotonicNs();
+        if( now - worker->lastPublishNs >= METRICS_PUBLISH_PERIOD_NS ) {
+            worker->lastPublishNs   = now;
+            Metrics_publish(dq, worker);
+        }
+    }
+}
+
+#define COUNT(dq, worker, field)    countEvent((dq), (worker), offsetof(ProcessQueueCounters, field))
+#define METRICS_TICK(dq, worker)    metricsTick((dq), (worker))
+#else
+#define COUNT(dq, worker, field)    ((void)0)
+#define METRICS_TICK(dq, worker)    ((void)0)
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// USDT probes (provider "tcpm"), see README for the list and arguments
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef TCPM_USDT
+#include <sys/sdt.h>
+#define PROBE1(name, a)                 DTRACE_PROBE1(tcpm, name, a)
+#define PROBE3(name, a, b, c)           DTRACE_PROBE3(tcpm, name, a, b, c)
+#define PROBE4(name, a, b, c, d)        DTRACE_PROBE4(tcpm, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e)     DTRACE_PROBE5(tcpm, name, a, b, c, d, e)
+#else
+#define PROBE1(name, a)                 ((void)0)
+#define PROBE3(name, a, b, c)           ((void)0)
+#define PROBE4(name, a, b, c, d)        ((void)0)
+#define PROBE5(name, a, b, c, d, e)     ((void)0)
+#endif
+
+#ifdef TCPM_TRACE
+void    TraceRing_init      (TraceRing* ring);
+void    TraceRing_release   (TraceRing* ring);
+
+static inline
+void
+traceEmit(ProcessQueue* dq, Worker* worker, TraceEventType type, Process* proc, uint64_t arg) {
+    TraceRing*  ring    = NULL;
+    uint64_t    slot    = 0;
+    if( worker ) {
+        ring    = &worker->trace;
+        slot    = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    } else {
+        ring    = &dq->externalTrace;
+        slot    = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+    }
+
+    // external slots are reserved before being written: readers check the stamp
+    TraceEvent* ev  = &ring->events[slot & (TCPM_TRACE_RING_SIZE - 1)];
+    atomic_store_explicit(&ev->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    ev->ticks   = readTicks();
+    ev->id      = proc->id;
+    ev->gen     = atomic_load_explicit(&proc->gen, memory_order_relaxed);
+    ev->arg     = arg;
+    ev->type    = type;
+    atomic_store_explicit(&ev->seq, slot + 1, memory_order_release);
+
+    if( worker ) {
+        atomic_store_explicit(&ring->head, slot + 1, memory_order_release);
+    }
+}
+
+#define TRACE(dq, worker, type, proc, arg)  traceEmit((dq), (worker), (type), (proc), (uint64_t)(arg))
+#else
+#define TRACE(dq, worker, type, proc, arg)  ((void)0)
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Introspection & profiling
+////////////////////////////////////////////////////////////////////////////////
+
+void    formatHandler       (char* buf, size_t size, ProcessHandler handler);
+void    Log_init            (ProcessQueue* dq);
+void    Log_release         (ProcessQueue* dq);
+void    Profile_attachWorker(Worker* worker);
+void    Profile_release     (ProcessQueue* dq);
+
+void    Reactor_init        (ProcessQueue* dq);
+void    Reactor_release     (ProcessQueue* dq);
+void    Reactor_poll        (ProcessQueue* dq);
+void    Reactor_deliver     (Reactor* r, PID dest, void* message, MessageRelease release);    // reactor lock held
+void    Reactor_dropWatches (ProcessQueue* dq, Process* proc);
+void    Reactor_syncSignalMask  (ProcessQueue* dq, Worker* worker);
+void    Timer_init          (ProcessQueue* dq);
+void    Timer_release       (ProcessQueue* dq);
+void    Timer_advance       (ProcessQueue* dq, Worker* worker, bool idle);
+void    Io_release          (ProcessQueue* dq);
+void    Io_poll             (ProcessQueue* dq);                     // reactor lock held
+SendResult  Node_send       (PID dest, void* message, MessageAction ma);
+void    Coroutine_init      (ProcessQueue* dq);
+void    Coroutine_release   (ProcessQueue* dq);
+
 #endif
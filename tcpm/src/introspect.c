@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Process table introspection
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Copy a live process without locking it. The generation is read before and
+// after the copy (seqlock style): if the process died or was respawned
+// meanwhile, the snapshot is discarded.
+static
+bool
+snapshotProcess(ProcessQueue* dq, Process* proc, ProcessInfo* info) {
+    uint64_t    gen     = atomic_load_explicit(&proc->gen, memory_order_acquire);
+    if( !atomic_load_explicit(&proc->alive, memory_order_acquire) ) {
+        return false;
+    }
+
+    Process*    parent  = proc->parent;
+    info->id            = proc->id;
+    info->gen           = gen;
+    info->waiting       = proc->runningState == PS_WAITING;
+    info->mailboxDepth  = BoundedQueue_size(&proc->messageQueue)
+                        + atomic_load_explicit(&proc->valueCount, memory_order_relaxed);
+    info->mailboxCap    = proc->messageQueue.cap;
+    info->maxMessagePerCycle    = proc->maxMessagePerCycle;
+    info->handler       = proc->handler;
+    info->parent        = parent
+                        ? (PID){ .pq = dq, .id = parent->id, .gen = proc->parentGen }
+                        : (PID){ .pq = NULL, .id = 0, .gen = 0 };
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&proc->alive, memory_order_relaxed)
+        && atomic_load_explicit(&proc->gen, memory_order_relaxed) == gen;
+}
+
+uint32_t
+ProcessQueue_forEach(ProcessQueue* dq, ProcessVisitor visitor, void* ctx) {
+    uint32_t    visited = 0;
+    for( uint32_t p = 0; p < dq->processCap; ++p ) {
+        ProcessInfo info;
+        if( snapshotProcess(dq, &dq->processes[p], &info) ) {
+            ++visited;
+            if( !visitor(&info, ctx) ) {
+                break;
+            }
+        }
+    }
+    return visited;
+}
+
+void
+formatHandler(char* buf, size_t size, ProcessHandler handler) {
+    Dl_info     dl;
+    // static handlers are only resolved if the executable exports them (-rdynamic)
+    if( dladdr((void*)handler, &dl) && dl.dli_sname ) {
+        snprintf(buf, size, "%s+0x%zx", dl.dli_sname, (size_t)((char*)handler - (char*)dl.dli_saddr));
+    } else {
+        snprintf(buf, size, "%p", (void*)handler);
+    }
+}
+
+static
+bool
+dumpProcess(const ProcessInfo* info, void* out_) {
+    FILE*       out     = (FILE*)out_;
+    char        handler[128];
+    char        parent[32]  = "-";
+    if( info->parent.pq ) {
+        snprintf(parent, sizeof(parent), "%" PRIu64 ".%" PRIu64, info->parent.id, info->parent.gen);
+    }
+
+    formatHandler(handler, sizeof(handler), info->handler);
+    fprintf(out, "%10" PRIu64 " %10" PRIu64 "  %-8s %8" PRIu32 "/%-8" PRIu32 " %-21s %s\n",
+            info->id, info->gen, info->waiting ? "waiting" : "running",
+            info->mailboxDepth, info->mailboxCap, parent, handler);
+    return true;
+}
+
+void
+ProcessQueue_dump(ProcessQueue* dq, FILE* out) {
+    fprintf(out, "process queue %p: %" PRIu32 " processes (cap %" PRIu32 "), %" PRIu32 " workers, run queue depth %" PRIu32 "\n",
+            (void*)dq, atomic_load(&dq->procCount), dq->processCap, dq->threadCount, BoundedQueue_size(&dq->runQueue));
+    fprintf(out, "%10s %10s  %-8s %17s %-21s %s\n", "id", "gen", "state", "mailbox", "parent", "handler");
+    uint32_t    visited = ProcessQueue_forEach(dq, dumpProcess, out);
+    fprintf(out, "%" PRIu32 " live processes\n", visited);
+
+    static const char*  queueNames[QS_COUNT] = { "run queue", "process pool", "mailboxes" };
+    QueueStats  qs;
+    for( uint32_t kind = 0; kind < QS_COUNT && ProcessQueue_queueStats(dq, (QueueStatsKind)kind, &qs); ++kind ) {
+        fprintf(out, "%-12s push %" PRIu64 " (full %" PRIu64 ", cas fail %" PRIu64 ", spins %" PRIu64 ")"
+                     " pop %" PRIu64 " (empty %" PRIu64 ", cas fail %" PRIu64 ", spins %" PRIu64 ")\n",
+                queueNames[kind], qs.pushes, qs.pushFull, qs.pushCasFailures, qs.pushSpins,
+                qs.pops, qs.popEmpty, qs.popCasFailures, qs.popSpins);
+    }
+}
@@ -0,0 +1,427 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+#ifdef TCPM_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define IO_CANCEL_DATA      UINT64_MAX  // user_data of the cancel requests
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Asynchronous I/O: io_uring, or a blocking thread pool
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// wait until the request fd is ready, false if the pool is stopping first
+static
+bool
+waitReady(IoService* io, IoRequest* req) {
+    if( req->fd < 0 || req->op == IO_FSYNC ) {
+        return true;    // fails at once, or nothing to wait for
+    }
+    struct pollfd   fds[2]  = {
+        { .fd = req->fd,    .events = req->op == IO_WRITE ? POLLOUT : POLLIN },
+        { .fd = io->stopFd, .events = POLLIN },
+    };
+    while( poll(fds, 2, -1) < 0 && errno == EINTR ) {}
+    return (fds[1].revents & POLLIN) == 0;
+}
+
+static
+int64_t
+runBlocking(IoService* io, IoRequest* req) {
+    ssize_t res = -1;
+    do {
+        if( !waitReady(io, req) ) {
+            return -ECANCELED;
+        }
+        switch( req->op ) {
+        case IO_READ:
+            res = req->offset == IO_OFFSET_NONE ? read(req->fd, req->buffer, req->length) : pread(req->fd, req->buffer, req->length, (off_t)req->offset);
+            break;
+        case IO_WRITE:
+            res = req->offset == IO_OFFSET_NONE ? write(req->fd, req->buffer, req->length) : pwrite(req->fd, req->buffer, req->length, (off_t)req->offset);
+            break;
+        case IO_ACCEPT:
+            res = accept4(req->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            break;
+        case IO_FSYNC:
+            res = fsync(req->fd);
+            break;
+        default:
+            errno   = EINVAL;
+        }
+    // another reader was first, or a non-blocking fd: wait again
+    } while( res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && req->op != IO_FSYNC );
+    return res < 0 ? -(int64_t)errno : (int64_t)res;
+}
+
+static
+void*
+ioThread(void* dq_) {
+    ProcessQueue*   dq  = (ProcessQueue*)dq_;
+    IoService*      io  = &dq->io;
+    sigset_t        all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);     // signals are for the workers
+    for( ;; ) {
+        while( sem_wait(&io->work) != 0 ) {}
+        if( !atomic_load_explicit(&io->running, memory_order_acquire) ) {
+            return NULL;
+        }
+
+        // one post per staged request, it may not be visible yet
+        IoRequest*  req = NULL;
+        while( (req = (IoRequest*)BoundedQueue_pop(&io->staged)) == NULL ) {
+            sched_yield();
+        }
+        atomic_fetch_sub_explicit(&io->stagedCount, 1, memory_order_relaxed);
+        req->result = runBlocking(io, req);
+        // nobody polls the completions once the pool stops
+        while( BoundedQueue_push(&io->completed, req) == false && atomic_load_explicit(&io->running, memory_order_acquire) ) {
+            sched_yield();
+        }
+    }
+}
+
+static
+void
+startThreads(ProcessQueue* dq) {
+    IoService*  io  = &dq->io;
+    BoundedQueue_init(&io->completed, IO_QUEUE_SIZE, NULL);
+    sem_init(&io->work, 0, 0);
+    io->stopFd  = eventfd(0, EFD_CLOEXEC);
+    if( io->stopFd < 0 ) {
+        fprintf(stderr, "Fatal Error: unable to create I/O eventfd!\n");
+        exit(1);
+    }
+    atomic_store(&io->running, true);
+    for( uint32_t t = 0; t < TCPM_IO_THREADS; ++t ) {
+        if( pthread_create(&io->threads[t], NULL, ioThread, dq) != 0 ) {
+            fprintf(stderr, "Fatal Error: unable to create I/O thread!\n");
+            exit(1);
+        }
+    }
+}
+
+#ifdef TCPM_IO_URING
+
+static
+bool
+startUring(IoService* io) {
+    struct io_uring_params  p;
+    memset(&p, 0, sizeof(p));
+    io->ringFd  = (int)syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &p);
+    if( io->ringFd < 0 ) {
+        return false;
+    }
+
+    io->sqRingSize  = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    io->cqRingSize  = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        io->sqRingSize  = io->cqRingSize = io->sqRingSize > io->cqRingSize ? io->sqRingSize : io->cqRingSize;
+    }
+    io->sqRing  = mmap(NULL, io->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ringFd, IORING_OFF_SQ_RING);
+    io->cqRing  = (p.features & IORING_FEAT_SINGLE_MMAP) ? io->sqRing
+                : mmap(NULL, io->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ringFd, IORING_OFF_CQ_RING);
+    io->sqes    = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ringFd, IORING_OFF_SQES);
+    if( io->sqRing == MAP_FAILED || io->cqRing == MAP_FAILED || io->sqes == MAP_FAILED ) {
+        close(io->ringFd);
+        return false;
+    }
+
+    char*   sq      = (char*)io->sqRing;
+    char*   cq      = (char*)io->cqRing;
+    io->sqEntries   = p.sq_entries;
+    io->cqEntries   = p.cq_entries;
+    io->sqHead      = (atomic_uint32_t*)(sq + p.sq_off.head);
+    io->sqTail      = (atomic_uint32_t*)(sq + p.sq_off.tail);
+    io->sqMask      = *(uint32_t*)(sq + p.sq_off.ring_mask);
+    io->sqArray     = (uint32_t*)(sq + p.sq_off.array);
+    io->cqHead      = (atomic_uint32_t*)(cq + p.cq_off.head);
+    io->cqTail      = (atomic_uint32_t*)(cq + p.cq_off.tail);
+    io->cqMask      = *(uint32_t*)(cq + p.cq_off.ring_mask);
+    io->cqes        = cq + p.cq_off.cqes;
+    io->inflight    = 0;
+    io->submitted   = (IoRequest**)calloc(io->cqEntries, sizeof(IoRequest*));
+    io->freeSlots   = (uint32_t*)malloc(io->cqEntries * sizeof(uint32_t));
+    for( io->freeCount = 0; io->freeCount < io->cqEntries; ++io->freeCount ) {
+        io->freeSlots[io->freeCount]    = io->cqEntries - 1 - io->freeCount;
+    }
+    return true;
+}
+
+// the request buffers belong to processes about to be released: cancel what
+// the kernel still holds and wait for every completion before unmapping
+static
+void
+cancelUring(IoService* io) {
+    uint32_t    next    = 0;
+    while( io->inflight ) {
+        uint32_t    tail    = atomic_load_explicit(io->sqTail, memory_order_relaxed);
+        uint32_t    head    = atomic_load_explicit(io->sqHead, memory_order_acquire);
+        for( ; next < io->cqEntries && tail - head < io->sqEntries; ++next ) {
+            if( io->submitted[next] == NULL ) {
+                continue;
+            }
+            uint32_t                idx = tail & io->sqMask;
+            struct io_uring_sqe*    sqe = &((struct io_uring_sqe*)io->sqes)[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode     = IORING_OP_ASYNC_CANCEL;
+            sqe->fd         = -1;
+            sqe->addr       = next;     // the user_data of the request
+            sqe->user_data  = IO_CANCEL_DATA;
+            io->sqArray[idx]    = idx;
+            ++tail;
+        }
+        atomic_store_explicit(io->sqTail, tail, memory_order_release);
+        uint32_t    unsubmitted = tail - atomic_load_explicit(io->sqHead, memory_order_acquire);
+        syscall(__NR_io_uring_enter, io->ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        // completed or cancelled, either way dropped
+        uint32_t    cqHead  = atomic_load_explicit(io->cqHead, memory_order_relaxed);
+        uint32_t    cqTail  = atomic_load_explicit(io->cqTail, memory_order_acquire);
+        for( ; cqHead != cqTail; ++cqHead ) {
+            struct io_uring_cqe*    cqe = &((struct io_uring_cqe*)io->cqes)[cqHead & io->cqMask];
+            if( cqe->user_data != IO_CANCEL_DATA ) {
+                io->submitted[cqe->user_data]       = NULL;
+                io->freeSlots[io->freeCount++]      = (uint32_t)cqe->user_data;
+                --io->inflight;
+            }
+        }
+        atomic_store_explicit(io->cqHead, cqHead, memory_order_release);
+    }
+}
+
+static
+void
+stopUring(IoService* io) {
+    cancelUring(io);
+    free(io->submitted);
+    free(io->freeSlots);
+    munmap(io->sqes, io->sqEntries * sizeof(struct io_uring_sqe));
+    if( io->cqRing != io->sqRing ) {
+        munmap(io->cqRing, io->cqRingSize);
+    }
+    munmap(io->sqRing, io->sqRingSize);
+    close(io->ringFd);
+}
+
+// move every staged request into the submission ring, one syscall for all
+static
+void
+submitUring(IoService* io) {
+    uint32_t    tail    = atomic_load_explicit(io->sqTail, memory_order_relaxed);
+    uint32_t    head    = atomic_load_explicit(io->sqHead, memory_order_acquire);
+    uint32_t    count   = 0;
+    while( io->inflight < io->cqEntries && tail - head < io->sqEntries ) {
+        IoRequest*  req = (IoRequest*)BoundedQueue_pop(&io->staged);
+        if( req == NULL ) {
+            break;
+        }
+        atomic_fetch_sub_explicit(&io->stagedCount, 1, memory_order_relaxed);
+
+        // inflight < cqEntries: a slot is free
+        uint32_t                slot    = io->freeSlots[--io->freeCount];
+        uint32_t                idx     = tail & io->sqMask;
+        struct io_uring_sqe*    sqe     = &((struct io_uring_sqe*)io->sqes)[idx];
+        io->submitted[slot] = req;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd         = req->fd;
+        sqe->user_data  = slot;
+        switch( req->op ) {
+        case IO_READ:
+        case IO_WRITE:
+            sqe->opcode = req->op == IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->addr   = (uint64_t)(uintptr_t)req->buffer;
+            sqe->len    = req->length;
+            sqe->off    = req->offset;      // -1: current position
+            break;
+        case IO_ACCEPT:
+            sqe->opcode         = IORING_OP_ACCEPT;
+            sqe->accept_flags   = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            break;
+        case IO_FSYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            break;
+        default:
+            sqe->opcode = IORING_OP_NOP;    // completes with 0
+        }
+        io->sqArray[idx]    = idx;
+        ++tail;
+        ++io->inflight;
+        ++count;
+    }
+    if( count ) {
+        atomic_store_explicit(io->sqTail, tail, memory_order_release);
+    }
+    // entries the kernel did not take last time are submitted again
+    uint32_t    unsubmitted = tail - atomic_load_explicit(io->sqHead, memory_order_acquire);
+    if( unsubmitted ) {
+        syscall(__NR_io_uring_enter, io->ringFd, unsubmitted, 0, 0, NULL, 0);
+    }
+}
+
+static
+void
+reapUring(ProcessQueue* dq) {
+    IoService*  io      = &dq->io;
+    uint32_t    head    = atomic_load_explicit(io->cqHead, memory_order_relaxed);
+    uint32_t    tail    = atomic_load_explicit(io->cqTail, memory_order_acquire);
+    for( ; head != tail; ++head ) {
+        struct io_uring_cqe*    cqe     = &((struct io_uring_cqe*)io->cqes)[head & io->cqMask];
+        uint32_t                slot    = (uint32_t)cqe->user_data;
+        IoRequest*              req     = io->submitted[slot];
+        io->submitted[slot] = NULL;
+        io->freeSlots[io->freeCount++]  = slot;
+        req->result = cqe->res;
+        --io->inflight;
+        Reactor_deliver(&dq->reactor, req->owner, req, NULL);
+    }
+    atomic_store_explicit(io->cqHead, head, memory_order_release);
+}
+
+#endif
+
+static
+void
+startBackend(ProcessQueue* dq) {
+    IoService*  io  = &dq->io;
+    spinLock(&io->initLock);
+    if( atomic_load_explicit(&io->backend, memory_order_acquire) == IOB_NONE ) {
+        BoundedQueue_init(&io->staged, IO_QUEUE_SIZE, NULL);
+        IoBackend   backend = IOB_THREADS;
+#ifdef TCPM_IO_URING
+        if( startUring(io) ) {
+            backend = IOB_URING;
+        }
+#endif
+        if( backend == IOB_THREADS ) {
+            startThreads(dq);
+        }
+        atomic_store_explicit(&io->backend, backend, memory_order_release);
+    }
+    unlock(&io->initLock);
+}
+
+void
+Io_poll(ProcessQueue* dq) {
+    IoService*  io  = &dq->io;
+    switch( atomic_load_explicit(&io->backend, memory_order_acquire) ) {
+#ifdef TCPM_IO_URING
+    case IOB_URING:
+        reapUring(dq);
+        submitUring(io);
+        break;
+#endif
+    case IOB_THREADS: {
+        IoRequest*  req = NULL;
+        while( (req = (IoRequest*)BoundedQueue_pop(&io->completed)) ) {
+            Reactor_deliver(&dq->reactor, req->owner, req, NULL);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void
+Io_release(ProcessQueue* dq) {
+    IoService*  io  = &dq->io;
+    switch( atomic_load_explicit(&io->backend, memory_order_acquire) ) {
+#ifdef TCPM_IO_URING
+    case IOB_URING:
+        stopUring(io);
+        break;
+#endif
+    case IOB_THREADS:
+        atomic_store_explicit(&io->running, false, memory_order_release);
+        // wakes the threads waiting for their fd, idle ones on the semaphore
+        eventfd_write(io->stopFd, 1);
+        for( uint32_t t = 0; t < TCPM_IO_THREADS; ++t ) {
+            sem_post(&io->work);
+        }
+        for( uint32_t t = 0; t < TCPM_IO_THREADS; ++t ) {
+            pthread_join(io->threads[t], NULL);
+        }
+        close(io->stopFd);
+        sem_destroy(&io->work);
+        BoundedQueue_release(&io->completed);
+        break;
+    default:
+        return;
+    }
+    // requests still in flight are dropped, they belong to their owners
+    BoundedQueue_release(&io->staged);
+    atomic_store(&io->backend, IOB_NONE);
+}
+
+bool
+Process_submitIo(PID pid, IoRequest* request) {
+    if( pid.pq == NULL ) {
+        return false;
+    }
+
+    ProcessQueue*   dq  = pid.pq;
+    IoService*      io  = &dq->io;
+    if( atomic_load_explicit(&io->backend, memory_order_acquire) == IOB_NONE ) {
+        startBackend(dq);
+    }
+
+    request->owner  = pid;
+    request->result = 0;
+    atomic_fetch_add_explicit(&dq->reactor.active, 1, memory_order_relaxed);
+    if( BoundedQueue_push(&io->staged, request) == false ) {
+        atomic_fetch_sub_explicit(&dq->reactor.active, 1, memory_order_relaxed);
+        return false;
+    }
+    atomic_fetch_add_explicit(&io->stagedCount, 1, memory_order_release);
+    if( atomic_load_explicit(&io->backend, memory_order_relaxed) == IOB_THREADS ) {
+        sem_post(&io->work);
+    }
+    return true;
+}
+
+const char*
+ProcessQueue_ioBackend(ProcessQueue* dq) {
+    switch( atomic_load_explicit(&dq->io.backend, memory_order_acquire) ) {
+    case IOB_URING:     return "io_uring";
+    case IOB_THREADS:   return "threads";
+    default:            return "none";
+    }
+}
@@ -0,0 +1,210 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Asynchronous logging
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define LOG_IDLE_SLEEP_MIN_NS   (100 * 1000)
+#define LOG_IDLE_SLEEP_MAX_NS   (20 * 1000 * 1000)
+
+static const char* levelNames[] = {
+    [LL_DEBUG]      = "DEBUG",
+    [LL_INFO]       = "INFO",
+    [LL_WARNING]    = "WARNING",
+    [LL_ERROR]      = "ERROR",
+};
+
+static
+void
+logRingInit(LogRing* ring) {
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->dropped, 0);
+    ring->reportedDrops = 0;
+    ring->records   = (LogRecord*)calloc(LOG_RING_SIZE, sizeof(LogRecord));
+}
+
+// returns the number of records written
+static
+uint32_t
+drainRing(ProcessQueue* dq, LogRing* ring, const char* source, FILE* out) {
+    uint64_t    tail    = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t    head    = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t    count   = 0;
+    (void)dq;
+
+    for( ; tail != head; ++tail, ++count ) {
+        LogRecord*  r   = &ring->records[tail & (LOG_RING_SIZE - 1)];
+        time_t      sec = (time_t)(r->ns / 1000000000ull);
+        struct tm   tm;
+        char        date[32];
+        localtime_r(&sec, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        if( r->id != UINT64_MAX ) {
+            fprintf(out, "%s.%06" PRIu64 " %-7s %s <%" PRIu64 ".%" PRIu64 "> %.*s\n", date, (uint64_t)(r->ns % 1000000000ull) / 1000,
+                    levelNames[r->level], source, r->id, r->gen, (int)r->length, r->text);
+        } else {
+            fprintf(out, "%s.%06" PRIu64 " %-7s %s %.*s\n", date, (uint64_t)(r->ns % 1000000000ull) / 1000,
+                    levelNames[r->level], source, (int)r->length, r->text);
+        }
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    }
+
+    uint64_t    dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if( dropped != ring->reportedDrops ) {
+        fprintf(out, "%s: %" PRIu64 " log records dropped\n", source, dropped - ring->reportedDrops);
+        ring->reportedDrops = dropped;
+    }
+    return count;
+}
+
+static
+uint32_t
+drainAll(ProcessQueue* dq) {
+    FILE*       out     = atomic_load(&dq->logOut);
+    uint32_t    count   = 0;
+    char        source[16];
+    for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
+        snprintf(source, sizeof(source), "w%" PRIu32, threadId);
+        count  += drainRing(dq, &dq->workers[threadId].log, source, out);
+    }
+    count  += drainRing(dq, &dq->externalLog, "ext", out);
+    if( count ) {
+        fflush(out);
+    }
+    return count;
+}
+
+static
+void*
+logThread(void* dq_) {
+    ProcessQueue*   dq      = (ProcessQueue*)dq_;
+    long            sleepNs = LOG_IDLE_SLEEP_MIN_NS;
+    sigset_t        all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);     // signals are for the workers
+
+    while( atomic_load_explicit(&dq->logRunning, memory_order_acquire) ) {
+        if( drainAll(dq) ) {
+            sleepNs = LOG_IDLE_SLEEP_MIN_NS;
+        } else {
+            struct timespec ts  = { .tv_sec = 0, .tv_nsec = sleepNs };
+            nanosleep(&ts, NULL);
+            sleepNs = sleepNs * 2 > LOG_IDLE_SLEEP_MAX_NS ? LOG_IDLE_SLEEP_MAX_NS : sleepNs * 2;
+        }
+    }
+    drainAll(dq);
+    return NULL;
+}
+
+void
+Log_init(ProcessQueue* dq) {
+    for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
+        logRingInit(&dq->workers[threadId].log);
+    }
+    logRingInit(&dq->externalLog);
+    atomic_store(&dq->externalLogLock, false);
+    atomic_store(&dq->logOut, stderr);
+    atomic_store(&dq->logLevel, LL_INFO);
+    atomic_store(&dq->logRunning, true);
+    if( pthread_create(&dq->logThread, NULL, logThread, dq) != 0 ) {
+        fprintf(stderr, "Fatal Error: unable to create thread!\n");
+        exit(1);
+    }
+}
+
+void
+Log_release(ProcessQueue* dq) {
+    atomic_store_explicit(&dq->logRunning, false, memory_order_release);
+    pthread_join(dq->logThread, NULL);
+    for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
+        free(dq->workers[threadId].log.records);
+    }
+    free(dq->externalLog.records);
+}
+
+void
+ProcessQueue_setLogOutput(ProcessQueue* dq, FILE* out, LogLevel minLevel) {
+    atomic_store(&dq->logOut, out);
+    atomic_store(&dq->logLevel, minLevel);
+}
+
+uint64_t
+ProcessQueue_logDropped(ProcessQueue* dq) {
+    uint64_t    dropped = atomic_load(&dq->externalLog.dropped);
+    for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
+        dropped    += atomic_load(&dq->workers[threadId].log.dropped);
+    }
+    return dropped;
+}
+
+void
+ProcessQueue_log(ProcessQueue* dq, LogLevel level, const char* format, ...) {
+    if( (int)level < atomic_load_explicit(&dq->logLevel, memory_order_relaxed) ) {
+        return;
+    }
+
+    Worker*     worker  = (Worker*)pthread_getspecific(dq->currentWorker);
+    LogRing*    ring    = worker ? &worker->log : &dq->externalLog;
+    if( worker == NULL ) {
+        // several producers: serialize them, workers never take this lock
+        spinLock(&dq->externalLogLock);
+    }
+
+    uint64_t    head    = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if( head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE ) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    } else {
+        LogRecord*      r       = &ring->records[head & (LOG_RING_SIZE - 1)];
+        Process*        proc    = (Process*)pthread_getspecific(dq->currentProcess);
+        struct timespec ts;
+        va_list         args;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        r->ns       = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+        r->level    = level;
+        r->id       = (worker && proc) ? proc->id : UINT64_MAX;
+        r->gen      = (worker && proc) ? atomic_load_explicit(&proc->gen, memory_order_relaxed) : 0;
+        va_start(args, format);
+        int length  = vsnprintf(r->text, LOG_TEXT_SIZE, format, args);
+        va_end(args);
+        r->length   = length < 0 ? 0 : (length >= LOG_TEXT_SIZE ? LOG_TEXT_SIZE - 1 : (uint32_t)length);
+        atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    }
+
+    if( worker == NULL ) {
+        unlock(&dq->externalLogLock);
+    }
+}
@@ -0,0 +1,164 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "internals.h"
+#include "tcpm_metrics.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Shared memory metrics segment
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef TCPM_METRICS
+
+static atomic_uint32_t  segmentCount;
+
+static
+void
+copyCounters(ProcessQueueCounters* dst, ProcessQueueCounters* src) {
+    uint64_t*   s   = (uint64_t*)src;
+    uint64_t*   d   = (uint64_t*)dst;
+    for( size_t c = 0; c < sizeof(ProcessQueueCounters) / sizeof(uint64_t); ++c ) {
+        atomic_store_explicit((atomic_uint64_t*)&d[c], atomic_load_explicit((atomic_uint64_t*)&s[c], memory_order_relaxed), memory_order_relaxed);
+    }
+}
+
+void
+Metrics_init(ProcessQueue* dq) {
+    const char* name    = getenv("TCPM_METRICS_NAME");
+    uint32_t    n       = atomic_fetch_add(&segmentCount, 1);
+    if( name && n == 0 ) {
+        snprintf(dq->metricsName, sizeof(dq->metricsName), "%s", name);
+    } else if( name ) {
+        snprintf(dq->metricsName, sizeof(dq->metricsName), "%s.%u", name, n);
+    } else {
+        snprintf(dq->metricsName, sizeof(dq->metricsName), "/tcpm.%d.%u", (int)getpid(), n);
+    }
+
+    dq->metricsSize = sizeof(MetricsSegment) + (dq->threadCount + 1) * sizeof(WorkerMetrics);
+    dq->metrics     = NULL;
+
+    int fd  = shm_open(dq->metricsName, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if( fd < 0 ) {
+        fprintf(stderr, "tcpm: unable to create metrics segment %s\n", dq->metricsName);
+        dq->metricsName[0]  = '\0';
+        return;
+    }
+    if( ftruncate(fd, (off_t)dq->metricsSize) == 0 ) {
+        void*   addr    = mmap(NULL, dq->metricsSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if( addr != MAP_FAILED ) {
+            dq->metrics = (MetricsSegment*)addr;
+        }
+    }
+    close(fd);
+
+    if( dq->metrics == NULL ) {
+        fprintf(stderr, "tcpm: unable to map metrics segment %s\n", dq->metricsName);
+        shm_unlink(dq->metricsName);
+        dq->metricsName[0]  = '\0';
+        return;
+    }
+
+    dq->metrics->version        = METRICS_VERSION;
+    dq->metrics->pid            = (uint32_t)getpid();
+    dq->metrics->threadCount    = dq->threadCount;
+    dq->metrics->processCap     = dq->processCap;
+    dq->metrics->publishNs      = monotonicNs();
+    // readers check the magic last
+    atomic_store_explicit((atomic_uint64_t*)&dq->metrics->magic, METRICS_MAGIC, memory_order_release);
+}
+
+void
+Metrics_release(ProcessQueue* dq) {
+    if( dq->metrics ) {
+        munmap(dq->metrics, dq->metricsSize);
+        shm_unlink(dq->metricsName);
+        dq->metrics = NULL;
+    }
+}
+
+void
+Metrics_publish(ProcessQueue* dq, Worker* worker) {
+    MetricsSegment* seg     = dq->metrics;
+    if( seg == NULL ) {
+        return;
+    }
+
+    WorkerMetrics*  slot    = &seg->workers[worker->threadId];
+    copyCounters(&slot->counters, &worker->counters);
+#ifdef TCPM_LATENCY_HISTOGRAMS
+    memcpy(&slot->mailboxLatency, &worker->mailboxLatency, sizeof(Histogram));
+#endif
+
+    // the first worker publishes the gauges and the non-worker counters
+    if( worker->threadId == 0 ) {
+        copyCounters(&seg->workers[dq->threadCount].counters, &dq->externalCounters);
+        atomic_store_explicit((atomic_uint64_t*)&seg->processCount, atomic_load(&dq->procCount), memory_order_relaxed);
+        atomic_store_explicit((atomic_uint64_t*)&seg->runQueueDepth, BoundedQueue_size(&dq->runQueue), memory_order_relaxed);
+        atomic_store_explicit((atomic_uint64_t*)&seg->publishNs, worker->lastPublishNs, memory_order_release);
+    }
+}
+
+bool
+ProcessQueue_counters(ProcessQueue* dq, ProcessQueueCounters* out) {
+    memset(out, 0, sizeof(ProcessQueueCounters));
+    uint64_t*   dst = (uint64_t*)out;
+    for( uint32_t threadId = 0; threadId <= dq->threadCount; ++threadId ) {
+        ProcessQueueCounters*   src = threadId < dq->threadCount ? &dq->workers[threadId].counters : &dq->externalCounters;
+        for( size_t c = 0; c < sizeof(ProcessQueueCounters) / sizeof(uint64_t); ++c ) {
+            dst[c] += atomic_load_explicit((atomic_uint64_t*)&((uint64_t*)src)[c], memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+const char*
+ProcessQueue_metricsName(ProcessQueue* dq) {
+    return dq->metrics ? dq->metricsName : NULL;
+}
+
+#else
+
+bool
+ProcessQueue_counters(ProcessQueue* dq, ProcessQueueCounters* out) {
+    (void)dq;
+    memset(out, 0, sizeof(ProcessQueueCounters));
+    return false;
+}
+
+const char*
+ProcessQueue_metricsName(ProcessQueue* dq) {
+    (void)dq;
+    return NULL;
+}
+
+#endif
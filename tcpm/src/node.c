@@ -0,0 +1,564 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Distribution: remote PIDs, one transport process per node
+//
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    Distribution*   dist;
+    void*           message;
+    uint64_t        id;
+    uint64_t        gen;
+} Envelope;
+
+typedef struct {
+    ProcessQueue*   dq;
+    int             fd;
+    uint32_t        peer;           // 0 until its hello frame
+    bool            helloSent;
+    bool            readable;       // read until EAGAIN before re-arming
+    bool            armed;
+    uint32_t        armedEvents;
+    char*           in;
+    uint32_t        inLength;
+    uint32_t        inCap;
+    char*           out;
+    uint32_t        outOffset;      // written so far
+    uint32_t        outLength;
+    uint32_t        outCap;
+    PID             stalledDest;    // incoming message whose mailbox was full
+    void*           stalled;
+} Transport;
+
+typedef struct {
+    int             fd;
+} Listener;
+
+// fd readiness message of every transport and listener: a static address is
+// never mistaken for an envelope, even after the transport state is freed
+static char readiness;
+
+static
+void
+releaseMessage(Distribution* dist, void* message) {
+    if( message && dist->serializer.release ) {
+        dist->serializer.release(message, dist->serializer.ctx);
+    }
+}
+
+static
+void
+envelopeRelease(void* message) {
+    if( message != &readiness ) {
+        Envelope*   env = (Envelope*)message;
+        releaseMessage(env->dist, env->message);
+        free(env);
+    }
+}
+
+static
+void
+setRoute(Distribution* dist, uint32_t node, PID transport) {
+    spinLock(&dist->lock);
+    dist->routes[node]  = transport;
+    unlock(&dist->lock);
+}
+
+// only if it still goes through this transport
+static
+void
+clearRoute(Distribution* dist, uint32_t node, PID transport) {
+    spinLock(&dist->lock);
+    PID*    route   = &dist->routes[node];
+    if( route->pq == transport.pq && route->id == transport.id && route->gen == transport.gen ) {
+        route->pq   = NULL;
+    }
+    unlock(&dist->lock);
+}
+
+SendResult
+Node_send(PID dest, void* message, MessageAction ma) {
+    Distribution*   dist    = &dest.pq->node;
+    PID             route   = { 0 };
+    if( dest.node < NODE_MAX ) {
+        spinLock(&dist->lock);
+        route   = dist->routes[dest.node];
+        unlock(&dist->lock);
+    }
+    if( route.pq == NULL ) {
+        return ACTOR_IS_DEAD;   // not connected
+    }
+
+    Envelope*   env = (Envelope*)malloc(sizeof(Envelope));
+    env->dist       = dist;
+    env->message    = message;
+    env->id         = dest.id;
+    env->gen        = dest.gen;
+    SendResult  res = Process_sendMessage(route, env, MA_KEEP);
+    if( res != SEND_SUCCESS ) {
+        free(env);
+        if( res == SEND_FAIL && ma == MA_REMOVE ) {
+            releaseMessage(dist, message);
+        }
+    }
+    return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// transport process
+////////////////////////////////////////////////////////////////////////////////
+
+static
+void
+transportRelease(void* state) {
+    Transport*  t   = (Transport*)state;
+    releaseMessage(&t->dq->node, t->stalled);
+    close(t->fd);
+    free(t->in);
+    free(t->out);
+    free(t);
+}
+
+// room for size more bytes at the end of the output buffer
+static
+char*
+reserveOut(Transport* t, uint32_t size) {
+    if( t->outOffset && t->outOffset == t->outLength ) {
+        t->outOffset    = t->outLength  = 0;
+    }
+    if( t->outLength + size > t->outCap ) {
+        if( t->outOffset ) {
+            memmove(t->out, t->out + t->outOffset, t->outLength - t->outOffset);
+            t->outLength   -= t->outOffset;
+            t->outOffset    = 0;
+        }
+        while( t->outLength + size > t->outCap ) {
+            t->outCap  *= 2;
+        }
+        t->out  = (char*)realloc(t->out, t->outCap);
+    }
+    return t->out + t->outLength;
+}
+
+static
+void
+appendFrame(Transport* t, uint64_t id, uint64_t gen, const void* payload, uint32_t length) {
+    NodeFrameHeader header  = { .length = length, .id = id, .gen = gen };
+    char*           frame   = reserveOut(t, (uint32_t)sizeof(header) + length);
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), payload, length);
+    t->outLength   += (uint32_t)sizeof(header) + length;
+}
+
+// serialize in place, growing the buffer until the message fits
+static
+void
+appendEnvelope(Transport* t, Envelope* env) {
+    Distribution*   dist    = &t->dq->node;
+    uint32_t        want    = 256;
+    while( true ) {
+        char*           frame   = reserveOut(t, (uint32_t)sizeof(NodeFrameHeader) + want);
+        uint32_t        cap     = t->outCap - t->outLength - (uint32_t)sizeof(NodeFrameHeader);
+        uint32_t        size    = dist->serializer.serialize(t->dq, env->message, frame + sizeof(NodeFrameHeader), cap, dist->serializer.ctx);
+        if( size > NODE_FRAME_MAX ) {
+            ProcessQueue_log(t->dq, LL_WARNING, "node %u: dropped a %u bytes message", t->peer, size);
+            break;
+        }
+        if( size <= cap ) {
+            NodeFrameHeader header  = { .length = size, .id = env->id, .gen = env->gen };
+            memcpy(frame, &header, sizeof(header));
+            t->outLength   += (uint32_t)sizeof(header) + size;
+            break;
+        }
+        want    = size;
+    }
+    releaseMessage(dist, env->message);
+    free(env);
+}
+
+// false: the connection is gone
+static
+bool
+flushOut(Transport* t) {
+    while( t->outOffset < t->outLength ) {
+        ssize_t n   = write(t->fd, t->out + t->outOffset, t->outLength - t->outOffset);
+        if( n < 0 ) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        t->outOffset   += (uint32_t)n;
+    }
+    return true;
+}
+
+// false: protocol error
+static
+bool
+handleHello(Transport* t, PID self, const char* payload, uint32_t length) {
+    uint32_t    node    = 0;
+    if( length != sizeof(node) ) {
+        return false;
+    }
+    memcpy(&node, payload, sizeof(node));
+    if( node == 0 || node >= NODE_MAX || node == t->dq->node.nodeId || (t->peer && t->peer != node) ) {
+        ProcessQueue_log(t->dq, LL_ERROR, "node %u: unexpected hello from node %u", t->peer, node);
+        return false;
+    }
+    if( t->peer == 0 ) {
+        t->peer = node;
+        setRoute(&t->dq->node, node, self);
+    }
+    return true;
+}
+
+// hand the complete frames to local processes, false: protocol error
+static
+bool
+dispatchFrames(Transport* t, PID self) {
+    Distribution*   dist        = &t->dq->node;
+    uint32_t        consumed    = 0;
+    while( t->stalled == NULL && t->inLength - consumed >= sizeof(NodeFrameHeader) ) {
+        NodeFrameHeader header;
+        memcpy(&header, t->in + consumed, sizeof(header));
+        if( header.length > NODE_FRAME_MAX ) {
+            return false;
+        }
+        if( t->inLength - consumed - sizeof(header) < header.length ) {
+            break;
+        }
+
+        const char* payload = t->in + consumed + sizeof(header);
+        consumed   += (uint32_t)sizeof(header) + header.length;
+        if( header.id == NODE_HELLO ) {
+            if( !handleHello(t, self, payload, header.length) ) {
+                return false;
+            }
+            continue;
+        }
+        if( t->peer == 0 ) {
+            return false;
+        }
+
+        void*   msg = dist->serializer.deserialize(t->dq, payload, header.length, dist->serializer.ctx);
+        if( msg == NULL ) {
+            continue;
+        }
+        PID     dest    = { .pq = t->dq, .id = header.id, .gen = header.gen };
+        switch( header.id < t->dq->processCap ? Process_sendMessage(dest, msg, MA_KEEP) : ACTOR_IS_DEAD ) {
+        case SEND_SUCCESS:
+            break;
+        case ACTOR_IS_DEAD:
+        case SEND_UNSUPPORTED:
+            releaseMessage(dist, msg);
+            break;
+        case SEND_FAIL:     // stop reading until it goes through
+            t->stalledDest  = dest;
+            t->stalled      = msg;
+            break;
+        }
+    }
+    memmove(t->in, t->in + consumed, t->inLength - consumed);
+    t->inLength    -= consumed;
+    return true;
+}
+
+// false: the connection is gone
+static
+bool
+readIn(Transport* t, PID self) {
+    while( t->readable && t->stalled == NULL ) {
+        if( t->inLength == t->inCap ) {
+            t->inCap   *= 2;
+            t->in       = (char*)realloc(t->in, t->inCap);
+        }
+        ssize_t n   = read(t->fd, t->in + t->inLength, t->inCap - t->inLength);
+        if( n == 0 ) {
+            return false;
+        }
+        if( n < 0 ) {
+            if( errno == EINTR ) {
+                continue;
+            }
+            t->readable = false;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        t->inLength    += (uint32_t)n;
+        if( !dispatchFrames(t, self) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static
+ProcessContinuation
+closeTransport(Transport* t, PID self) {
+    Process_unwatchFd(self, t->fd);
+    if( t->peer ) {
+        clearRoute(&t->dq->node, t->peer, self);
+        ProcessQueue_log(t->dq, LL_INFO, "node %u: disconnected", t->peer);
+    }
+    return PCT_STOP;
+}
+
+// the peer does not keep up: envelopes wait in the mailbox, whose senders get
+// SEND_FAIL once it is full
+static inline
+bool
+congested(const Transport* t) {
+    return t->outLength - t->outOffset >= NODE_OUT_HIGH;
+}
+
+static
+ProcessContinuation
+transportHandler(ProcessQueue* dq, void* state, void* msg) {
+    Transport*  t       = (Transport*)state;
+    PID         self    = Process_self(dq);
+
+    if( !t->helloSent ) {
+        appendFrame(t, NODE_HELLO, 0, &dq->node.nodeId, sizeof(dq->node.nodeId));
+        t->helloSent    = true;
+    }
+
+    // this message and the ones behind it go out in one write
+    if( msg == NULL && !congested(t) ) {
+        msg = Process_receiveMessage(dq);   // running again after a stall
+    }
+    for( uint32_t batch = 1; msg; ++batch ) {
+        if( msg == &readiness ) {
+            t->armed    = false;
+            t->readable = true;
+        } else {
+            appendEnvelope(t, (Envelope*)msg);
+        }
+        msg = batch < NODE_BATCH && !congested(t) ? Process_receiveMessage(dq) : NULL;
+    }
+    if( !flushOut(t) ) {
+        return closeTransport(t, self);
+    }
+
+    if( t->stalled ) {
+        switch( Process_sendMessage(t->stalledDest, t->stalled, MA_KEEP) ) {
+        case SEND_FAIL:
+            return PCT_CONTINUE;
+        case ACTOR_IS_DEAD:
+        case SEND_UNSUPPORTED:
+            releaseMessage(&dq->node, t->stalled);
+            break;
+        case SEND_SUCCESS:
+            break;
+        }
+        t->stalled  = NULL;
+        if( !dispatchFrames(t, self) ) {
+            return closeTransport(t, self);
+        }
+    }
+    if( !readIn(t, self) ) {
+        return closeTransport(t, self);
+    }
+    if( t->stalled ) {
+        return PCT_CONTINUE;
+    }
+    if( congested(t) ) {
+        // readiness is behind the envelopes in the mailbox: keep trying to
+        // read, a peer blocked on its own writes needs us to
+        t->readable = true;
+        return PCT_CONTINUE;
+    }
+
+    uint32_t    events  = FE_READ | (t->outOffset < t->outLength ? FE_WRITE : 0);
+    if( !t->armed || events != t->armedEvents ) {
+        if( !Process_watchFd(self, t->fd, events, &readiness) ) {
+            return closeTransport(t, self);
+        }
+        t->armed        = true;
+        t->armedEvents  = events;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+static
+PID
+spawnTransport(ProcessQueue* dq, int fd, uint32_t peer) {
+    int         one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    Transport*  t   = (Transport*)calloc(1, sizeof(Transport));
+    t->dq       = dq;
+    t->fd       = fd;
+    t->peer     = peer;
+    t->readable = true;
+    t->inCap    = NODE_BUFFER;
+    t->in       = (char*)malloc(t->inCap);
+    t->outCap   = NODE_BUFFER;
+    t->out      = (char*)malloc(t->outCap);
+
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = transportHandler;
+    sp.initialState         = t;
+    sp.releaseState         = transportRelease;
+    sp.messageRelease       = envelopeRelease;
+    sp.messageCap           = NODE_BATCH * 4;
+    sp.maxMessagePerCycle   = 4;
+    PID         pid = ProcessQueue_spawn(dq, &sp);
+    if( pid.pq && peer ) {
+        setRoute(&dq->node, peer, pid);
+    }
+    return pid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// listener process
+////////////////////////////////////////////////////////////////////////////////
+
+static
+void
+listenerRelease(void* state) {
+    Listener*   l   = (Listener*)state;
+    close(l->fd);
+    free(l);
+}
+
+static
+ProcessContinuation
+listenerHandler(ProcessQueue* dq, void* state, void* msg) {
+    Listener*   l   = (Listener*)state;
+    int         fd;
+    (void)msg;
+    // the peer node is known from its hello frame
+    while( (fd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 ) {
+        spawnTransport(dq, fd, 0);
+    }
+    if( !Process_watchFd(Process_self(dq), l->fd, FE_READ, &readiness) ) {
+        return PCT_STOP;
+    }
+    return PCT_WAIT_MESSAGE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+
+PID
+Process_remote(ProcessQueue* dq, uint32_t node, uint64_t id, uint64_t gen) {
+    if( node == dq->node.nodeId ) {
+        node    = 0;
+    }
+    return (PID){ .pq = dq, .id = id, .gen = gen, .node = node };
+}
+
+bool
+ProcessQueue_setNode(ProcessQueue* dq, uint32_t node, const NodeSerializer* serializer) {
+    if( node == 0 || node >= NODE_MAX || dq->node.nodeId || serializer == NULL
+     || serializer->serialize == NULL || serializer->deserialize == NULL ) {
+        return false;
+    }
+    dq->node.serializer = *serializer;
+    dq->node.nodeId     = node;
+    return true;
+}
+
+uint32_t
+ProcessQueue_node(ProcessQueue* dq) {
+    return dq->node.nodeId;
+}
+
+static
+bool
+parseAddress(const char* address, uint16_t port, struct sockaddr_in* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family    = AF_INET;
+    addr->sin_port      = htons(port);
+    return inet_pton(AF_INET, address ? address : "127.0.0.1", &addr->sin_addr) == 1;
+}
+
+uint16_t
+ProcessQueue_listen(ProcessQueue* dq, const char* address, uint16_t port) {
+    struct sockaddr_in  addr;
+    socklen_t           length  = sizeof(addr);
+    int                 one     = 1;
+    if( dq->node.nodeId == 0 || !parseAddress(address, port, &addr) ) {
+        return 0;
+    }
+
+    int     fd  = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if( fd < 0 ) {
+        return 0;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if( bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0
+     || getsockname(fd, (struct sockaddr*)&addr, &length) != 0 ) {
+        close(fd);
+        return 0;
+    }
+
+    Listener*   l   = (Listener*)malloc(sizeof(Listener));
+    l->fd   = fd;
+    ProcessSpawnParameters  sp  = { 0 };
+    sp.handler              = listenerHandler;
+    sp.initialState         = l;
+    sp.releaseState         = listenerRelease;
+    sp.messageCap           = 2;
+    sp.maxMessagePerCycle   = 2;
+    if( ProcessQueue_spawn(dq, &sp).pq == NULL ) {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+bool
+ProcessQueue_connect(ProcessQueue* dq, uint32_t node, const char* address, uint16_t port) {
+    struct sockaddr_in  addr;
+    if( dq->node.nodeId == 0 || node == 0 || node >= NODE_MAX || node == dq->node.nodeId
+     || !parseAddress(address, port, &addr) ) {
+        return false;
+    }
+
+    int     fd  = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if( fd < 0 ) {
+        return false;
+    }
+    // blocking connect from the caller, the transport only sees a connected socket
+    if( connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ) {
+        close(fd);
+        return false;
+    }
+    int     one = 1;
+    ioctl(fd, FIONBIO, &one);
+    return spawnTransport(dq, fd, node).pq != NULL;
+}
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Per-process CPU sampling profiler
+//
+// Every worker gets a timer on its own thread CPU clock that sends it SIGPROF.
+// The signal handler reads the process the worker is running (Worker.current)
+// and counts the sample in a lock-free open addressing table keyed by PID.
+// Only one process queue can be profiled at a time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define PROFILE_TABLE_SIZE  (1u << 16)  // distinct processes, power of 2
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id  _sigev_un._tid
+#endif
+
+typedef struct {
+    atomic_uint64_t     key;        // ((gen + 1) << 32) | id, 0 if free
+    atomic_uint64_t     samples;
+    ProcessHandler      handler;
+} ProfileEntry;
+
+struct Profile {
+    ProfileEntry        entries[PROFILE_TABLE_SIZE];
+    atomic_uint64_t     idle;       // worker not running a handler
+    atomic_uint64_t     dropped;    // table full
+    timer_t*            timers;
+    uint32_t            timerCount;
+    struct sigaction    previous;
+};
+
+static _Thread_local Worker*    profiledWorker;
+static _Atomic(ProcessQueue*)   profiledQueue;
+
+void
+Profile_attachWorker(Worker* worker) {
+    profiledWorker  = worker;
+}
+
+static
+void
+recordSample(Profile* profile, Process* proc) {
+    ProcessHandler  handler = proc->handler;
+    uint64_t        key     = ((atomic_load_explicit(&proc->gen, memory_order_relaxed) + 1) << 32) | (proc->id & 0xffffffffu);
+    uint32_t        slot    = (uint32_t)(key * 0x9e3779b97f4a7c15ull >> 48) & (PROFILE_TABLE_SIZE - 1);
+
+    for( uint32_t probe = 0; probe < PROFILE_TABLE_SIZE; ++probe ) {
+        ProfileEntry*   e       = &profile->entries[(slot + probe) & (PROFILE_TABLE_SIZE - 1)];
+        uint64_t        current = atomic_load_explicit(&e->key, memory_order_acquire);
+        if( current == 0 ) {
+            uint64_t    expected    = 0;
+            if( atomic_compare_exchange_strong(&e->key, &expected, key) ) {
+                e->handler  = handler;
+                current     = key;
+            } else {
+                current     = expected;
+            }
+        }
+        if( current == key ) {
+            atomic_fetch_add_explicit(&e->samples, 1, memory_order_relaxed);
+            return;
+        }
+    }
+    atomic_fetch_add_explicit(&profile->dropped, 1, memory_order_relaxed);
+}
+
+static
+void
+onSigprof(int signo, siginfo_t* info, void* context) {
+    (void)signo;
+    (void)info;
+    (void)context;
+    Worker*         worker  = profiledWorker;
+    ProcessQueue*   dq      = atomic_load_explicit(&profiledQueue, memory_order_acquire);
+    if( worker == NULL || dq == NULL || worker->queue != dq ) {
+        return;
+    }
+
+    Process*        proc    = atomic_load_explicit(&worker->current, memory_order_relaxed);
+    if( proc ) {
+        recordSample(dq->profile, proc);
+    } else {
+        atomic_fetch_add_explicit(&dq->profile->idle, 1, memory_order_relaxed);
+    }
+}
+
+bool
+ProcessQueue_profileStart(ProcessQueue* dq, uint32_t hz) {
+    ProcessQueue*   expected    = NULL;
+    if( hz == 0 || !atomic_compare_exchange_strong(&profiledQueue, &expected, dq) ) {
+        return false;
+    }
+
+    if( dq->profile == NULL ) {
+        dq->profile = (Profile*)calloc(1, sizeof(Profile));
+    } else {
+        memset(dq->profile, 0, sizeof(Profile));
+    }
+    Profile*    profile = dq->profile;
+
+    struct sigaction    sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = onSigprof;
+    sa.sa_flags     = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, &profile->previous);
+
+    long            periodNs    = 1000000000L / (long)hz;
+    struct itimerspec   its = {
+        .it_interval    = { .tv_sec = periodNs / 1000000000L, .tv_nsec = periodNs % 1000000000L },
+        .it_value       = { .tv_sec = periodNs / 1000000000L, .tv_nsec = periodNs % 1000000000L },
+    };
+    profile->timers     = (timer_t*)calloc(dq->threadCount, sizeof(timer_t));
+    for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
+        Worker*     worker  = &dq->workers[threadId];
+        clockid_t   clock;
+        pid_t       tid;
+        while( (tid = atomic_load(&worker->tid)) == 0 ) {
+            sched_yield();
+        }
+        if( pthread_getcpuclockid(dq->threads[threadId], &clock) != 0 ) {
+            continue;
+        }
+
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify           = SIGEV_THREAD_ID;
+        sev.sigev_signo            = SIGPROF;
+        sev.sigev_notify_thread_id = tid;
+        timer_t*    timer   = &profile->timers[profile->timerCount];
+        if( timer_create(clock, &sev, timer) == 0 ) {
+            timer_settime(*timer, 0, &its, NULL);
+            ++profile->timerCount;
+        }
+    }
+    return profile->timerCount > 0;
+}
+
+void
+ProcessQueue_profileStop(ProcessQueue* dq) {
+    Profile*    profile = dq->profile;
+    if( profile == NULL || atomic_load(&profiledQueue) != dq ) {
+        return;
+    }
+    for( uint32_t t = 0; t < profile->timerCount; ++t ) {
+        timer_delete(profile->timers[t]);
+    }
+    free(profile->timers);
+    profile->timers     = NULL;
+    profile->timerCount = 0;
+    // a deleted timer may leave its signal pending on a worker: ignoring
+    // SIGPROF discards it, restoring SIG_DFL first would kill the process
+    struct sigaction    ignore;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler   = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPROF, &ignore, NULL);
+    sigaction(SIGPROF, &profile->previous, NULL);
+    atomic_store(&profiledQueue, NULL);
+}
+
+void
+Profile_release(ProcessQueue* dq) {
+    ProcessQueue_profileStop(dq);
+    free(dq->profile);
+    dq->profile = NULL;
+}
+
+typedef struct {
+    ProcessHandler      handler;
+    uint64_t            samples;
+    uint64_t            processes;
+} HandlerSamples;
+
+static
+int
+compareEntries(const void* a_, const void* b_) {
+    uint64_t    a   = ((const ProfileEntry*)a_)->samples;
+    uint64_t    b   = ((const ProfileEntry*)b_)->samples;
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+static
+int
+compareHandlers(const void* a_, const void* b_) {
+    uint64_t    a   = ((const HandlerSamples*)a_)->samples;
+    uint64_t    b   = ((const HandlerSamples*)b_)->samples;
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+void
+ProcessQueue_profileDump(ProcessQueue* dq, FILE* out, uint32_t maxRows) {
+    Profile*        profile = dq->profile;
+    if( profile == NULL ) {
+        fprintf(out, "no profile\n");
+        return;
+    }
+
+    // snapshot the table, the profiler may still be running
+    ProfileEntry*   entries     = (ProfileEntry*)calloc(PROFILE_TABLE_SIZE, sizeof(ProfileEntry));
+    HandlerSamples* handlers    = (HandlerSamples*)calloc(PROFILE_TABLE_SIZE, sizeof(HandlerSamples));
+    uint32_t        entryCount  = 0;
+    uint32_t        handlerCount    = 0;
+    uint64_t        idle        = atomic_load(&profile->idle);
+    uint64_t        total       = idle;
+    for( uint32_t e = 0; e < PROFILE_TABLE_SIZE; ++e ) {
+        uint64_t    samples = atomic_load_explicit(&profile->entries[e].samples, memory_order_relaxed);
+        if( samples == 0 ) {
+            continue;
+        }
+        ProfileEntry*   dst = &entries[entryCount++];
+        atomic_store_explicit(&dst->key, atomic_load(&profile->entries[e].key), memory_order_relaxed);
+        atomic_store_explicit(&dst->samples, samples, memory_order_relaxed);
+        dst->handler    = profile->entries[e].handler;
+        total          += samples;
+
+        uint32_t    h   = 0;
+        while( h < handlerCount && handlers[h].handler != dst->handler ) { ++h; }
+        if( h == handlerCount ) {
+            handlers[handlerCount++].handler    = dst->handler;
+        }
+        handlers[h].samples    += samples;
+        handlers[h].processes  += 1;
+    }
+    qsort(entries, entryCount, sizeof(ProfileEntry), compareEntries);
+    qsort(handlers, handlerCount, sizeof(HandlerSamples), compareHandlers);
+
+    char    symbol[128];
+    double  scale   = total ? 100.0 / (double)total : 0.0;
+    fprintf(out, "%" PRIu64 " samples, %" PRIu64 " idle (%.2f%%), %" PRIu64 " dropped\n\n",
+            total, idle, (double)idle * scale, atomic_load(&profile->dropped));
+
+    fprintf(out, "%10s %8s %10s  %s\n", "samples", "%", "processes", "handler");
+    for( uint32_t h = 0; h < handlerCount && h < maxRows; ++h ) {
+        formatHandler(symbol, sizeof(symbol), handlers[h].handler);
+        fprintf(out, "%10" PRIu64 " %7.2f%% %10" PRIu64 "  %s\n",
+                handlers[h].samples, (double)handlers[h].samples * scale, handlers[h].processes, symbol);
+    }
+
+    fprintf(out, "\n%10s %8s %10s %10s  %s\n", "samples", "%", "id", "gen", "handler");
+    for( uint32_t e = 0; e < entryCount && e < maxRows; ++e ) {
+        uint64_t    key     = atomic_load_explicit(&entries[e].key, memory_order_relaxed);
+        uint64_t    samples = atomic_load_explicit(&entries[e].samples, memory_order_relaxed);
+        formatHandler(symbol, sizeof(symbol), entries[e].handler);
+        fprintf(out, "%10" PRIu64 " %7.2f%% %10" PRIu64 " %10" PRIu64 "  %s\n",
+                samples, (double)samples * scale, key & 0xffffffffu, (key >> 32) - 1, symbol);
+    }
+
+    free(handlers);
+    free(entries);
+}
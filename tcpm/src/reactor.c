@@ -0,0 +1,396 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Reactor: fd readiness delivered as messages
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void
+Reactor_init(ProcessQueue* dq) {
+    Reactor*    r   = &dq->reactor;
+    memset(r, 0, sizeof(Reactor));
+    r->signalFd = -1;
+    sigemptyset(&r->signalMask);
+    r->epollFd  = epoll_create1(EPOLL_CLOEXEC);
+    if( r->epollFd < 0 ) {
+        fprintf(stderr, "Fatal Error: unable to create the epoll instance!\n");
+        exit(1);
+    }
+}
+
+void
+Reactor_release(ProcessQueue* dq) {
+    Reactor*    r   = &dq->reactor;
+    if( r->signalFd >= 0 ) {
+        close(r->signalFd);
+    }
+    close(r->epollFd);
+    for( uint32_t p = 0; p < r->pendingCount; ++p ) {
+        if( r->pending[p].release ) {
+            r->pending[p].release(r->pending[p].message);
+        }
+    }
+    free(r->watches);
+    free(r->pending);
+    free(r->channels);
+    memset(r, 0, sizeof(Reactor));
+    r->epollFd  = -1;
+}
+
+void
+Reactor_deliver(Reactor* r, PID dest, void* message, MessageRelease release) {
+    switch( Process_sendMessage(dest, message, MA_KEEP) ) {
+    case SEND_SUCCESS:
+        atomic_fetch_sub_explicit(&r->active, 1, memory_order_relaxed);
+        break;
+    case ACTOR_IS_DEAD:     // watch and I/O messages belong to the watcher, nothing to free
+    case SEND_UNSUPPORTED:  // values only
+        if( release ) {
+            release(message);
+        }
+        atomic_fetch_sub_explicit(&r->active, 1, memory_order_relaxed);
+        break;
+    case SEND_FAIL:
+        if( r->pendingCount == r->pendingCap ) {
+            r->pendingCap   = r->pendingCap ? r->pendingCap * 2 : 64;
+            r->pending      = (PendingDelivery*)realloc(r->pending, r->pendingCap * sizeof(PendingDelivery));
+        }
+        r->pending[r->pendingCount++]   = (PendingDelivery){ .dest = dest, .message = message, .release = release };
+        break;
+    }
+}
+
+// one malloc'd SignalInfo message per signal, to its route if any
+static
+void
+readSignals(Reactor* r) {
+    struct signalfd_siginfo si[16];
+    ssize_t                 size;
+    while( (size = read(r->signalFd, si, sizeof(si))) > 0 ) {
+        for( size_t s = 0; s < (size_t)size / sizeof(si[0]); ++s ) {
+            PID         route   = si[s].ssi_signo < SIGNAL_MAX ? r->signalRoutes[si[s].ssi_signo] : (PID){ 0 };
+            if( route.pq == NULL ) {
+                continue;
+            }
+            SignalInfo* info    = (SignalInfo*)malloc(sizeof(SignalInfo));
+            info->signo     = (int)si[s].ssi_signo;
+            info->code      = si[s].ssi_code;
+            info->senderPid = si[s].ssi_pid;
+            info->senderUid = si[s].ssi_uid;
+            info->status    = si[s].ssi_status;
+            atomic_fetch_add_explicit(&r->active, 1, memory_order_relaxed);
+            Reactor_deliver(r, route, info, free);
+        }
+    }
+}
+
+// armed watches are linked per process slot, so that a process stopping
+// without unwatching does not leave them armed (reactor lock held)
+static
+void
+linkWatch(Reactor* r, int fd) {
+    FdWatch*    watch   = &r->watches[fd];
+    Process*    proc    = &watch->owner.pq->processes[watch->owner.id];
+    int         head    = atomic_load_explicit(&proc->watchedFds, memory_order_relaxed);
+    watch->prev = -1;
+    watch->next = head;
+    if( head >= 0 ) {
+        r->watches[head].prev   = fd;
+    }
+    atomic_store_explicit(&proc->watchedFds, fd, memory_order_relaxed);
+}
+
+static
+void
+unlinkWatch(Reactor* r, int fd) {
+    FdWatch*    watch   = &r->watches[fd];
+    Process*    proc    = &watch->owner.pq->processes[watch->owner.id];
+    if( watch->prev >= 0 ) {
+        r->watches[watch->prev].next    = watch->next;
+    } else {
+        atomic_store_explicit(&proc->watchedFds, watch->next, memory_order_relaxed);
+    }
+    if( watch->next >= 0 ) {
+        r->watches[watch->next].prev    = watch->prev;
+    }
+}
+
+void
+Reactor_poll(ProcessQueue* dq) {
+    Reactor*    r   = &dq->reactor;
+    if( atomic_load_explicit(&r->active, memory_order_relaxed) == 0 || !tryLock(&r->lock) ) {
+        return;
+    }
+
+    // deliveries that failed last time first, they are older
+    uint32_t    count   = r->pendingCount;
+    r->pendingCount = 0;
+    for( uint32_t p = 0; p < count; ++p ) {
+        Reactor_deliver(r, r->pending[p].dest, r->pending[p].message, r->pending[p].release);
+    }
+    Io_poll(dq);
+
+    // shared channels have no fd to wait on: armed ones are checked each poll
+    for( uint32_t c = 0; c < r->channelCount; ++c ) {
+        ChannelWatch*   watch   = &r->channels[c];
+        if( watch->owner.pq && SharedChannel_size(watch->channel) ) {
+            PID     owner   = watch->owner;
+            watch->owner.pq = NULL;
+            Reactor_deliver(r, owner, watch->message, NULL);
+        }
+    }
+
+    struct epoll_event  events[REACTOR_EVENTS];
+    int                 ready   = r->armed ? epoll_wait(r->epollFd, events, REACTOR_EVENTS, 0) : 0;
+    for( int e = 0; e < ready; ++e ) {
+        int         fd      = events[e].data.fd;
+        if( fd == r->signalFd ) {
+            readSignals(r);
+            continue;
+        }
+        FdWatch*    watch   = &r->watches[fd];
+        if( watch->owner.pq == NULL ) {
+            continue;   // unwatched between the event and now
+        }
+        PID         owner   = watch->owner;
+        unlinkWatch(r, fd);
+        watch->owner.pq     = NULL;     // oneshot: disarmed by the kernel too
+        --r->armed;
+        Reactor_deliver(r, owner, watch->message, NULL);
+    }
+    unlock(&r->lock);
+}
+
+bool
+Process_watchFd(PID pid, int fd, uint32_t events, void* message) {
+    if( pid.pq == NULL || fd < 0 ) {
+        return false;
+    }
+
+    Reactor*            r   = &pid.pq->reactor;
+    struct epoll_event  ev  = { 0 };
+    ev.events   = EPOLLONESHOT | ((events & FE_READ) ? EPOLLIN | EPOLLRDHUP : 0) | ((events & FE_WRITE) ? EPOLLOUT : 0);
+    ev.data.fd  = fd;
+
+    spinLock(&r->lock);
+    if( (uint32_t)fd >= r->watchCap ) {
+        uint32_t    cap     = r->watchCap ? r->watchCap : 1024;
+        while( cap <= (uint32_t)fd ) {
+            cap    *= 2;
+        }
+        r->watches  = (FdWatch*)realloc(r->watches, cap * sizeof(FdWatch));
+        memset(&r->watches[r->watchCap], 0, (cap - r->watchCap) * sizeof(FdWatch));
+        r->watchCap = cap;
+    }
+
+    // the fd may still be in the epoll set from a previous (fired) watch, or
+    // may have been closed and reopened since: try both ways
+    int     res = epoll_ctl(r->epollFd, EPOLL_CTL_MOD, fd, &ev);
+    if( res != 0 && errno == ENOENT ) {
+        res = epoll_ctl(r->epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if( res == 0 ) {
+        FdWatch*    watch   = &r->watches[fd];
+        if( watch->owner.pq == NULL ) {
+            ++r->armed;
+            atomic_fetch_add_explicit(&r->active, 1, memory_order_relaxed);
+        } else {
+            unlinkWatch(r, fd);     // from its previous owner
+        }
+        watch->owner    = pid;
+        watch->message  = message;
+        linkWatch(r, fd);
+    }
+    unlock(&r->lock);
+    return res == 0;
+}
+
+void
+Process_unwatchFd(PID pid, int fd) {
+    if( pid.pq == NULL || fd < 0 ) {
+        return;
+    }
+
+    Reactor*    r   = &pid.pq->reactor;
+    spinLock(&r->lock);
+    epoll_ctl(r->epollFd, EPOLL_CTL_DEL, fd, NULL);
+    if( (uint32_t)fd < r->watchCap && r->watches[fd].owner.pq ) {
+        unlinkWatch(r, fd);
+        r->watches[fd].owner.pq = NULL;
+        --r->armed;
+        atomic_fetch_sub_explicit(&r->active, 1, memory_order_relaxed);
+    }
+    unlock(&r->lock);
+}
+
+// the watches of a stopping process, including those of fds it closed
+// (silently removed from the epoll set) that would otherwise stay armed
+void
+Reactor_dropWatches(ProcessQueue* dq, Process* proc) {
+    if( atomic_load_explicit(&proc->watchedFds, memory_order_relaxed) < 0 ) {
+        return;     // most processes
+    }
+
+    Reactor*    r   = &dq->reactor;
+    spinLock(&r->lock);
+    for( int fd = atomic_load_explicit(&proc->watchedFds, memory_order_relaxed); fd >= 0; fd = r->watches[fd].next ) {
+        epoll_ctl(r->epollFd, EPOLL_CTL_DEL, fd, NULL);     // fails if it was closed
+        r->watches[fd].owner.pq = NULL;
+        --r->armed;
+        atomic_fetch_sub_explicit(&r->active, 1, memory_order_relaxed);
+    }
+    atomic_store_explicit(&proc->watchedFds, -1, memory_order_relaxed);
+    unlock(&r->lock);
+}
+
+bool
+Process_watchChannel(PID pid, SharedChannel* channel, void* message) {
+    if( pid.pq == NULL || channel == NULL ) {
+        return false;
+    }
+
+    Reactor*        r       = &pid.pq->reactor;
+    ChannelWatch*   watch   = NULL;
+    spinLock(&r->lock);
+    for( uint32_t c = 0; c < r->channelCount && watch == NULL; ++c ) {
+        if( r->channels[c].channel == channel ) {
+            watch   = &r->channels[c];
+        }
+    }
+    if( watch == NULL ) {
+        if( r->channelCount == r->channelCap ) {
+            r->channelCap   = r->channelCap ? r->channelCap * 2 : 8;
+            r->channels     = (ChannelWatch*)realloc(r->channels, r->channelCap * sizeof(ChannelWatch));
+        }
+        watch           = &r->channels[r->channelCount++];
+        watch->channel  = channel;
+        watch->owner.pq = NULL;
+    }
+    if( watch->owner.pq == NULL ) {
+        atomic_fetch_add_explicit(&r->active, 1, memory_order_relaxed);
+    }
+    watch->owner    = pid;
+    watch->message  = message;
+    unlock(&r->lock);
+    return true;
+}
+
+void
+Process_unwatchChannel(PID pid, SharedChannel* channel) {
+    if( pid.pq == NULL ) {
+        return;
+    }
+
+    Reactor*    r   = &pid.pq->reactor;
+    spinLock(&r->lock);
+    for( uint32_t c = 0; c < r->channelCount; ++c ) {
+        if( r->channels[c].channel == channel ) {
+            if( r->channels[c].owner.pq ) {
+                atomic_fetch_sub_explicit(&r->active, 1, memory_order_relaxed);
+            }
+            r->channels[c]  = r->channels[--r->channelCount];
+            break;
+        }
+    }
+    unlock(&r->lock);
+}
+
+void
+Reactor_syncSignalMask(ProcessQueue* dq, Worker* worker) {
+    Reactor*    r   = &dq->reactor;
+    uint32_t    gen = atomic_load_explicit(&r->signalMaskGen, memory_order_acquire);
+    if( gen == worker->signalMaskGen ) {
+        return;
+    }
+    sigset_t    mask;
+    spinLock(&r->lock);
+    mask    = r->signalMask;
+    unlock(&r->lock);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    worker->signalMaskGen   = gen;
+}
+
+bool
+Process_watchSignal(PID pid, int signo) {
+    if( pid.pq == NULL || signo <= 0 || signo >= SIGNAL_MAX || signo == SIGKILL || signo == SIGSTOP ) {
+        return false;
+    }
+
+    Reactor*    r   = &pid.pq->reactor;
+    bool        ok  = true;
+    sigset_t    one;
+    sigemptyset(&one);
+    sigaddset(&one, signo);
+    // block it right away in the calling thread, workers follow on their next poll
+    pthread_sigmask(SIG_BLOCK, &one, NULL);
+
+    spinLock(&r->lock);
+    sigaddset(&r->signalMask, signo);
+    if( r->signalFd < 0 ) {
+        r->signalFd = signalfd(-1, &r->signalMask, SFD_NONBLOCK | SFD_CLOEXEC);
+        struct epoll_event  ev  = { .events = EPOLLIN, .data.fd = r->signalFd };
+        if( r->signalFd < 0 || epoll_ctl(r->epollFd, EPOLL_CTL_ADD, r->signalFd, &ev) != 0 ) {
+            if( r->signalFd >= 0 ) {
+                close(r->signalFd);
+                r->signalFd = -1;
+            }
+            sigdelset(&r->signalMask, signo);
+            ok  = false;
+        } else {
+            // the signalfd stays armed for good
+            ++r->armed;
+            atomic_fetch_add_explicit(&r->active, 1, memory_order_relaxed);
+        }
+    } else {
+        ok  = signalfd(r->signalFd, &r->signalMask, 0) >= 0;
+    }
+    if( ok ) {
+        r->signalRoutes[signo]  = pid;
+        atomic_fetch_add_explicit(&r->signalMaskGen, 1, memory_order_release);
+    }
+    unlock(&r->lock);
+    return ok;
+}
+
+void
+Process_unwatchSignal(ProcessQueue* dq, int signo) {
+    if( signo <= 0 || signo >= SIGNAL_MAX ) {
+        return;
+    }
+    // the signal stays blocked: from now on it is read and dropped
+    Reactor*    r   = &dq->reactor;
+    spinLock(&r->lock);
+    r->signalRoutes[signo].pq   = NULL;
+    unlock(&r->lock);
+}
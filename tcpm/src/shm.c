@@ -0,0 +1,151 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Shared channels: bounded queue in POSIX shared memory
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// the counters are shared with other OS processes, they must not hide a lock
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared channels need lock-free 32 bit atomics");
+
+static
+SharedChannel*
+mapChannel(int fd, size_t size) {
+    void*   addr    = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if( addr == MAP_FAILED ) {
+        return NULL;
+    }
+    SharedChannel*  channel = (SharedChannel*)malloc(sizeof(SharedChannel));
+    channel->ring       = (ValueRing*)addr;
+    channel->mappedSize = size;
+    return channel;
+}
+
+SharedChannel*
+SharedChannel_create(const char* name, uint32_t cap, uint32_t payloadSize) {
+    if( name == NULL || cap == 0 ) {
+        return NULL;
+    }
+
+    // a slot per cache line at least: OS processes on other cores write next to each other
+    size_t      size        = ValueRing_footprint(cap, payloadSize, VALUE_RING_LINE);
+    int         fd          = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if( fd < 0 ) {
+        return NULL;
+    }
+    if( ftruncate(fd, (off_t)size) != 0 ) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    SharedChannel*  channel = mapChannel(fd, size);
+    if( channel == NULL ) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    ValueRing*  ring    = ValueRing_init(channel->ring, cap, payloadSize, VALUE_RING_LINE);
+    ring->version       = SHARED_CHANNEL_VERSION;
+    // openers check the magic last
+    atomic_store_explicit((atomic_uint64_t*)&ring->magic, SHARED_CHANNEL_MAGIC, memory_order_release);
+    return channel;
+}
+
+SharedChannel*
+SharedChannel_open(const char* name) {
+    if( name == NULL ) {
+        return NULL;
+    }
+
+    int         fd  = shm_open(name, O_RDWR, 0);
+    struct stat st;
+    if( fd < 0 ) {
+        return NULL;
+    }
+    if( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ValueRing) ) {
+        close(fd);
+        return NULL;    // not created yet, or not a channel
+    }
+    SharedChannel*  channel = mapChannel(fd, (size_t)st.st_size);
+    if( channel == NULL ) {
+        return NULL;
+    }
+
+    ValueRing*  ring    = channel->ring;
+    if( atomic_load_explicit((atomic_uint64_t*)&ring->magic, memory_order_acquire) != SHARED_CHANNEL_MAGIC
+     || ring->version != SHARED_CHANNEL_VERSION || ring->cap == 0
+     || ring->slotsOffset + (size_t)ring->cap * ring->slotSize > channel->mappedSize
+     || ring->slotSize < sizeof(ValueSlot) + ring->valueSize ) {
+        SharedChannel_close(channel);
+        return NULL;
+    }
+    return channel;
+}
+
+void
+SharedChannel_close(SharedChannel* channel) {
+    if( channel ) {
+        munmap(channel->ring, channel->mappedSize);
+        free(channel);
+    }
+}
+
+void
+SharedChannel_unlink(const char* name) {
+    if( name ) {
+        shm_unlink(name);
+    }
+}
+
+bool
+SharedChannel_send(SharedChannel* channel, const void* payload, uint32_t size) {
+    return ValueRing_push(channel->ring, payload, size);
+}
+
+// payload must hold SharedChannel_payloadSize bytes
+bool
+SharedChannel_receive(SharedChannel* channel, void* payload, uint32_t* size) {
+    return ValueRing_pop(channel->ring, payload, size);
+}
+
+uint32_t
+SharedChannel_size(SharedChannel* channel) {
+    return ValueRing_size(channel->ring);
+}
+
+uint32_t
+SharedChannel_payloadSize(SharedChannel* channel) {
+    return channel->ring->valueSize;
+}
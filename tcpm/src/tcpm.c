@@ -26,46 +26,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "internals.h"
 
-////////////////////////////////////////////////////////////////////////////////
-//
-//         spinlock
-//
-////////////////////////////////////////////////////////////////////////////////
-
-static inline
-void
-spinLock(atomic_bool* lock) {
-    bool expected   = false;
-    while( !atomic_compare_exchange_weak(lock, &expected, true) ) {
-        expected    = false;
-    }
-}
-
-static inline
-void
-unlock(atomic_bool* lock) {
-    bool expected   = true;
-    bool current    = atomic_load(lock);
-    if( expected != current ) {
-        fprintf(stderr, "current: %u - expected: %u\n", current, expected);
-        assert(expected == current);
-    }
-    if( !atomic_compare_exchange_strong(lock, &expected, false) ) {
-        fprintf(stderr, "atomic_compare_exchange_strong failed in unlock! will die!\n");
-        exit(1);
-    }
-}
-
-static inline
-bool
-tryLock(atomic_bool* lock) {
-    bool expected   = false;
-    return atomic_compare_exchange_strong(lock, &expected, true);
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 //
 //         Lock-free Bounded Queue (heavily inspired from 1024cores.net)
@@ -99,10 +65,64 @@ BoundedQueue_release(BoundedQueue* bq) {
     bq->elements    = NULL;
 }
 
+#ifdef TCPM_QUEUE_STATS
+static _Thread_local Worker*    statsWorker;    // NULL outside worker threads
+
+static inline
+void
+statsAdd(uint64_t* counter, uint64_t n, bool shared) {
+    if( n == 0 ) {
+        return;
+    }
+    if( shared ) {
+        atomic_fetch_add_explicit((atomic_uint64_t*)counter, n, memory_order_relaxed);
+    } else {
+        // single writer: no need for an atomic read-modify-write
+        atomic_uint64_t*    c   = (atomic_uint64_t*)counter;
+        atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+    }
+}
+
+// the counters of the calling worker, or the shared ones of a non-worker thread
+// (or of a worker of another queue)
+static inline
+QueueStats*
+statsOf(BoundedQueue* bq, bool* shared) {
+    Worker*     worker  = statsWorker;
+    *shared = worker == NULL || worker->queue != bq->statsQueue;
+    return *shared ? &bq->statsQueue->externalQueueStats[bq->statsKind] : &worker->queueStats[bq->statsKind];
+}
+
+static inline
+void
+recordPush(BoundedQueue* bq, bool pushed, uint64_t spins, uint64_t casFailures) {
+    if( bq->statsQueue ) {
+        bool        shared;
+        QueueStats* stats   = statsOf(bq, &shared);
+        statsAdd(pushed ? &stats->pushes : &stats->pushFull, 1, shared);
+        statsAdd(&stats->pushSpins, spins, shared);
+        statsAdd(&stats->pushCasFailures, casFailures, shared);
+    }
+}
+
+static inline
+void
+recordPop(BoundedQueue* bq, bool popped, uint64_t spins, uint64_t casFailures) {
+    if( bq->statsQueue ) {
+        bool        shared;
+        QueueStats* stats   = statsOf(bq, &shared);
+        statsAdd(popped ? &stats->pops : &stats->popEmpty, 1, shared);
+        statsAdd(&stats->popSpins, spins, shared);
+        statsAdd(&stats->popCasFailures, casFailures, shared);
+    }
+}
+#endif
+
 bool
 BoundedQueue_push(BoundedQueue* bq, void* data) {
     Element*    el  = NULL;
     uint32_t    last    = atomic_load_explicit(&bq->last, memory_order_acquire);
+    QUEUE_STAT( uint64_t spins = 0; uint64_t casFailures = 0; )
 
     while(true) {
         el  = &bq->elements[last % bq->cap];
@@ -110,23 +130,35 @@ BoundedQueue_push(BoundedQueue* bq, void* data) {
         int32_t diff  = (int32_t)(seq) - (int32_t)(last);
         if( diff == 0 && atomic_compare_exchange_weak(&bq->last, &last, last + 1) ) {
             break;
-        } else if( diff < 0 ) { return false; }
+        } else if( diff < 0 ) {
+            QUEUE_STAT( recordPush(bq, false, spins, casFailures); )
+            return false;
+        }
+        QUEUE_STAT( ++spins; casFailures += (diff == 0); )
         last    = atomic_load_explicit(&bq->last, memory_order_acquire);
     }
+    QUEUE_STAT( recordPush(bq, true, spins, casFailures); )
 
     // Past this point, any preemption will cause all other consumers
     // to spin-lock waiting for it to finish, IF AND ONLY IF they
     // reach the end. Normal case: Producers are ahead
     atomic_store_explicit((atomic_size_t*)&el->data, (size_t)data, memory_order_release);
+#ifdef TCPM_LATENCY_HISTOGRAMS
+    if( bq->timestamped ) {
+        el->stamp   = monotonicNs();
+    }
+#endif
     atomic_store_explicit(&el->seq, last + 1, memory_order_release);
     return true;
 }
 
+static inline
 void*
-BoundedQueue_pop(BoundedQueue* bq) {
+queuePop(BoundedQueue* bq, uint64_t* stamp) {
     Element*    el      = NULL;
     void*       data    = NULL;
     uint32_t    first   = atomic_load_explicit(&bq->first, memory_order_acquire);
+    QUEUE_STAT( uint64_t spins = 0; uint64_t casFailures = 0; )
 
     while( true ) {
         el  = &bq->elements[first % bq->cap];
@@ -135,34 +167,225 @@ BoundedQueue_pop(BoundedQueue* bq) {
         if( diff == 0 && atomic_compare_exchange_weak(&bq->first, &first, first + 1) ) {
             break;
         } else if( diff < 0 ) {
+            QUEUE_STAT( recordPop(bq, false, spins, casFailures); )
             return NULL;
         }
 
+        QUEUE_STAT( ++spins; casFailures += (diff == 0); )
         first  = atomic_load_explicit(&bq->first, memory_order_acquire);
     }
+    QUEUE_STAT( recordPop(bq, true, spins, casFailures); )
 
     data    = (void*)atomic_load_explicit((atomic_size_t*)&el->data, memory_order_acquire);
+#ifdef TCPM_LATENCY_HISTOGRAMS
+    if( stamp ) {
+        *stamp  = el->stamp;
+    }
+#else
+    (void)stamp;
+#endif
     atomic_store_explicit(&el->seq, first + bq->cap, memory_order_release);
     return data;
 }
 
+void*
+BoundedQueue_pop(BoundedQueue* bq) {
+    return queuePop(bq, NULL);
+}
+
+#ifdef TCPM_LATENCY_HISTOGRAMS
+void*
+BoundedQueue_popStamped(BoundedQueue* bq, uint64_t* stamp) {
+    return queuePop(bq, stamp);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//                  Lock-free Bounded Queue of values
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static inline
+ValueSlot*
+slotAt(ValueRing* vr, uint32_t index) {
+    return (ValueSlot*)((char*)vr + vr->slotsOffset + (size_t)(index % vr->cap) * vr->slotSize);
+}
+
+static inline
+uint32_t
+slotSize(uint32_t valueSize, uint32_t slotAlign) {
+    return (uint32_t)((sizeof(ValueSlot) + valueSize + slotAlign - 1) & ~(size_t)(slotAlign - 1));
+}
+
+// slotAlign: power of 2, at least 4
+size_t
+ValueRing_footprint(uint32_t cap, uint32_t valueSize, uint32_t slotAlign) {
+    return sizeof(ValueRing) + (size_t)cap * slotSize(valueSize, slotAlign);
+}
+
+// memory holds ValueRing_footprint bytes, zeroed or not
+ValueRing*
+ValueRing_init(void* memory, uint32_t cap, uint32_t valueSize, uint32_t slotAlign) {
+    ValueRing*  vr  = (ValueRing*)memory;
+    memset(vr, 0, sizeof(ValueRing));
+    vr->cap         = cap;
+    vr->valueSize   = valueSize;
+    vr->slotSize    = slotSize(valueSize, slotAlign);
+    vr->slotsOffset = sizeof(ValueRing);
+    for( uint32_t i = 0; i < cap; ++i ) {
+        atomic_store_explicit(&slotAt(vr, i)->seq, i, memory_order_relaxed);
+    }
+    atomic_store_explicit(&vr->first, 0, memory_order_release);
+    atomic_store_explicit(&vr->last, 0, memory_order_release);
+    return vr;
+}
+
+bool
+ValueRing_push(ValueRing* vr, const void* value, uint32_t size) {
+    ValueSlot*  slot    = NULL;
+    if( size > vr->valueSize ) {
+        return false;
+    }
+
+    uint32_t    last    = atomic_load_explicit(&vr->last, memory_order_acquire);
+    while( true ) {
+        slot    = slotAt(vr, last);
+        uint32_t seq  = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int32_t diff  = (int32_t)(seq) - (int32_t)(last);
+        if( diff == 0 && atomic_compare_exchange_weak(&vr->last, &last, last + 1) ) {
+            break;
+        } else if( diff < 0 ) {
+            return false;
+        }
+        last    = atomic_load_explicit(&vr->last, memory_order_acquire);
+    }
+
+    memcpy(slot->value, value, size);
+    slot->size  = size;
+    atomic_store_explicit(&slot->seq, last + 1, memory_order_release);
+    return true;
+}
+
+bool
+ValueRing_pop(ValueRing* vr, void* value, uint32_t* size) {
+    ValueSlot*  slot    = NULL;
+
+    uint32_t    first   = atomic_load_explicit(&vr->first, memory_order_acquire);
+    while( true ) {
+        slot    = slotAt(vr, first);
+        uint32_t seq  = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int32_t diff  = (int32_t)(seq) - (int32_t)((first + 1));
+        if( diff == 0 && atomic_compare_exchange_weak(&vr->first, &first, first + 1) ) {
+            break;
+        } else if( diff < 0 ) {
+            return false;
+        }
+        first   = atomic_load_explicit(&vr->first, memory_order_acquire);
+    }
+
+    // a shared ring may have been written by anyone, never trust the size
+    uint32_t    length  = slot->size <= vr->valueSize ? slot->size : vr->valueSize;
+    memcpy(value, slot->value, length);
+    if( size ) {
+        *size   = length;
+    }
+    atomic_store_explicit(&slot->seq, first + vr->cap, memory_order_release);
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //                      Process Dispatcher Queue
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-typedef struct {
-    uint32_t         threadId;
-    ProcessQueue*    queue;
-} WorkerState;
+// a value is copied to the process buffer, valid until the next pop
+static inline
+void*
+popValue(Process* proc) {
+    if( proc->values && ValueRing_pop(proc->values, proc->valueBuffer, NULL) ) {
+        atomic_fetch_sub_explicit(&proc->valueCount, 1, memory_order_relaxed);
+        return proc->valueBuffer;
+    }
+    return NULL;
+}
+
+// pointers first: timers, the reactor and the nodes only send pointers
+#ifdef TCPM_LATENCY_HISTOGRAMS
+static inline
+void*
+popMessage(Worker* worker, Process* proc) {
+    uint64_t    stamp   = 0;
+    void*       msg     = BoundedQueue_popStamped(&proc->messageQueue, &stamp);
+    if( msg ) {
+        uint64_t    latency = monotonicNs() - stamp;
+        if( worker ) {
+            Histogram_record(&worker->mailboxLatency, latency);
+        }
+        if( proc->latencyHistogram ) {
+            Histogram_record(proc->latencyHistogram, latency);
+        }
+        return msg;
+    }
+    return popValue(proc);
+}
+#else
+static inline
+void*
+popMessage(Worker* worker, Process* proc) {
+    (void)worker;
+    void*       msg     = BoundedQueue_pop(&proc->messageQueue);
+    return msg ? msg : popValue(proc);
+}
+#endif
+
+#define VALUE_SLOT_ALIGN    8
+
+static inline
+size_t
+roundUp(size_t size, size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
+
+// ring, then the buffer on its own cache line. The memory of the previous
+// incarnation is reused when large enough. Introspection only reads
+// valueCount, never the ring, so an outgrown ring can be freed right away.
+static
+void
+valuesInit(Process* proc, uint32_t cap, uint32_t valueSize) {
+    atomic_store_explicit(&proc->valueCount, 0, memory_order_relaxed);
+    if( valueSize == 0 || cap == 0 ) {
+        proc->values        = NULL;
+        proc->valueBuffer   = NULL;
+        return;
+    }
+
+    size_t      bufferOffset    = roundUp(ValueRing_footprint(cap, valueSize, VALUE_SLOT_ALIGN), VALUE_RING_LINE);
+    size_t      footprint       = roundUp(bufferOffset + valueSize, VALUE_RING_LINE);
+    if( footprint > proc->valuesFootprint ) {
+        proc->values            = NULL;
+        free(proc->valuesMemory);
+        proc->valuesMemory      = aligned_alloc(VALUE_RING_LINE, footprint);
+        proc->valuesFootprint   = footprint;
+    }
+    proc->valueBuffer   = (char*)proc->valuesMemory + bufferOffset;
+    proc->values        = ValueRing_init(proc->valuesMemory, cap, valueSize, VALUE_SLOT_ALIGN);
+}
 
 static
 void
 processRelease(Process* proc) {
+    TRACE(proc->processQueue, (Worker*)pthread_getspecific(proc->processQueue->currentWorker), TE_RELEASE, proc, 0);
+    COUNT(proc->processQueue, (Worker*)pthread_getspecific(proc->processQueue->currentWorker), releases);
+    PROBE3(release, proc->id, proc->gen, BoundedQueue_size(&proc->messageQueue));
     spinLock(&proc->releaseLock);
+    // alive first: a snapshot reading the new gen must also see the process dead
+    atomic_store_explicit(&proc->alive, false, memory_order_release);
     atomic_fetch_add(&proc->gen, 1);
 
+    // before releaseState, which may close the watched fds
+    Reactor_dropWatches(proc->processQueue, proc);
     if( proc->releaseState ) {
         proc->releaseState(proc->state);
     }
@@ -178,10 +401,20 @@ processRelease(Process* proc) {
 
 static
 bool
-handleProcess(ProcessQueue* dq, Process* proc, void* msg) {
+handleProcess(ProcessQueue* dq, Worker* worker, Process* proc, void* msg) {
     pthread_setspecific(dq->currentProcess, proc); // set the current running actor
     assert( proc == pthread_getspecific(dq->currentProcess) );
-    switch( proc->handler(dq, proc->state, msg) ) {
+    if( msg ) {
+        COUNT(dq, worker, messagesHandled);
+    }
+    TRACE(dq, worker, TE_HANDLER_START, proc, proc->handler);
+    PROBE4(handler__entry, proc->id, proc->gen, proc->handler, BoundedQueue_size(&proc->messageQueue));
+    atomic_store_explicit(&worker->current, proc, memory_order_relaxed);
+    ProcessContinuation pct = proc->handler(dq, proc->state, msg);
+    atomic_store_explicit(&worker->current, NULL, memory_order_relaxed);
+    PROBE4(handler__exit, proc->id, proc->gen, proc->handler, (int)pct);
+    TRACE(dq, worker, TE_HANDLER_STOP, proc, pct);
+    switch( pct ) {
     case PCT_STOP:
         processRelease(proc);
         return false;
@@ -196,26 +429,51 @@ handleProcess(ProcessQueue* dq, Process* proc, void* msg) {
 
 static
 void*
-threadWorker(void* workerState_) {
-    WorkerState*     workerState = (WorkerState*)workerState_;
-    ProcessQueue*    dq          = workerState->queue;
+threadWorker(void* worker_) {
+    Worker*          worker      = (Worker*)worker_;
+    ProcessQueue*    dq          = worker->queue;
+
+    uint32_t         reactorTick = 0;
+
+    pthread_setspecific(dq->currentWorker, worker);
+    QUEUE_STAT( statsWorker = worker; )
+    Profile_attachWorker(worker);
+    atomic_store(&worker->tid, (pid_t)syscall(SYS_gettid));
 
     while( atomic_load_explicit((atomic_int*)&dq->state, memory_order_acquire) == DQS_RUNNING ) {
+        METRICS_TICK(dq, worker);
+        if( ++reactorTick >= REACTOR_POLL_INTERVAL ) {
+            reactorTick = 0;
+            Reactor_syncSignalMask(dq, worker);
+            Reactor_poll(dq);
+            Timer_advance(dq, worker, false);
+        }
         Process*    proc = (Process*)BoundedQueue_pop(&dq->runQueue);
         if( proc == NULL ) {
-            pthread_yield();
+            COUNT(dq, worker, idleLoops);
+            PROBE1(worker__idle, worker->threadId);
+            Reactor_syncSignalMask(dq, worker);
+            Reactor_poll(dq);
+            Timer_advance(dq, worker, true);
+            sched_yield();
         } else {
+            TRACE(dq, worker, TE_SCHEDULE, proc, 0);
             bool        pushActorBack   = true;
             uint32_t    msgCount        = 0;
             while( msgCount < proc->maxMessagePerCycle && pushActorBack ) {
                 if( proc->runningState == PS_RUNNING ) {
-                    pushActorBack       = handleProcess(dq, proc, NULL);
+                    pushActorBack       = handleProcess(dq, worker, proc, NULL);
                 } else {
                     assert( proc->runningState == PS_WAITING );
-                    void*   msg         = BoundedQueue_pop(&proc->messageQueue);
+                    void*   msg         = popMessage(worker, proc);
                     if( msg ) {
-                        pushActorBack   = handleProcess(dq, proc, msg);
+                        proc->deadline  = 0;
+                        pushActorBack   = handleProcess(dq, worker, proc, msg);
+                    } else if( proc->deadline && monotonicNs() >= proc->deadline ) {
+                        proc->deadline  = 0;
+                        pushActorBack   = handleProcess(dq, worker, proc, PROCESS_TIMEOUT);
                     } else {
+                        TRACE(dq, worker, TE_PARK, proc, 0);
                         break;
                     }
                 }
@@ -223,15 +481,18 @@ threadWorker(void* workerState_) {
             }
             if( pushActorBack ) {
                 while( BoundedQueue_push(&dq->runQueue, proc) == false ) {
-                    pthread_yield();
+                    sched_yield();
                 }
             } else {    // actor died
                 atomic_fetch_sub(&dq->procCount, 1);
             }
+            // hand the I/O requests of this cycle to the kernel in one batch
+            if( atomic_load_explicit(&dq->io.stagedCount, memory_order_relaxed) ) {
+                Reactor_poll(dq);
+            }
         }
     }
 
-    free(workerState);
     return NULL;
 }
 
@@ -244,21 +505,47 @@ ProcessQueue_init(uint32_t procCap, uint32_t threadCount) {
     dq->threads     = (pthread_t*)calloc(threadCount, sizeof(pthread_t));
     BoundedQueue_init(&dq->runQueue, procCap, (ElementRelease)processRelease);
     pthread_key_create(&dq->currentProcess, NULL);
+    pthread_key_create(&dq->currentWorker, NULL);
+    dq->workers     = (Worker*)calloc(threadCount, sizeof(Worker));
     dq->processes   = (Process*)calloc(procCap, sizeof(Process));
     dq->state       = DQS_RUNNING;
     BoundedQueue_init(&dq->procPool, procCap, NULL);
+#ifdef TCPM_QUEUE_STATS
+    dq->runQueue.statsQueue = dq;
+    dq->runQueue.statsKind  = QS_RUN_QUEUE;
+    dq->procPool.statsQueue = dq;
+    dq->procPool.statsKind  = QS_PROCESS_POOL;
+#endif
 
     for( uint32_t p = 0; p < procCap; ++p ) {
         dq->processes[p].id = p;
+        atomic_store_explicit(&dq->processes[p].watchedFds, -1, memory_order_relaxed);
         atomic_store_explicit(&dq->processes[p].gen, 0, memory_order_release);
         BoundedQueue_push(&dq->procPool, &dq->processes[p]);
     }
 
     atomic_store(&dq->procCount, 0);
+#ifdef TCPM_METRICS
+    Metrics_init(dq);
+#endif
+#ifdef TCPM_TRACE
+    TraceRing_init(&dq->externalTrace);
+    dq->traceStartTicks = readTicks();
+    dq->traceStartNs    = monotonicNs();
+#endif
+    for( uint32_t threadId = 0; threadId < threadCount; ++threadId ) {
+        dq->workers[threadId].threadId  = threadId;
+        dq->workers[threadId].queue     = dq;
+    }
+    Log_init(dq);
+    Reactor_init(dq);
+    Timer_init(dq);
+    Coroutine_init(dq);
     for( uint32_t threadId = 0; threadId < threadCount; ++threadId ) {
-        WorkerState*    ws  = (WorkerState*)calloc(1, sizeof(WorkerState));
-        ws->threadId    = threadId;
-        ws->queue       = dq;
+        Worker*         ws  = &dq->workers[threadId];
+#ifdef TCPM_TRACE
+        TraceRing_init(&ws->trace);
+#endif
         if( pthread_create(&dq->threads[threadId], NULL, threadWorker, ws) != 0 ) {
             fprintf(stderr, "Fatal Error: unable to create thread!\n");
             exit(1);
@@ -270,72 +557,180 @@ ProcessQueue_init(uint32_t procCap, uint32_t threadCount) {
 
 void
 ProcessQueue_release(ProcessQueue* dq) {
-    if( atomic_load_explicit((atomic_int*)&dq->state, memory_order_acquire) == DQS_RUNNING ) {
+    bool    running = atomic_load_explicit((atomic_int*)&dq->state, memory_order_acquire) == DQS_RUNNING;
+    if( running ) {
         atomic_store_explicit((atomic_int*)&dq->state, DQS_STOPPED, memory_order_release);
         // wait on the threads to exit
         for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
             pthread_join(dq->threads[threadId], NULL);
         }
-
+    }
+    // in-flight requests write into buffers of the processes: cancel them first
+    Io_release(dq);
+    if( running ) {
         // now free the actors/messages
         BoundedQueue_release(&dq->runQueue);
     }
+    Log_release(dq);
+    Reactor_release(dq);
+    Timer_release(dq);
+    Coroutine_release(dq);
     BoundedQueue_release(&dq->procPool);
+    Profile_release(dq);
+#ifdef TCPM_METRICS
+    Metrics_release(dq);
+#endif
+#ifdef TCPM_TRACE
+    for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
+        TraceRing_release(&dq->workers[threadId].trace);
+    }
+    TraceRing_release(&dq->externalTrace);
+#endif
+    for( uint32_t p = 0; p < dq->processCap; ++p ) {
+        free(dq->processes[p].valuesMemory);
+    }
     free(dq->threads);
+    free(dq->workers);
     free(dq->processes);
     free(dq);
 }
 
-SendResult
-Process_sendMessage(PID dest, void* message, MessageAction ma) {
+// Take the release lock of dest if it is still alive. We have to handle
+// nasty situations here:
+//
+// 1. we are trying to write while the process is dying:
+//    X = genId
+//    actor dies
+//    push message
+//    actor revived
+//    new actor consumes wrong message
+//    send returns SUCCESS
+//
+// 2. we are trying to write while the process is dying:
+//    X = genId
+//    actor dies
+//    push message
+//    send returns SUCCESS, but message never processed (lesser evil)
+//
+// we need a release lock (until another better method is found). Returns NULL
+// and the result of the send if the process is dead or being released.
+static inline
+Process*
+lockDestination(PID dest, SendResult* result) {
     ProcessQueue*   destPQ      = dest.pq;
     Process*        destProc    = &destPQ->processes[dest.id];
 
-    // We have to handle nasty situations here:
-    //
-    // 1. we are trying to write while the process is dying:
-    //    X = genId
-    //    actor dies
-    //    push message
-    //    actor revived
-    //    new actor consumes wrong message
-    //    send returns SUCCESS
-    //
-    // 2. we are trying to write while the process is dying:
-    //    X = genId
-    //    actor dies
-    //    push message
-    //    send returns SUCCESS, but message never processed (lesser evil)
-    //
-    // we need a release lock (until another better method is found)
-    if( tryLock(&destProc->releaseLock) ) {
-        if( dest.gen != destProc->gen ) {
-            unlock(&destProc->releaseLock);
-            return ACTOR_IS_DEAD;
-        }
+    if( !tryLock(&destProc->releaseLock) ) {
+        TRACE(destPQ, (Worker*)pthread_getspecific(destPQ->currentWorker), TE_SEND_FAIL, destProc, 0);
+        PROBE5(send, dest.id, dest.gen, (int)SEND_FAIL, 0, 1);
+        COUNT(destPQ, (Worker*)pthread_getspecific(destPQ->currentWorker), sendBusy);
+        *result     = SEND_FAIL;
+        return NULL;
+    }
+    if( dest.gen != destProc->gen ) {
+        unlock(&destProc->releaseLock);
+        COUNT(destPQ, (Worker*)pthread_getspecific(destPQ->currentWorker), sendDead);
+        PROBE5(send, dest.id, dest.gen, (int)ACTOR_IS_DEAD, 0, 0);
+        *result     = ACTOR_IS_DEAD;
+        return NULL;
+    }
+    return destProc;
+}
 
-        if( BoundedQueue_push(&destProc->messageQueue, message) ) {
-            unlock(&destProc->releaseLock);
-            return SEND_SUCCESS;
-        } else {
-            switch(ma) {
-            case MA_KEEP: break;
-            case MA_REMOVE:
-                destProc->messageQueue.elementRelease(message);
-            }
-            unlock(&destProc->releaseLock);
-            return SEND_FAIL;
-        }
+// probe arguments only: the mailbox is not read when probes are compiled out
+#define MAILBOX_SIZE(proc, byValue)     ((byValue) ? ValueRing_size((proc)->values) : BoundedQueue_size(&(proc)->messageQueue))
+#define MAILBOX_CAP(proc, byValue)      ((byValue) ? (proc)->values->cap : (proc)->messageQueue.cap)
+
+// a push to the mailbox (or value ring) of a locked destination, unlocks it
+static inline
+SendResult
+sendPushed(PID dest, Process* destProc, bool pushed, bool byValue) {
+    ProcessQueue*   destPQ      = dest.pq;
+    (void)destPQ;   // probes and counters may be compiled out
+    (void)byValue;
+    if( pushed ) {
+        PROBE5(send, dest.id, dest.gen, (int)SEND_SUCCESS, MAILBOX_SIZE(destProc, byValue), 0);
+        unlock(&destProc->releaseLock);
+        COUNT(destPQ, (Worker*)pthread_getspecific(destPQ->currentWorker), sends);
+        return SEND_SUCCESS;
     } else {
-        //fprintf(stderr, ".");
+        TRACE(destPQ, (Worker*)pthread_getspecific(destPQ->currentWorker), TE_SEND_FAIL, destProc, 1);
+        PROBE5(send, dest.id, dest.gen, (int)SEND_FAIL, MAILBOX_CAP(destProc, byValue), 0);
+        unlock(&destProc->releaseLock);
+        COUNT(destPQ, (Worker*)pthread_getspecific(destPQ->currentWorker), sendFull);
         return SEND_FAIL;
     }
 }
 
+SendResult
+Process_sendMessage(PID dest, void* message, MessageAction ma) {
+    if( dest.node ) {
+        return Node_send(dest, message, ma);
+    }
+
+    SendResult  res         = SEND_FAIL;
+    Process*    destProc    = lockDestination(dest, &res);
+    if( destProc == NULL ) {
+        return res;
+    }
+
+    bool        pushed      = BoundedQueue_push(&destProc->messageQueue, message);
+    if( !pushed && ma == MA_REMOVE ) {
+        destProc->messageQueue.elementRelease(message);
+    }
+    return sendPushed(dest, destProc, pushed, false);
+}
+
+SendResult
+Process_sendValue(PID dest, const void* value, uint32_t size) {
+    if( dest.node ) {
+        return SEND_UNSUPPORTED;    // values have no serializer, see Process_sendMessage
+    }
+
+    // the ring is reinitialized on respawn: same locking as Process_sendMessage
+    SendResult  res         = SEND_FAIL;
+    Process*    destProc    = lockDestination(dest, &res);
+    if( destProc == NULL ) {
+        return res;
+    }
+
+    ValueRing*  values      = destProc->values;
+    if( values == NULL || size > values->valueSize ) {
+        unlock(&destProc->releaseLock);
+        PROBE5(send, dest.id, dest.gen, (int)SEND_UNSUPPORTED, 0, 0);
+        return SEND_UNSUPPORTED;
+    }
+
+    // counted before the push: a receiver may pop it before we are back
+    atomic_fetch_add_explicit(&destProc->valueCount, 1, memory_order_relaxed);
+    bool        pushed      = ValueRing_push(values, value, size);
+    if( !pushed ) {
+        atomic_fetch_sub_explicit(&destProc->valueCount, 1, memory_order_relaxed);
+    }
+    return sendPushed(dest, destProc, pushed, true);
+}
+
 void*
 Process_receiveMessage(ProcessQueue* dq) {
     Process*    proc    = (Process*)pthread_getspecific(dq->currentProcess);
-    return BoundedQueue_pop(&proc->messageQueue);
+    return popMessage((Worker*)pthread_getspecific(dq->currentWorker), proc);
+}
+
+bool
+Process_receiveValue(ProcessQueue* dq, void* value, uint32_t size) {
+    Process*    proc    = (Process*)pthread_getspecific(dq->currentProcess);
+    if( proc->values == NULL || size < proc->values->valueSize
+     || !ValueRing_pop(proc->values, value, NULL) ) {
+        return false;
+    }
+    atomic_fetch_sub_explicit(&proc->valueCount, 1, memory_order_relaxed);
+    return true;
+}
+
+void*
+Process_valueBuffer(ProcessQueue* dq) {
+    Process*    proc    = (Process*)pthread_getspecific(dq->currentProcess);
+    return proc->valueBuffer;
 }
 
 PID
@@ -359,24 +754,40 @@ ProcessQueue_spawn(ProcessQueue* dq, ProcessSpawnParameters* parameters) {
 
         // TODO: contention point
         while( (proc = (Process*)BoundedQueue_pop(&dq->procPool)) == NULL ) {
-            pthread_yield();
+            sched_yield();
         }
 
         Process*    parent  = (Process*)pthread_getspecific(dq->currentProcess);
-        atomic_store(&proc->releaseLock, false);
+        // do not reset releaseLock: processRelease left it unlocked, but a
+        // sender holding a stale PID may own it right now to check the gen
         proc->parent        = parent;
+        proc->parentGen     = parent ? atomic_load(&parent->gen) : 0;
         proc->processQueue  = dq;
         proc->handler       = parameters->handler;
         proc->releaseState  = parameters->releaseState;
         proc->state         = parameters->initialState;
         proc->runningState  = PS_RUNNING;
+        proc->latencyHistogram  = parameters->latencyHistogram;
+        proc->deadline          = 0;
         proc->maxMessagePerCycle   = (parameters->messageCap > parameters->maxMessagePerCycle) ? parameters->maxMessagePerCycle :  parameters->messageCap;
         BoundedQueue_init(&proc->messageQueue, parameters->messageCap, parameters->messageRelease);
+        valuesInit(proc, parameters->messageCap, parameters->messageSize);
+#ifdef TCPM_LATENCY_HISTOGRAMS
+        proc->messageQueue.timestamped  = true;
+#endif
+#ifdef TCPM_QUEUE_STATS
+        proc->messageQueue.statsQueue   = dq;
+        proc->messageQueue.statsKind    = QS_MAILBOXES;
+#endif
+        TRACE(dq, (Worker*)pthread_getspecific(dq->currentWorker), TE_SPAWN, proc, parent ? parent->id : UINT64_MAX);
+        PROBE4(spawn, proc->id, proc->gen, proc->handler, parent ? parent->id : UINT64_MAX);
+        COUNT(dq, (Worker*)pthread_getspecific(dq->currentWorker), spawns);
+        atomic_store_explicit(&proc->alive, true, memory_order_release);
 
         // TODO: contention point
         while( BoundedQueue_push(&dq->runQueue, proc) == false ) {
             // other threads are hanging before writing the el->seq, yield
-            pthread_yield();
+            sched_yield();
         }
 
         return (PID){ .pq = dq, .id = proc->id, .gen = proc->gen };
@@ -390,3 +801,37 @@ ProcessQueue_spawn(ProcessQueue* dq, ProcessSpawnParameters* parameters) {
         return (PID){ .pq = NULL, .id = 0, .gen = 0 };
     }
 }
+
+bool
+ProcessQueue_mailboxLatency(ProcessQueue* dq, Histogram* out) {
+    Histogram_init(out);
+#ifdef TCPM_LATENCY_HISTOGRAMS
+    for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
+        Histogram_merge(out, &dq->workers[threadId].mailboxLatency);
+    }
+    return true;
+#else
+    (void)dq;
+    return false;
+#endif
+}
+
+bool
+ProcessQueue_queueStats(ProcessQueue* dq, QueueStatsKind kind, QueueStats* out) {
+#ifdef TCPM_QUEUE_STATS
+    memset(out, 0, sizeof(QueueStats));
+    uint64_t*   dst = (uint64_t*)out;
+    for( uint32_t threadId = 0; threadId <= dq->threadCount; ++threadId ) {
+        QueueStats* src = threadId < dq->threadCount ? &dq->workers[threadId].queueStats[kind] : &dq->externalQueueStats[kind];
+        for( size_t c = 0; c < sizeof(QueueStats) / sizeof(uint64_t); ++c ) {
+            dst[c] += atomic_load_explicit((atomic_uint64_t*)&((uint64_t*)src)[c], memory_order_relaxed);
+        }
+    }
+    return true;
+#else
+    (void)dq;
+    (void)kind;
+    memset(out, 0, sizeof(QueueStats));
+    return false;
+#endif
+}
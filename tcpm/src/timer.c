@@ -0,0 +1,292 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <string.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Timers: sharded hierarchical timing wheel
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// handle: generation (20 bits) | shard (12 bits) | node index (32 bits)
+#define HANDLE_GEN_BITS     20
+#define HANDLE_SHARD_BITS   12
+#define HANDLE_GEN_MASK     ((1u << HANDLE_GEN_BITS) - 1)
+#define HANDLE_SHARD_MASK   ((1u << HANDLE_SHARD_BITS) - 1)
+
+// the holder may be a preempted worker firing a slot: yield rather than spin
+static inline
+void
+lockShard(TimerShard* shard) {
+    while( !tryLock(&shard->lock) ) {
+        sched_yield();
+    }
+}
+
+static inline
+uint64_t
+currentTick(ProcessQueue* dq) {
+    return (monotonicNs() - dq->timerStartNs) / TIMER_TICK_NS;
+}
+
+void
+Timer_init(ProcessQueue* dq) {
+    uint32_t    shards  = dq->threadCount + 1;
+    dq->timers          = (TimerShard*)calloc(shards, sizeof(TimerShard));
+    dq->timerStartNs    = monotonicNs();
+    for( uint32_t s = 0; s < shards; ++s ) {
+        memset(dq->timers[s].heads, 0xff, sizeof(dq->timers[s].heads));
+        dq->timers[s].freeHead  = TIMER_NIL;
+    }
+}
+
+void
+Timer_release(ProcessQueue* dq) {
+    // armed timers will never be delivered
+    for( uint32_t s = 0; s <= dq->threadCount; ++s ) {
+        TimerShard* shard   = &dq->timers[s];
+        for( uint32_t idx = 0; idx < shard->nodeCap; ++idx ) {
+            if( shard->nodes[idx].slot != TIMER_NIL && shard->nodes[idx].release ) {
+                shard->nodes[idx].release(shard->nodes[idx].message);
+            }
+        }
+        free(shard->nodes);
+    }
+    free(dq->timers);
+    dq->timers  = NULL;
+}
+
+// level: highest byte in which the expiry and the current tick differ, the
+// node is cascaded down when the wheel reaches the start of its slot
+static
+void
+linkNode(TimerShard* shard, uint32_t idx) {
+    TimerNode*  node    = &shard->nodes[idx];
+    uint64_t    diff    = node->expiry ^ shard->now;
+    uint32_t    level   = 0;
+    // beyond the wheel range, the node lands in a last level slot that comes
+    // around before its expiry, and is cascaded there again
+    while( level < TIMER_LEVELS - 1 && (diff >> (TIMER_SLOT_BITS * (level + 1))) != 0 ) {
+        ++level;
+    }
+    uint32_t    slot    = level * TIMER_SLOTS + (uint32_t)((node->expiry >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+    node->slot  = slot;
+    node->prev  = TIMER_NIL;
+    node->next  = shard->heads[slot];
+    if( node->next != TIMER_NIL ) {
+        shard->nodes[node->next].prev   = idx;
+    }
+    shard->heads[slot]  = idx;
+}
+
+static
+void
+unlinkNode(TimerShard* shard, uint32_t idx) {
+    TimerNode*  node    = &shard->nodes[idx];
+    if( node->prev != TIMER_NIL ) {
+        shard->nodes[node->prev].next   = node->next;
+    } else {
+        shard->heads[node->slot]        = node->next;
+    }
+    if( node->next != TIMER_NIL ) {
+        shard->nodes[node->next].prev   = node->prev;
+    }
+}
+
+static
+uint32_t
+allocNode(TimerShard* shard) {
+    if( shard->freeHead == TIMER_NIL ) {
+        uint32_t    cap     = shard->nodeCap ? shard->nodeCap * 2 : 1024;
+        shard->nodes        = (TimerNode*)realloc(shard->nodes, cap * sizeof(TimerNode));
+        for( uint32_t n = shard->nodeCap; n < cap; ++n ) {
+            shard->nodes[n].slot    = TIMER_NIL;
+            shard->nodes[n].gen     = 1;
+            shard->nodes[n].next    = n + 1 < cap ? n + 1 : TIMER_NIL;
+        }
+        shard->freeHead     = shard->nodeCap;
+        shard->nodeCap      = cap;
+    }
+    uint32_t    idx = shard->freeHead;
+    shard->freeHead = shard->nodes[idx].next;
+    return idx;
+}
+
+static
+void
+freeNode(TimerShard* shard, uint32_t idx) {
+    TimerNode*  node    = &shard->nodes[idx];
+    node->slot      = TIMER_NIL;
+    node->message   = NULL;
+    node->release   = NULL;
+    node->gen       = (node->gen + 1) & HANDLE_GEN_MASK;
+    if( node->gen == 0 ) {
+        node->gen   = 1;
+    }
+    node->next      = shard->freeHead;
+    shard->freeHead = idx;
+}
+
+// detach a slot list, to fire or to cascade its nodes
+static
+uint32_t
+takeSlot(TimerShard* shard, uint32_t slot) {
+    uint32_t    head    = shard->heads[slot];
+    shard->heads[slot]  = TIMER_NIL;
+    return head;
+}
+
+static
+void
+fireSlot(TimerShard* shard, uint32_t slot) {
+    uint32_t    idx = takeSlot(shard, slot);
+    while( idx != TIMER_NIL ) {
+        TimerNode*  node    = &shard->nodes[idx];
+        uint32_t    next    = node->next;
+        SendResult  res     = Process_sendMessage(node->dest, node->message, MA_KEEP);
+        if( res == SEND_FAIL ) {
+            // full or busy mailbox: try again on the next tick
+            node->expiry    = shard->now + 1;
+            linkNode(shard, idx);
+        } else {
+            if( res != SEND_SUCCESS && node->release ) {
+                node->release(node->message);   // the destination died
+            }
+            freeNode(shard, idx);
+            atomic_fetch_sub_explicit(&shard->count, 1, memory_order_relaxed);
+        }
+        idx = next;
+    }
+}
+
+static
+void
+advanceShard(TimerShard* shard, uint64_t target) {
+    while( shard->now < target ) {
+        if( atomic_load_explicit(&shard->count, memory_order_relaxed) == 0 ) {
+            shard->now  = target;
+            break;
+        }
+        ++shard->now;
+        // cascade from the top, a node may move down several levels at once
+        for( uint32_t level = TIMER_LEVELS - 1; level > 0; --level ) {
+            if( (shard->now & ((1ull << (TIMER_SLOT_BITS * level)) - 1)) == 0 ) {
+                uint32_t    idx = takeSlot(shard, level * TIMER_SLOTS + (uint32_t)((shard->now >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1)));
+                while( idx != TIMER_NIL ) {
+                    uint32_t    next    = shard->nodes[idx].next;
+                    linkNode(shard, idx);
+                    idx = next;
+                }
+            }
+        }
+        fireSlot(shard, (uint32_t)(shard->now & (TIMER_SLOTS - 1)));
+    }
+}
+
+void
+Timer_advance(ProcessQueue* dq, Worker* worker, bool idle) {
+    uint64_t    target  = 0;
+    for( uint32_t s = 0; s <= dq->threadCount; ++s ) {
+        // busy workers only take care of their own shard and the external one
+        if( !idle && s != worker->threadId && s != dq->threadCount ) {
+            continue;
+        }
+        TimerShard* shard   = &dq->timers[s];
+        if( atomic_load_explicit(&shard->count, memory_order_relaxed) == 0 || !tryLock(&shard->lock) ) {
+            continue;
+        }
+        if( target == 0 ) {
+            target  = currentTick(dq);
+        }
+        advanceShard(shard, target);
+        unlock(&shard->lock);
+    }
+}
+
+TimerHandle
+Process_sendAfter(PID dest, uint64_t delayNs, void* message, MessageRelease release) {
+    ProcessQueue*   dq      = dest.pq;
+    if( dq == NULL ) {
+        return 0;
+    }
+    Worker*         worker  = (Worker*)pthread_getspecific(dq->currentWorker);
+    uint32_t        s       = worker ? worker->threadId : dq->threadCount;
+    TimerShard*     shard   = &dq->timers[s];
+    uint64_t        elapsed = monotonicNs() - dq->timerStartNs;
+    uint64_t        now     = elapsed / TIMER_TICK_NS;
+    // first tick starting at or after the due time, timers never fire early
+    uint64_t        expiry  = (elapsed + delayNs + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+
+    lockShard(shard);
+    if( atomic_load_explicit(&shard->count, memory_order_relaxed) == 0 ) {
+        shard->now  = now;      // nothing to process in between
+    }
+    uint32_t    idx     = allocNode(shard);
+    TimerNode*  node    = &shard->nodes[idx];
+    node->expiry    = expiry;
+    if( node->expiry <= shard->now ) {
+        node->expiry    = shard->now + 1;
+    }
+    node->dest      = dest;
+    node->message   = message;
+    node->release   = release;
+    linkNode(shard, idx);
+    atomic_fetch_add_explicit(&shard->count, 1, memory_order_relaxed);
+    TimerHandle handle  = ((uint64_t)node->gen << 44) | ((uint64_t)(s & HANDLE_SHARD_MASK) << 32) | idx;
+    unlock(&shard->lock);
+    return handle;
+}
+
+bool
+Process_cancelTimer(ProcessQueue* dq, TimerHandle timer) {
+    uint32_t    s       = (uint32_t)(timer >> 32) & HANDLE_SHARD_MASK;
+    uint32_t    gen     = (uint32_t)(timer >> 44) & HANDLE_GEN_MASK;
+    uint32_t    idx     = (uint32_t)timer;
+    if( timer == 0 || s > dq->threadCount ) {
+        return false;
+    }
+
+    TimerShard* shard       = &dq->timers[s];
+    bool        cancelled   = false;
+    lockShard(shard);
+    if( idx < shard->nodeCap && shard->nodes[idx].slot != TIMER_NIL && shard->nodes[idx].gen == gen ) {
+        unlinkNode(shard, idx);
+        freeNode(shard, idx);
+        atomic_fetch_sub_explicit(&shard->count, 1, memory_order_relaxed);
+        cancelled   = true;
+    }
+    unlock(&shard->lock);
+    return cancelled;
+}
+
+void
+Process_receiveTimeout(ProcessQueue* dq, uint64_t timeoutNs) {
+    Process*    proc    = (Process*)pthread_getspecific(dq->currentProcess);
+    if( proc ) {
+        proc->deadline  = monotonicNs() + timeoutNs;
+    }
+}
@@ -0,0 +1,140 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//         Scheduling event tracer (Chrome trace / Perfetto JSON export)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef TCPM_TRACE
+
+static const char* eventNames[] = {
+    [TE_SPAWN]          = "spawn",
+    [TE_SCHEDULE]       = "schedule",
+    [TE_HANDLER_START]  = "handler",
+    [TE_HANDLER_STOP]   = "handler",
+    [TE_PARK]           = "park",
+    [TE_SEND_FAIL]      = "send-fail",
+    [TE_RELEASE]        = "release",
+};
+
+void
+TraceRing_init(TraceRing* ring) {
+    atomic_store_explicit(&ring->head, 0, memory_order_release);
+    ring->events    = (TraceEvent*)calloc(TCPM_TRACE_RING_SIZE, sizeof(TraceEvent));
+}
+
+void
+TraceRing_release(TraceRing* ring) {
+    free(ring->events);
+    ring->events    = NULL;
+}
+
+static
+bool
+dumpRing(FILE* out, TraceRing* ring, uint32_t tid, uint64_t startTicks, double nsPerTick, bool first) {
+    uint64_t    head    = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t    tail    = head > TCPM_TRACE_RING_SIZE ? head - TCPM_TRACE_RING_SIZE : 0;
+    bool        inHandler   = false;
+
+    for( uint64_t i = tail; i < head; ++i ) {
+        TraceEvent* slot    = &ring->events[i & (TCPM_TRACE_RING_SIZE - 1)];
+        uint64_t    seq     = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        TraceEvent  ev;
+        ev.ticks    = slot->ticks;
+        ev.id       = slot->id;
+        ev.gen      = slot->gen;
+        ev.arg      = slot->arg;
+        ev.type     = slot->type;
+        atomic_thread_fence(memory_order_acquire);
+        // not written yet (external ring), or rewritten while we were copying
+        if( seq != i + 1 || atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq ) {
+            continue;
+        }
+        // the writer lapped us: at head - i == size it is already writing slot i
+        if( atomic_load_explicit(&ring->head, memory_order_acquire) - i >= TCPM_TRACE_RING_SIZE ) {
+            continue;
+        }
+
+        const char* phase   = "i";
+        if( ev.type == TE_HANDLER_START ) {
+            phase       = "B";
+            inHandler   = true;
+        } else if( ev.type == TE_HANDLER_STOP ) {
+            // the matching start was overwritten
+            if( !inHandler ) { continue; }
+            phase       = "E";
+            inHandler   = false;
+        }
+
+        double  us  = (double)(int64_t)(ev.ticks - startTicks) * nsPerTick / 1000.0;
+        fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%" PRIu32,
+                first ? "" : ",", eventNames[ev.type], phase, us, tid);
+        if( phase[0] == 'i' ) {
+            fprintf(out, ",\"s\":\"t\"");
+        }
+        fprintf(out, ",\"args\":{\"id\":%" PRIu64 ",\"gen\":%" PRIu64 ",\"arg\":%" PRIu64 "}}", ev.id, ev.gen, ev.arg);
+        first   = false;
+    }
+    return first;
+}
+
+bool
+ProcessQueue_traceDump(ProcessQueue* dq, FILE* out) {
+    // calibrate ticks against the monotonic clock over the lifetime of the queue
+    uint64_t    ticks   = readTicks() - dq->traceStartTicks;
+    uint64_t    ns      = monotonicNs() - dq->traceStartNs;
+    double      nsPerTick   = ticks ? (double)ns / (double)ticks : 1.0;
+
+    bool        first   = true;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for( uint32_t threadId = 0; threadId < dq->threadCount; ++threadId ) {
+        fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32 ",\"args\":{\"name\":\"worker %" PRIu32 "\"}}",
+                first ? "" : ",", threadId, threadId);
+        first   = false;
+        first   = dumpRing(out, &dq->workers[threadId].trace, threadId, dq->traceStartTicks, nsPerTick, first);
+    }
+    fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32 ",\"args\":{\"name\":\"external\"}}", dq->threadCount);
+    dumpRing(out, &dq->externalTrace, dq->threadCount, dq->traceStartTicks, nsPerTick, false);
+    fprintf(out, "\n]}\n");
+    return true;
+}
+
+#else
+
+bool
+ProcessQueue_traceDump(ProcessQueue* dq, FILE* out) {
+    (void)dq;
+    (void)out;
+    return false;
+}
+
+#endif
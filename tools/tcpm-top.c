@@ -0,0 +1,163 @@
+/*
+    Tiny Cooperative Process Management library
+    Copyright (C) 2018  Wael El Oraiby
+
+    All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tcpm_metrics.h>
+
+// tcpm-top: live view of the metrics segment published by a process queue
+// built with TCPM_METRICS
+//
+// usage: tcpm-top [segment name] [refresh interval in ms]
+
+#define COUNTER_COUNT   (sizeof(ProcessQueueCounters) / sizeof(uint64_t))
+
+static const char* counterNames[COUNTER_COUNT] = {
+    "spawns", "releases", "messages handled", "sends", "send full", "send busy", "send dead", "idle loops",
+};
+
+static
+bool
+findSegment(char* name, size_t size) {
+    DIR*            dir = opendir("/dev/shm");
+    struct dirent*  ent = NULL;
+    bool            found   = false;
+    if( dir == NULL ) {
+        return false;
+    }
+    while( !found && (ent = readdir(dir)) ) {
+        if( strncmp(ent->d_name, "tcpm.", 5) == 0 ) {
+            snprintf(name, size, "/%s", ent->d_name);
+            found   = true;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+static
+void
+sumCounters(const MetricsSegment* seg, uint32_t slot, ProcessQueueCounters* out) {
+    const uint64_t* src = (const uint64_t*)&seg->workers[slot].counters;
+    uint64_t*       dst = (uint64_t*)out;
+    for( size_t c = 0; c < COUNTER_COUNT; ++c ) {
+        dst[c] += src[c];
+    }
+}
+
+int
+main(int argc, char** argv) {
+    char        name[256];
+    uint32_t    intervalMs  = 1000;
+
+    if( argc > 1 ) {
+        snprintf(name, sizeof(name), "%s%s", argv[1][0] == '/' ? "" : "/", argv[1]);
+    } else if( !findSegment(name, sizeof(name)) ) {
+        fprintf(stderr, "tcpm-top: no tcpm metrics segment found in /dev/shm\n");
+        return 1;
+    }
+    if( argc > 2 ) {
+        intervalMs  = (uint32_t)atoi(argv[2]);
+    }
+
+    int fd  = shm_open(name, O_RDONLY, 0);
+    struct stat st;
+    if( fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MetricsSegment) ) {
+        fprintf(stderr, "tcpm-top: unable to open %s\n", name);
+        return 1;
+    }
+    const MetricsSegment*   seg = (const MetricsSegment*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if( seg == MAP_FAILED || seg->magic != METRICS_MAGIC || seg->version != METRICS_VERSION
+     || (size_t)st.st_size < sizeof(MetricsSegment) + (seg->threadCount + 1) * sizeof(WorkerMetrics) ) {
+        fprintf(stderr, "tcpm-top: %s is not a tcpm metrics segment (version %u)\n", name, METRICS_VERSION);
+        return 1;
+    }
+
+    uint32_t                threadCount = seg->threadCount;
+    ProcessQueueCounters    previous;
+    ProcessQueueCounters*   previousWorkers = (ProcessQueueCounters*)calloc(threadCount, sizeof(ProcessQueueCounters));
+    Histogram*              latency     = (Histogram*)malloc(sizeof(Histogram));
+    struct timespec         sleep       = { .tv_sec = intervalMs / 1000, .tv_nsec = (intervalMs % 1000) * 1000000L };
+    uint64_t                previousNs  = 0;
+    memset(&previous, 0, sizeof(previous));
+
+    while( kill((pid_t)seg->pid, 0) == 0 ) {
+        uint64_t                publishNs   = seg->publishNs;
+        double                  elapsed     = previousNs ? (double)(publishNs - previousNs) / 1e9 : 0.0;
+        ProcessQueueCounters    total;
+        memset(&total, 0, sizeof(total));
+        Histogram_init(latency);
+        for( uint32_t slot = 0; slot <= threadCount; ++slot ) {
+            sumCounters(seg, slot, &total);
+            Histogram_merge(latency, &seg->workers[slot].mailboxLatency);
+        }
+
+        printf("\033[H\033[2J");
+        printf("tcpm-top  %s  pid %" PRIu32 "  workers %" PRIu32 "  processes %" PRIu64 "/%" PRIu32 "  run queue %" PRIu64 "\n\n",
+               name, seg->pid, threadCount, seg->processCount, seg->processCap, seg->runQueueDepth);
+        printf("%-18s %16s %14s\n", "", "total", "rate/s");
+        for( size_t c = 0; c < COUNTER_COUNT; ++c ) {
+            uint64_t    value   = ((uint64_t*)&total)[c];
+            uint64_t    delta   = value - ((uint64_t*)&previous)[c];
+            printf("%-18s %16" PRIu64 " %14.0f\n", counterNames[c], value, elapsed > 0 ? (double)delta / elapsed : 0.0);
+        }
+
+        printf("\nmailbox latency (ns)  count %" PRIu64 "  mean %.0f  p50 %" PRIu64 "  p99 %" PRIu64 "  p99.9 %" PRIu64 "  max %" PRIu64 "\n",
+               Histogram_count(latency), Histogram_mean(latency), Histogram_percentile(latency, 50.0),
+               Histogram_percentile(latency, 99.0), Histogram_percentile(latency, 99.9), Histogram_max(latency));
+
+        printf("\n%-8s %14s %14s %14s\n", "worker", "handled/s", "sends/s", "idle loops/s");
+        for( uint32_t w = 0; w < threadCount; ++w ) {
+            const ProcessQueueCounters* c   = &seg->workers[w].counters;
+            ProcessQueueCounters*       p   = &previousWorkers[w];
+            printf("%-8" PRIu32 " %14.0f %14.0f %14.0f\n", w,
+                   elapsed > 0 ? (double)(c->messagesHandled - p->messagesHandled) / elapsed : 0.0,
+                   elapsed > 0 ? (double)(c->sends - p->sends) / elapsed : 0.0,
+                   elapsed > 0 ? (double)(c->idleLoops - p->idleLoops) / elapsed : 0.0);
+            *p  = *c;
+        }
+        fflush(stdout);
+
+        previous    = total;
+        previousNs  = publishNs;
+        nanosleep(&sleep, NULL);
+    }
+
+    printf("\ntcpm-top: process %" PRIu32 " exited\n", seg->pid);
+    free(latency);
+    free(previousWorkers);
+    return 0;
+}